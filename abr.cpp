@@ -0,0 +1,160 @@
+#include <climits>
+#include <algorithm>
+
+#include "abr.h"
+
+// rendition heights commonly found in HLS/DASH ladders
+static const int ladder[] = { 240, 360, 480, 720, 1080, 1440, ABR_LADDER_TOP };
+#define LADDER_STEPS (int)(sizeof ladder / sizeof *ladder)
+
+static struct _abr {
+    unsigned int window_start;
+    float need;                        // largest of the window
+    bool counted;                      // frames, dropped hold a window start
+    unsigned long long frames, dropped;
+    int cap;                           // lines, 0 uncapped
+    int pending;                       // cap the last windows asked for
+    int pending_windows;
+    unsigned int last_change;
+    unsigned int drop_until;           // no raising before
+    unsigned int now;
+
+    // report
+    unsigned int changes, drop_changes;
+    unsigned int cap_since;
+    unsigned long long cap_ms[LADDER_STEPS + 1]; // per step, uncapped last
+} abr;
+
+// 0 reads as no limit
+static int limit(int cap)
+{
+    return cap ? cap : INT_MAX;
+}
+
+static int step_index(int cap)
+{
+    for (int i = 0; i < LADDER_STEPS; i++) {
+        if (ladder[i] == cap)
+            return i;
+    }
+    return LADDER_STEPS;
+}
+
+// smallest step covering lines, 0 above the ladder
+static int step_covering(float lines)
+{
+    for (int i = 0; i < LADDER_STEPS; i++) {
+        if (ladder[i] >= lines)
+            return ladder[i];
+    }
+    return 0;
+}
+
+// largest step below lines, the smallest step at least
+static int step_below(int lines)
+{
+    int below = ladder[0];
+    for (int i = 0; i < LADDER_STEPS; i++) {
+        if (ladder[i] < lines)
+            below = ladder[i];
+    }
+    return below;
+}
+
+void abr_init(unsigned int now)
+{
+    abr = _abr();
+    abr.pending = -1;
+    abr.cap_since = abr.now = now;
+    abr_restarted(now);
+}
+
+void abr_restarted(unsigned int now)
+{
+    abr.window_start = now;
+    abr.need = 0;
+    abr.counted = false;
+    abr.pending_windows = 0;
+}
+
+void abr_sample(float lines)
+{
+    abr.need = std::max(abr.need, lines);
+}
+
+bool abr_update(unsigned int now, unsigned long long frames, unsigned long long dropped, int height)
+{
+    abr.now = now;
+    if (!abr.counted || frames < abr.frames || dropped < abr.dropped) {
+        abr.frames = frames;
+        abr.dropped = dropped;
+        abr.counted = true;
+    }
+    if (now - abr.window_start < ABR_WINDOW_MS)
+        return false;
+
+    unsigned long long window_frames = frames - abr.frames;
+    bool drops = window_frames >= ABR_MIN_FRAMES &&
+        (dropped - abr.dropped) > ABR_DROP_RATIO * window_frames;
+    int want = abr.need > 0 ? step_covering(abr.need * ABR_OVERSAMPLE) : 0;
+    abr.window_start = now;
+    abr.need = 0;
+    abr.frames = frames;
+    abr.dropped = dropped;
+
+    if (drops) {
+        want = std::min(limit(want), step_below(abr.cap ? abr.cap : height));
+        abr.drop_until = now + ABR_DROP_HOLD_MS;
+    } else if ((int)(abr.drop_until - now) > 0 && limit(want) > limit(abr.cap)) {
+        want = abr.cap;
+    }
+
+    if (want == abr.cap) {
+        abr.pending_windows = 0;
+        return false;
+    }
+    if (want == abr.pending) {
+        abr.pending_windows++;
+    } else {
+        abr.pending = want;
+        abr.pending_windows = 1;
+    }
+    if (abr.pending_windows < (drops ? 1 : ABR_HOLD))
+        return false;
+    if (abr.changes && now - abr.last_change < ABR_MIN_INTERVAL_MS)
+        return false;
+
+    abr.cap_ms[step_index(abr.cap)] += now - abr.cap_since;
+    abr.cap_since = now;
+    abr.cap = want;
+    abr.last_change = now;
+    abr.changes++;
+    if (drops)
+        abr.drop_changes++;
+    abr.pending_windows = 0;
+    return true;
+}
+
+int abr_cap()
+{
+    return abr.cap;
+}
+
+void abr_report(FILE *out)
+{
+    unsigned long long ms[LADDER_STEPS + 1];
+    std::copy(abr.cap_ms, abr.cap_ms + LADDER_STEPS + 1, ms);
+    ms[step_index(abr.cap)] += abr.now - abr.cap_since;
+
+    fprintf(out, "adaptive: %u cap changes (%u for drops), time per cap:", abr.changes,
+            abr.drop_changes);
+    for (int i = 0; i <= LADDER_STEPS; i++) {
+        if (!ms[i])
+            continue;
+        if (i < LADDER_STEPS)
+            fprintf(out, " %dp %.0fs", ladder[i], ms[i] / 1000.0);
+        else
+            fprintf(out, " none %.0fs", ms[i] / 1000.0);
+    }
+    fprintf(out, "\n");
+}
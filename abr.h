@@ -0,0 +1,47 @@
+#ifndef ABR_H
+#define ABR_H
+
+#include <cstdio>
+
+// Render aware rendition cap for adaptive (HLS/DASH) streams.
+//
+// VLC's adaptive demuxer picks renditions by network throughput alone and
+// keeps pulling 2160p for a screen a few hundred eye buffer pixels tall, or
+// for a machine that can't decode it in time.  The render thread reports
+// the video lines the screen can show, from its size and distance, and the
+// frames shown and dropped.  Each ABR_WINDOW_MS window the largest need
+// picks the smallest step of the rendition ladder covering it; a window
+// dropping more than ABR_DROP_RATIO of its frames steps below the current
+// cap instead and keeps the cap from rising for ABR_DROP_HOLD_MS.
+//
+// A new cap means reopening the stream, which rebuffers, so it has to hold
+// for ABR_HOLD windows (drops: one) and ABR_MIN_INTERVAL_MS must have passed
+// since the last change.  Not thread safe, render thread only.
+
+#define ABR_WINDOW_MS 2000
+#define ABR_HOLD 3                // windows a raised or size based cap must hold
+#define ABR_MIN_INTERVAL_MS 20000 // between reopens
+#define ABR_OVERSAMPLE 1.25f      // video lines per eye buffer row, headroom for filtering
+#define ABR_DROP_RATIO 0.05f      // dropped share of a window's frames
+#define ABR_DROP_HOLD_MS 60000    // no raising the cap after drops
+#define ABR_MIN_FRAMES 10         // in a window, for its drop ratio to count
+#define ABR_LADDER_TOP 2160       // highest rendition step, the output size when uncapped
+
+// Start uncapped, at ticks now.
+void abr_init(unsigned int now);
+// Video lines needed this frame, 0 for no estimate.
+void abr_sample(float lines);
+// Every frame, with cumulative counters of the current stream's frames and
+// of those dropped (a counter going backwards starts over) and the lines of
+// the video now decoded.  True when the stream should be reopened with
+// abr_cap().
+bool abr_update(unsigned int now, unsigned long long frames, unsigned long long dropped,
+        int height);
+// After reopening: the stream's counters restart, the rebuffer isn't judged.
+void abr_restarted(unsigned int now);
+// Current cap in lines, 0 while uncapped.
+int abr_cap();
+
+void abr_report(FILE *out);
+
+#endif // ABR_H
@@ -0,0 +1,334 @@
+
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_mutex.h>
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+#include "analyze.h"
+
+#define BUFFER_SIZE (ANALYZE_MAX_SIZE * ANALYZE_MAX_SIZE)
+#define BLACK_MEAN 24     // rows/columns this dark on average ...
+#define BLACK_MAX 48      // ... with no pixel brighter are bars
+#define MIN_BAR_FRACTION 0.01f
+#define FLAT_CONTRAST 6   // mean deviation below this: nothing to compare
+#define STEREO_RATIO 0.5f // halves this much closer than the other split
+
+static struct _analyze {
+    SDL_Thread *thread;
+    SDL_mutex *mutex;
+    SDL_cond *cond;
+    bool stop;
+
+    // reduced frame handed to the worker
+    uint8_t frame[BUFFER_SIZE] __attribute__((aligned(16)));
+    int width, height, stride; // reduced size, stride is a multiple of 16
+    int step;                  // source pixels per reduced pixel
+    int src_width, src_height;
+    bool pending;
+    Uint32 last_submit;
+    unsigned int generation;   // bumped by analyze_reset()
+
+    // worker
+    uint8_t work[BUFFER_SIZE] __attribute__((aligned(16)));
+    analyze_result last;
+    bool have_last;
+    analyze_result stable;
+    bool changed;
+} analyze;
+
+bool analyze_wanted()
+{
+    return analyze.thread && !analyze.pending &&
+        SDL_GetTicks() - analyze.last_submit >= ANALYZE_INTERVAL_MS;
+}
+
+void analyze_submit(const uint8_t *pixels, int width, int height, int pitch)
+{
+    int step = (std::max(width, height) + ANALYZE_MAX_SIZE - 1) / ANALYZE_MAX_SIZE;
+    int rw = width / step, rh = height / step;
+    int stride = (rw + 15) & ~15;
+
+    SDL_LockMutex(analyze.mutex);
+    analyze.last_submit = SDL_GetTicks();
+    if (!analyze.pending && rw > 0 && rh > 0) {
+        // (r + 2g + b) / 4 reads the same for BGRA and RGBA
+        for (int y = 0; y < rh; y++) {
+            const uint8_t *src = pixels + y * step * pitch;
+            uint8_t *dst = analyze.frame + y * stride;
+            for (int x = 0; x < rw; x++, src += step * 4)
+                dst[x] = (src[0] + 2 * src[1] + src[2]) >> 2;
+            memset(dst + rw, 0, stride - rw);
+        }
+        analyze.width = rw;
+        analyze.height = rh;
+        analyze.stride = stride;
+        analyze.step = step;
+        analyze.src_width = width;
+        analyze.src_height = height;
+        analyze.pending = true;
+        SDL_CondSignal(analyze.cond);
+    }
+    SDL_UnlockMutex(analyze.mutex);
+}
+
+// per row sum and maximum over the whole stride (the padding is zero)
+static void row_stats(const uint8_t *img, int stride, int h, uint32_t *sum, uint8_t *peak)
+{
+    for (int y = 0; y < h; y++) {
+        const uint8_t *row = img + y * stride;
+#ifdef __SSE2__
+        __m128i zero = _mm_setzero_si128();
+        __m128i acc = zero, top = zero;
+        for (int x = 0; x < stride; x += 16) {
+            __m128i v = _mm_load_si128((const __m128i*)(row + x));
+            acc = _mm_add_epi64(acc, _mm_sad_epu8(v, zero));
+            top = _mm_max_epu8(top, v);
+        }
+        sum[y] = _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+        uint8_t lanes[16] __attribute__((aligned(16)));
+        _mm_store_si128((__m128i*)lanes, top);
+        uint8_t m = 0;
+        for (int i = 0; i < 16; i++)
+            m = std::max(m, lanes[i]);
+        peak[y] = m;
+#else
+        uint32_t s = 0;
+        uint8_t m = 0;
+        for (int x = 0; x < stride; x++) {
+            s += row[x];
+            m = std::max(m, row[x]);
+        }
+        sum[y] = s;
+        peak[y] = m;
+#endif
+    }
+}
+
+// per column sum and maximum, h <= 256 so the sums fit 16 bits
+static void col_stats(const uint8_t *img, int stride, int h, uint16_t *sum, uint8_t *peak)
+{
+    memset(sum, 0, stride * sizeof *sum);
+    memset(peak, 0, stride);
+    for (int y = 0; y < h; y++) {
+        const uint8_t *row = img + y * stride;
+#ifdef __SSE2__
+        __m128i zero = _mm_setzero_si128();
+        for (int x = 0; x < stride; x += 16) {
+            __m128i v = _mm_load_si128((const __m128i*)(row + x));
+            __m128i *lo = (__m128i*)(sum + x), *hi = (__m128i*)(sum + x + 8);
+            _mm_store_si128(lo, _mm_add_epi16(_mm_load_si128(lo), _mm_unpacklo_epi8(v, zero)));
+            _mm_store_si128(hi, _mm_add_epi16(_mm_load_si128(hi), _mm_unpackhi_epi8(v, zero)));
+            __m128i *p = (__m128i*)(peak + x);
+            _mm_store_si128(p, _mm_max_epu8(_mm_load_si128(p), v));
+        }
+#else
+        for (int x = 0; x < stride; x++) {
+            sum[x] += row[x];
+            peak[x] = std::max(peak[x], row[x]);
+        }
+#endif
+    }
+}
+
+// sum of absolute differences of n bytes
+static uint32_t sad(const uint8_t *a, const uint8_t *b, int n)
+{
+    uint32_t s = 0;
+    int i = 0;
+#ifdef __SSE2__
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+    }
+    s = _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+#endif
+    for (; i < n; i++)
+        s += abs(a[i] - b[i]);
+    return s;
+}
+
+static bool is_bar(uint32_t sum, int count, uint8_t peak)
+{
+    return sum <= (uint32_t)(BLACK_MEAN * count) && peak <= BLACK_MAX;
+}
+
+static analyze_stereo_t guess_stereo(const uint8_t *img, int stride, int left, int top, int w, int h)
+{
+    if (w < 32 || h < 32)
+        return ANALYZE_STEREO_UNKNOWN;
+
+    // contrast: mean deviation from the mean, to skip flat frames
+    uint64_t total = 0;
+    for (int y = top; y < top + h; y++) {
+        const uint8_t *row = img + y * stride + left;
+        for (int x = 0; x < w; x++)
+            total += row[x];
+    }
+    uint8_t mean[ANALYZE_MAX_SIZE];
+    memset(mean, total / (w * h), sizeof mean);
+    uint64_t dev = 0, sbs = 0, ou = 0;
+    for (int y = top; y < top + h; y++)
+        dev += sad(img + y * stride + left, mean, w);
+    float contrast = (float)dev / (w * h);
+    if (contrast < FLAT_CONTRAST)
+        return ANALYZE_STEREO_UNKNOWN;
+
+    for (int y = top; y < top + h; y++) {
+        const uint8_t *row = img + y * stride + left;
+        sbs += sad(row, row + w / 2, w / 2);
+    }
+    for (int y = top; y < top + h / 2; y++) {
+        const uint8_t *row = img + y * stride + left;
+        ou += sad(row, row + (h / 2) * stride, w);
+    }
+    float d_sbs = (float)sbs / ((w / 2) * h);
+    float d_ou = (float)ou / (w * (h / 2));
+
+    if (d_sbs < d_ou * STEREO_RATIO && d_sbs < contrast * STEREO_RATIO)
+        return ANALYZE_STEREO_SBS;
+    if (d_ou < d_sbs * STEREO_RATIO && d_ou < contrast * STEREO_RATIO)
+        return ANALYZE_STEREO_OVER_UNDER;
+    return ANALYZE_STEREO_NONE;
+}
+
+static bool analyze_frame(const uint8_t *img, int w, int h, int stride, int step,
+        int src_width, int src_height, analyze_result *r)
+{
+    uint32_t row_sum[ANALYZE_MAX_SIZE];
+    uint8_t row_peak[ANALYZE_MAX_SIZE];
+    uint16_t col_sum[ANALYZE_MAX_SIZE] __attribute__((aligned(16)));
+    uint8_t col_peak[ANALYZE_MAX_SIZE] __attribute__((aligned(16)));
+
+    row_stats(img, stride, h, row_sum, row_peak);
+    col_stats(img, stride, h, col_sum, col_peak);
+
+    int top = 0, bottom = h - 1, left = 0, right = w - 1;
+    while (top < h && is_bar(row_sum[top], w, row_peak[top]))
+        top++;
+    if (top == h)
+        return false; // black frame, says nothing about bars
+    while (bottom > top && is_bar(row_sum[bottom], w, row_peak[bottom]))
+        bottom--;
+    while (left < w && is_bar(col_sum[left], h, col_peak[left]))
+        left++;
+    while (right > left && is_bar(col_sum[right], h, col_peak[right]))
+        right--;
+
+    // back to source pixels, the edges lie somewhere between the last bar
+    // sample and the first picture sample: round outwards to even values
+    int x0 = left ? (left - 1) * step + 1 : 0, x1 = std::min(src_width, (right + 1) * step);
+    int y0 = top ? (top - 1) * step + 1 : 0, y1 = std::min(src_height, (bottom + 1) * step);
+    if (x0 < src_width * MIN_BAR_FRACTION) x0 = 0;
+    if (src_width - x1 < src_width * MIN_BAR_FRACTION) x1 = src_width;
+    if (y0 < src_height * MIN_BAR_FRACTION) y0 = 0;
+    if (src_height - y1 < src_height * MIN_BAR_FRACTION) y1 = src_height;
+    r->x = x0 & ~1;
+    r->y = y0 & ~1;
+    r->width = std::min(src_width, (x1 + 1) & ~1) - r->x;
+    r->height = std::min(src_height, (y1 + 1) & ~1) - r->y;
+
+    r->stereo = guess_stereo(img, stride, left, top, right - left + 1, bottom - top + 1);
+    return true;
+}
+
+static bool same_result(const analyze_result &a, const analyze_result &b, int tolerance)
+{
+    return abs(a.x - b.x) <= tolerance && abs(a.y - b.y) <= tolerance &&
+        abs(a.width - b.width) <= tolerance && abs(a.height - b.height) <= tolerance &&
+        a.stereo == b.stereo;
+}
+
+static int analyze_worker(void *)
+{
+    SDL_LockMutex(analyze.mutex);
+    for (;;) {
+        while (!analyze.pending && !analyze.stop)
+            SDL_CondWait(analyze.cond, analyze.mutex);
+        if (analyze.stop)
+            break;
+
+        int w = analyze.width, h = analyze.height, stride = analyze.stride, step = analyze.step;
+        int src_width = analyze.src_width, src_height = analyze.src_height;
+        unsigned int generation = analyze.generation;
+        memcpy(analyze.work, analyze.frame, stride * h);
+        analyze.pending = false;
+        SDL_UnlockMutex(analyze.mutex);
+
+        analyze_result r;
+        bool valid = analyze_frame(analyze.work, w, h, stride, step, src_width, src_height, &r);
+
+        SDL_LockMutex(analyze.mutex);
+        if (!valid || generation != analyze.generation)
+            continue;
+        // the stereo guess of a flat frame doesn't count against the last one
+        if (r.stereo == ANALYZE_STEREO_UNKNOWN && analyze.have_last)
+            r.stereo = analyze.last.stereo;
+        if (analyze.have_last && same_result(r, analyze.last, 2 * step) &&
+                !same_result(r, analyze.stable, 2 * step)) {
+            analyze.stable = r;
+            analyze.changed = true;
+        }
+        analyze.last = r;
+        analyze.have_last = true;
+    }
+    SDL_UnlockMutex(analyze.mutex);
+    return 0;
+}
+
+void analyze_start()
+{
+    analyze.mutex = SDL_CreateMutex();
+    analyze.cond = SDL_CreateCond();
+    analyze.stop = false;
+    analyze.thread = SDL_CreateThread(analyze_worker, "analyze", 0);
+}
+
+void analyze_stop()
+{
+    if (!analyze.thread)
+        return;
+
+    SDL_LockMutex(analyze.mutex);
+    analyze.stop = true;
+    SDL_CondSignal(analyze.cond);
+    SDL_UnlockMutex(analyze.mutex);
+    SDL_WaitThread(analyze.thread, 0);
+    analyze.thread = 0;
+    // the mutex stays, the decoder may still be inside analyze_submit()
+}
+
+void analyze_reset()
+{
+    if (!analyze.thread)
+        return;
+
+    SDL_LockMutex(analyze.mutex);
+    analyze.generation++;
+    analyze.have_last = false;
+    memset(&analyze.stable, 0, sizeof analyze.stable);
+    analyze.changed = false;
+    analyze.last_submit = 0;
+    SDL_UnlockMutex(analyze.mutex);
+}
+
+bool analyze_poll(analyze_result *result)
+{
+    if (!analyze.thread)
+        return false;
+
+    SDL_LockMutex(analyze.mutex);
+    bool changed = analyze.changed;
+    if (changed)
+        *result = analyze.stable;
+    analyze.changed = false;
+    SDL_UnlockMutex(analyze.mutex);
+    return changed;
+}
@@ -0,0 +1,45 @@
+#ifndef ANALYZE_H
+#define ANALYZE_H
+
+#include <stdint.h>
+
+// Background picture analysis.
+//
+// Every few seconds unlock() hands over the decoded frame, which is reduced
+// to a small luma image right away.  A worker thread then computes per row
+// and per column mean and maximum luma (SSE2 where available) to find the
+// active picture inside baked-in letterbox or pillarbox bars, and compares
+// the left/right and top/bottom halves to guess the stereo layout.  Results
+// are only reported once two analyses in a row agree, so a dark scene or a
+// fade doesn't flip the crop or the layout.
+
+#define ANALYZE_INTERVAL_MS 3000
+#define ANALYZE_MAX_SIZE 256 // longest side of the reduced image
+
+typedef enum {
+    ANALYZE_STEREO_UNKNOWN, // flat frame, nothing to compare
+    ANALYZE_STEREO_NONE,
+    ANALYZE_STEREO_SBS,
+    ANALYZE_STEREO_OVER_UNDER,
+} analyze_stereo_t;
+
+struct analyze_result {
+    // active picture in source pixels, top row first
+    int x, y, width, height;
+    analyze_stereo_t stereo;
+};
+
+void analyze_start();
+void analyze_stop();
+// forget previous results, for a new video size or after seeking
+void analyze_reset();
+
+// true when a new frame should be submitted
+bool analyze_wanted();
+// 32 bit BGRA/RGBA, top row first; copies a reduced image and returns
+void analyze_submit(const uint8_t *pixels, int width, int height, int pitch);
+
+// true when the stable result changed since the last call
+bool analyze_poll(analyze_result *result);
+
+#endif // ANALYZE_H
@@ -0,0 +1,448 @@
+
+#include <cstring>
+#include <string>
+
+#include <zlib.h>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_mutex.h>
+
+#include "capture.h"
+#include "frame_arena.h"
+
+#define CAPTURE_FENCE_TIMEOUT_NS 100000000 // only waited on when closing
+#define PNG_COMPRESSION Z_BEST_SPEED
+
+typedef enum {
+    SLOT_FREE,
+    SLOT_PENDING, // readback issued, fence not signalled yet
+    SLOT_QUEUED,  // mapped, waiting for or being encoded by the writer
+    SLOT_SKIPPED, // the mapping failed, the writer passes over it
+    SLOT_DONE,    // written, the render thread still has to unmap it
+} slot_state_t;
+
+struct capture_slot {
+    GLuint pbo;
+    GLsync fence;
+    size_t size;
+    slot_state_t state;
+    unsigned int sequence;
+    unsigned int width, height;
+    const Uint8 *pixels; // the mapping, bottom row first
+};
+
+static struct _capture {
+    bool active;
+    capture_format_t format;
+    std::string path; // file, or printf pattern for png
+    FILE *file;
+    unsigned int interval;
+    double fps;
+    bool lossless;
+
+    capture_slot slots[CAPTURE_RING_SIZE];
+    unsigned int issue_pos;  // next slot to read back into
+    unsigned int retire_pos; // oldest slot that may be pending
+    unsigned int frames;     // frames offered, for the interval
+    unsigned int sequence;   // captures issued
+
+    SDL_Thread *thread;
+    SDL_mutex *mutex;
+    SDL_cond *cond;
+    bool stop;
+
+    // writer thread scratch, from the arena
+    Uint8 *scratch;
+    size_t scratch_size;
+    bool header_written;
+
+    // accounting
+    Uint64 render_ticks;      // since the last capture_overhead_ms()
+    unsigned int render_frames;
+    Uint64 render_ticks_total;
+    Uint64 writer_ticks;
+    unsigned int issued;
+    unsigned int written;
+    unsigned int dropped;
+    unsigned int failed;
+    unsigned int unmapped;    // readbacks that could not be mapped
+    Uint64 bytes_written;
+} capture;
+
+static bool has_suffix(const std::string &s, const char *suffix)
+{
+    size_t n = strlen(suffix);
+    return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+static Uint8* scratch(size_t bytes)
+{
+    if (capture.scratch_size < bytes) {
+        arena_free(capture.scratch);
+        capture.scratch = (Uint8*)arena_alloc(bytes, "capture");
+        capture.scratch_size = capture.scratch ? bytes : 0;
+    }
+    return capture.scratch;
+}
+
+static void write_raw(const capture_slot *s)
+{
+    size_t pitch = s->width * 4;
+
+    // GL rows are bottom up
+    for (int y = s->height - 1; y >= 0; y--)
+        fwrite(s->pixels + y * pitch, pitch, 1, capture.file);
+    capture.bytes_written += pitch * s->height;
+}
+
+static void write_y4m(const capture_slot *s)
+{
+    unsigned int w = s->width, h = s->height;
+
+    if (!capture.header_written) {
+        fprintf(capture.file, "YUV4MPEG2 W%u H%u F%u:%u Ip A1:1 C444\n",
+                w, h, (unsigned int)(capture.fps * 1000 + 0.5), capture.interval * 1000);
+        capture.header_written = true;
+    }
+
+    Uint8 *planes = scratch(w * h * 3);
+    if (!planes)
+        return;
+    Uint8 *py = planes, *pu = planes + w * h, *pv = planes + 2 * w * h;
+
+    // BT.601 studio range, 8 bit fixed point
+    for (unsigned int y = 0; y < h; y++) {
+        const Uint8 *src = s->pixels + (h - 1 - y) * w * 4;
+        for (unsigned int x = 0; x < w; x++, src += 4) {
+            int b = src[0], g = src[1], r = src[2];
+            *py++ = (( 66 * r + 129 * g +  25 * b + 128) >> 8) + 16;
+            *pu++ = ((-38 * r -  74 * g + 112 * b + 128) >> 8) + 128;
+            *pv++ = ((112 * r -  94 * g -  18 * b + 128) >> 8) + 128;
+        }
+    }
+
+    fputs("FRAME\n", capture.file);
+    fwrite(planes, w * h * 3, 1, capture.file);
+    capture.bytes_written += w * h * 3 + 6;
+}
+
+static void png_chunk(FILE *f, const char *type, const Uint8 *data, Uint32 len)
+{
+    Uint8 be[4] = { Uint8(len >> 24), Uint8(len >> 16), Uint8(len >> 8), Uint8(len) };
+    fwrite(be, 4, 1, f);
+    fwrite(type, 4, 1, f);
+    if (len)
+        fwrite(data, len, 1, f);
+
+    uLong crc = crc32(0, (const Bytef*)type, 4);
+    crc = crc32(crc, data, len);
+    Uint8 crc_be[4] = { Uint8(crc >> 24), Uint8(crc >> 16), Uint8(crc >> 8), Uint8(crc) };
+    fwrite(crc_be, 4, 1, f);
+}
+
+static void write_png(const capture_slot *s)
+{
+    unsigned int w = s->width, h = s->height;
+    size_t row = 1 + w * 3; // filter byte + RGB
+    size_t raw_size = row * h;
+    uLongf packed_size = compressBound(raw_size);
+
+    Uint8 *raw = scratch(raw_size + packed_size);
+    if (!raw)
+        return;
+    Uint8 *packed = raw + raw_size;
+
+    for (unsigned int y = 0; y < h; y++) {
+        const Uint8 *src = s->pixels + (h - 1 - y) * w * 4;
+        Uint8 *dst = raw + y * row;
+        *dst++ = 0; // no filter
+        for (unsigned int x = 0; x < w; x++, src += 4) {
+            *dst++ = src[2];
+            *dst++ = src[1];
+            *dst++ = src[0];
+        }
+    }
+    if (compress2(packed, &packed_size, raw, raw_size, PNG_COMPRESSION) != Z_OK) {
+        capture.failed++;
+        return;
+    }
+
+    char name[1024];
+    snprintf(name, sizeof name, capture.path.c_str(), s->sequence);
+    FILE *f = fopen(name, "wb");
+    if (!f) {
+        perror(name);
+        capture.failed++;
+        return;
+    }
+
+    static const Uint8 signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    Uint8 ihdr[13] = {
+        Uint8(w >> 24), Uint8(w >> 16), Uint8(w >> 8), Uint8(w),
+        Uint8(h >> 24), Uint8(h >> 16), Uint8(h >> 8), Uint8(h),
+        8, 2, 0, 0, 0 // 8 bit RGB, deflate, no filter, no interlace
+    };
+    fwrite(signature, sizeof signature, 1, f);
+    png_chunk(f, "IHDR", ihdr, sizeof ihdr);
+    png_chunk(f, "IDAT", packed, packed_size);
+    png_chunk(f, "IEND", 0, 0);
+    fclose(f);
+
+    capture.bytes_written += packed_size + 57;
+}
+
+static int capture_writer(void *)
+{
+    unsigned int pos = 0;
+
+    SDL_LockMutex(capture.mutex);
+    for (;;) {
+        // slots are queued in ring order
+        capture_slot *s = &capture.slots[pos];
+        while (s->state != SLOT_QUEUED && s->state != SLOT_SKIPPED && !capture.stop)
+            SDL_CondWait(capture.cond, capture.mutex);
+        if (s->state == SLOT_SKIPPED) {
+            // nothing to write or unmap, keep the ring moving
+            s->state = SLOT_FREE;
+            pos = (pos + 1) % CAPTURE_RING_SIZE;
+            continue;
+        }
+        if (s->state != SLOT_QUEUED)
+            break; // stopped and drained
+        SDL_UnlockMutex(capture.mutex);
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        switch (capture.format) {
+        case CAPTURE_RAW: write_raw(s); break;
+        case CAPTURE_Y4M: write_y4m(s); break;
+        case CAPTURE_PNG: write_png(s); break;
+        }
+        capture.writer_ticks += SDL_GetPerformanceCounter() - start;
+
+        SDL_LockMutex(capture.mutex);
+        s->state = SLOT_DONE;
+        capture.written++;
+        pos = (pos + 1) % CAPTURE_RING_SIZE;
+    }
+    SDL_UnlockMutex(capture.mutex);
+    return 0;
+}
+
+bool capture_open(const char *path, unsigned int interval, double fps, bool lossless)
+{
+    capture.path = path;
+    capture.interval = interval ? interval : 1;
+    capture.fps = fps;
+    capture.lossless = lossless;
+
+    if (has_suffix(capture.path, ".y4m")) {
+        capture.format = CAPTURE_Y4M;
+    } else if (has_suffix(capture.path, ".png")) {
+        capture.format = CAPTURE_PNG;
+        if (capture.path.find('%') == std::string::npos)
+            capture.path.insert(capture.path.size() - 4, "-%05u");
+    } else {
+        capture.format = CAPTURE_RAW;
+    }
+
+    if (capture.format != CAPTURE_PNG) {
+        capture.file = fopen(path, "wb");
+        if (!capture.file) {
+            perror(path);
+            return false;
+        }
+        setvbuf(capture.file, 0, _IOFBF, 1 << 20);
+    }
+
+    capture.mutex = SDL_CreateMutex();
+    capture.cond = SDL_CreateCond();
+    capture.thread = SDL_CreateThread(capture_writer, "capture", 0);
+    capture.active = true;
+
+    printf("Capturing every %u frame(s) to %s\n", capture.interval, capture.path.c_str());
+    return true;
+}
+
+bool capture_active()
+{
+    return capture.active;
+}
+
+// Hand finished readbacks to the writer and take back what it wrote.
+static void retire(bool wait)
+{
+    for (int i = 0; i < CAPTURE_RING_SIZE; i++) {
+        capture_slot *s = &capture.slots[capture.retire_pos];
+
+        SDL_LockMutex(capture.mutex);
+        slot_state_t state = s->state;
+        SDL_UnlockMutex(capture.mutex);
+
+        if (state != SLOT_PENDING)
+            break;
+
+        GLenum r = glClientWaitSync(s->fence, 0, wait ? CAPTURE_FENCE_TIMEOUT_NS : 0);
+        if (r != GL_ALREADY_SIGNALED && r != GL_CONDITION_SATISFIED)
+            break;
+        glDeleteSync(s->fence);
+        s->fence = 0;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, s->pbo);
+        s->pixels = (const Uint8*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, s->size, GL_MAP_READ_BIT);
+
+        SDL_LockMutex(capture.mutex);
+        if (s->pixels) {
+            s->state = SLOT_QUEUED;
+        } else {
+            s->state = SLOT_SKIPPED;
+            capture.unmapped++;
+        }
+        SDL_CondSignal(capture.cond);
+        SDL_UnlockMutex(capture.mutex);
+
+        capture.retire_pos = (capture.retire_pos + 1) % CAPTURE_RING_SIZE;
+    }
+
+    // unmap what the writer finished
+    for (int i = 0; i < CAPTURE_RING_SIZE; i++) {
+        capture_slot *s = &capture.slots[i];
+        SDL_LockMutex(capture.mutex);
+        bool done = s->state == SLOT_DONE;
+        if (done)
+            s->state = SLOT_FREE;
+        SDL_UnlockMutex(capture.mutex);
+        if (done) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, s->pbo);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            s->pixels = 0;
+        }
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void capture_frame(unsigned int width, unsigned int height)
+{
+    if (!capture.active)
+        return;
+
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    retire(false);
+
+    if (capture.frames++ % capture.interval == 0) {
+        capture_slot *s = &capture.slots[capture.issue_pos];
+
+        SDL_LockMutex(capture.mutex);
+        bool busy = s->state != SLOT_FREE;
+        SDL_UnlockMutex(capture.mutex);
+
+        while (busy && capture.lossless) {
+            retire(true);
+            SDL_LockMutex(capture.mutex);
+            busy = s->state != SLOT_FREE;
+            bool writing = busy && s->state != SLOT_PENDING;
+            SDL_UnlockMutex(capture.mutex);
+            if (writing) // the writer is behind
+                SDL_Delay(1);
+        }
+
+        if (busy) {
+            // the GPU or the writer is behind, never wait for them here
+            capture.dropped++;
+        } else {
+            size_t size = width * height * 4;
+            if (!s->pbo)
+                glGenBuffers(1, &s->pbo);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, s->pbo);
+            if (s->size != size) {
+                glBufferData(GL_PIXEL_PACK_BUFFER, size, 0, GL_STREAM_READ);
+                s->size = size;
+                mem_track_gpu("capture", "readback ring", size * CAPTURE_RING_SIZE);
+            }
+            glPixelStorei(GL_PACK_ALIGNMENT, 4);
+            glReadPixels(0, 0, width, height, GL_BGRA, GL_UNSIGNED_BYTE, 0);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+            s->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            s->width = width;
+            s->height = height;
+            s->sequence = capture.sequence++;
+            SDL_LockMutex(capture.mutex);
+            s->state = SLOT_PENDING;
+            SDL_UnlockMutex(capture.mutex);
+            capture.issued++;
+            capture.issue_pos = (capture.issue_pos + 1) % CAPTURE_RING_SIZE;
+        }
+    }
+
+    Uint64 ticks = SDL_GetPerformanceCounter() - start;
+    capture.render_ticks += ticks;
+    capture.render_ticks_total += ticks;
+    capture.render_frames++;
+}
+
+void capture_close()
+{
+    if (!capture.active)
+        return;
+
+    // flush what is in flight, waiting this time
+    for (int i = 0; i < CAPTURE_RING_SIZE; i++)
+        retire(true);
+
+    SDL_LockMutex(capture.mutex);
+    capture.stop = true;
+    SDL_CondSignal(capture.cond);
+    SDL_UnlockMutex(capture.mutex);
+    SDL_WaitThread(capture.thread, 0);
+    retire(false);
+
+    for (int i = 0; i < CAPTURE_RING_SIZE; i++) {
+        capture_slot *s = &capture.slots[i];
+        if (s->fence)
+            glDeleteSync(s->fence);
+        if (s->pbo)
+            glDeleteBuffers(1, &s->pbo);
+    }
+    mem_track_gpu("capture", "readback ring", 0);
+
+    if (capture.file)
+        fclose(capture.file);
+    arena_free(capture.scratch);
+    SDL_DestroyCond(capture.cond);
+    SDL_DestroyMutex(capture.mutex);
+
+    capture_report(stdout);
+    capture.active = false;
+}
+
+float capture_overhead_ms()
+{
+    float ms = 0;
+    if (capture.render_frames)
+        ms = capture.render_ticks * 1000.0 / SDL_GetPerformanceFrequency() / capture.render_frames;
+    capture.render_ticks = 0;
+    capture.render_frames = 0;
+    return ms;
+}
+
+unsigned int capture_dropped()
+{
+    return capture.dropped;
+}
+
+void capture_report(FILE *out)
+{
+    double freq = SDL_GetPerformanceFrequency();
+    double writer_s = capture.writer_ticks / freq;
+
+    fprintf(out, "capture: %u issued, %u written, %u dropped, %u failed, %u not mapped\n",
+            capture.issued, capture.written, capture.dropped, capture.failed, capture.unmapped);
+    fprintf(out, "\trender thread %.3f ms/frame over %u frames\n",
+            capture.frames ? capture.render_ticks_total * 1000.0 / freq / capture.frames : 0.0,
+            capture.frames);
+    fprintf(out, "\twriter %.2f ms/capture, %.2f MB written (%.1f MB/s while busy)\n",
+            capture.written ? writer_s * 1000.0 / capture.written : 0.0,
+            capture.bytes_written / (1024.0 * 1024.0),
+            writer_s > 0 ? capture.bytes_written / (1024.0 * 1024.0) / writer_s : 0.0);
+}
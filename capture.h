@@ -0,0 +1,45 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <cstdio>
+
+#include <GL/glew.h>
+
+// Asynchronous eye buffer capture.
+//
+// capture_frame() issues a glReadPixels into one of a ring of pixel pack
+// buffers and fences it, returning right away.  Buffers whose fence has
+// signalled on a later frame are mapped and handed to a writer thread, which
+// encodes straight from the mapping; the render thread unmaps them once the
+// writer is done.  When every buffer is still in flight the frame is dropped
+// rather than waiting on the GPU.
+//
+// The output format follows the file name:
+//   *.y4m  YUV4MPEG2 stream, 4:4:4 BT.601 studio range
+//   *.png  numbered PNG files, the name is a printf pattern ("shot%05d.png")
+//   else   raw BGRA frames, top row first
+
+#define CAPTURE_RING_SIZE 4
+
+typedef enum {
+    CAPTURE_RAW,
+    CAPTURE_Y4M,
+    CAPTURE_PNG,
+} capture_format_t;
+
+// interval: capture every nth frame.  fps is written to the y4m header.
+// lossless waits for a free buffer instead of dropping, for offline rendering.
+bool capture_open(const char *path, unsigned int interval, double fps, bool lossless);
+void capture_close();
+bool capture_active();
+
+// Call with the framebuffer to read bound and its color attachment selected
+// for reading, after the frame has been drawn.
+void capture_frame(unsigned int width, unsigned int height);
+
+// Render thread milliseconds per captured frame since the last call.
+float capture_overhead_ms();
+unsigned int capture_dropped();
+void capture_report(FILE *out);
+
+#endif // CAPTURE_H
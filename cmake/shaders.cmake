@@ -1,20 +1,133 @@
 separate_arguments(FILES)
 
+# Convert GLSL files into C string arrays.
+#
+# A file may declare permutation axes with lines of the form
+#
+#   //! permute AXIS VALUE0 VALUE1 ...
+#
+# Every combination of axis values is then emitted as its own specialized
+# source with the matching #defines prepended, so the shader can select code
+# with #if instead of branching on uniforms at runtime.  Symbolic values get
+# an enumerator each (AXIS_VALUE0 0, AXIS_VALUE1 1, ...) and AXIS is defined to
+# the selected one; numeric values are defined directly.  The variants are
+# also collected in <name>ShaderPermutations[], ordered with the first
+# declared axis varying slowest, so the renderer can index them with the same
+# nested loops over its own enums.
+#
+# Since #version has to come first, a permutation can select its own with
+#
+#   //! version AXIS=VALUE 330 core
+#
+# which replaces the file's #version line (if any) for matching variants.
+
+# turn a list of GLSL lines into concatenated C string literals
+macro(glsl_to_c_string lines out)
+    set(${out} "")
+    foreach (line ${lines})
+        # #version is emitted separately, it has to stay in front of the defines
+        if (NOT line MATCHES "^#version")
+            string(REPLACE "\\" "\\\\" line "${line}")
+            string(REPLACE "\"" "\\\"" line "${line}")
+            set(${out} "${${out}}    \"${line}\\n\"\n")
+        endif()
+    endforeach()
+endmacro()
+
 foreach (file ${FILES})
     set(filename ${SOURCE_DIR}/${file})
     get_filename_component(name ${filename} NAME_WE)
 
-    set(source "")
-
     file(STRINGS ${filename} lines)
-    foreach (line ${lines})
-        set(source "${source}    \"${line}\\n\"\n")
-    endforeach()
+    file(STRINGS ${filename} permute_lines REGEX "^//! permute ")
+    file(STRINGS ${filename} version_lines REGEX "^//! version ")
+
+    file(STRINGS ${filename} version REGEX "^#version" LIMIT_COUNT 1)
+    if (version)
+        set(version "    \"${version}\\n\"\n")
+    endif()
+    glsl_to_c_string("${lines}" source)
+
+    if (NOT permute_lines)
+        file(
+            WRITE ${DESTINATION_DIR}/${file}.h
+            "static const GLchar *${name}ShaderSource[] = {\n"
+            "${version}"
+            "${source}"
+            "};\n"
+        )
+    else()
+        # each combination is a comma separated list of AXIS=VALUE items
+        set(combos "")
+        foreach (permute ${permute_lines})
+            string(REGEX REPLACE "^//! permute +" "" permute "${permute}")
+            string(REGEX REPLACE " +" ";" values "${permute}")
+            list(GET values 0 axis)
+            list(REMOVE_AT values 0)
+
+            # the new axis varies fastest
+            set(next "")
+            if (combos)
+                foreach (combo ${combos})
+                    foreach (value ${values})
+                        list(APPEND next "${combo},${axis}=${value}")
+                    endforeach()
+                endforeach()
+            else()
+                foreach (value ${values})
+                    list(APPEND next "${axis}=${value}")
+                endforeach()
+            endif()
+            set(combos ${next})
+
+            set(axis_values_${axis} "${values}")
+        endforeach()
+
+        set(header "")
+        set(table "")
+        list(LENGTH combos count)
+        foreach (combo ${combos})
+            string(REPLACE "," ";" items "${combo}")
+            set(suffix "")
+            set(defines "")
+            foreach (item ${items})
+                string(REGEX REPLACE "=.*" "" axis "${item}")
+                string(REGEX REPLACE ".*=" "" value "${item}")
+                set(suffix "${suffix}_${axis}_${value}")
+                if (value MATCHES "^[0-9]+$")
+                    set(defines "${defines}    \"#define ${axis} ${value}\\n\"\n")
+                else()
+                    set(index 0)
+                    foreach (v ${axis_values_${axis}})
+                        set(defines "${defines}    \"#define ${axis}_${v} ${index}\\n\"\n")
+                        math(EXPR index "${index} + 1")
+                    endforeach()
+                    set(defines "${defines}    \"#define ${axis} ${axis}_${value}\\n\"\n")
+                endif()
+            endforeach()
+
+            set(combo_version "${version}")
+            foreach (version_line ${version_lines})
+                string(REGEX MATCH "^//! version +([^ ]+) +(.*)$" version_line "${version_line}")
+                set(selector "${CMAKE_MATCH_1}")
+                set(version_string "${CMAKE_MATCH_2}")
+                if ("${combo}" MATCHES "(^|,)${selector}(,|$)")
+                    set(combo_version "    \"#version ${version_string}\\n\"\n")
+                endif()
+            endforeach()
+
+            set(header "${header}static const GLchar *${name}${suffix}ShaderSource[] = {\n")
+            set(header "${header}${combo_version}${defines}${source}};\n\n")
+            set(table "${table}    ${name}${suffix}ShaderSource,\n")
+        endforeach()
 
-    file(
-        WRITE ${DESTINATION_DIR}/${file}.h
-        "static const GLchar *${name}ShaderSource[] = {\n"
-        "${source}"
-        "};\n"
-    )
+        file(
+            WRITE ${DESTINATION_DIR}/${file}.h
+            "${header}"
+            "#define ${name}ShaderPermutationCount ${count}\n"
+            "static const GLchar **${name}ShaderPermutations[] = {\n"
+            "${table}"
+            "};\n"
+        )
+    endif()
 endforeach()
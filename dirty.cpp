@@ -0,0 +1,146 @@
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+#include "dirty.h"
+
+#define HASH_SEED 0xcbf29ce484222325ULL  // FNV-1a offset basis and prime,
+#define HASH_PRIME 0x100000001b3ULL      // folding row segments into tiles
+
+static std::atomic<unsigned int> frames, duplicates;
+static std::atomic<unsigned long long> ratio_ppm; // per frame changed ratios, summed
+
+static inline uint64_t rotl(uint64_t x, int n)
+{
+    return (x << n) | (x >> (64 - n));
+}
+
+// Copy bytes and hash them on the way, into two 64 bit halves.
+static void copy_hash(uint8_t *dst, const uint8_t *src, int bytes, uint64_t *lo, uint64_t *hi)
+{
+    int i = 0;
+#ifdef __SSE2__
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= bytes; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dst + i), v);
+        acc = _mm_or_si128(_mm_slli_epi32(acc, 5), _mm_srli_epi32(acc, 27));
+        acc = _mm_add_epi32(acc, v);
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    *lo = lanes[0];
+    *hi = lanes[1];
+#else
+    *lo = *hi = 0;
+    for (; i + 8 <= bytes; i += 8) {
+        uint64_t w;
+        memcpy(&w, src + i, 8);
+        memcpy(dst + i, &w, 8);
+        *lo = rotl(*lo, 5) + w;
+        *hi ^= w;
+    }
+#endif
+    for (; i < bytes; i++) {
+        dst[i] = src[i];
+        *lo = rotl(*lo, 5) + src[i];
+    }
+}
+
+void dirty_begin(dirty_hashes *frame, int width, int height)
+{
+    frame->width = width;
+    frame->height = height;
+    frame->tiles_x = (width + DIRTY_TILE_SIZE - 1) / DIRTY_TILE_SIZE;
+    frame->tiles_y = (height + DIRTY_TILE_SIZE - 1) / DIRTY_TILE_SIZE;
+    frame->hash.assign(frame->tiles_x * frame->tiles_y, HASH_SEED);
+}
+
+void dirty_copy_row(uint8_t *dst, const uint8_t *src, int width, int y, dirty_hashes *frame)
+{
+    uint64_t *h = &frame->hash[(y / DIRTY_TILE_SIZE) * frame->tiles_x];
+    const int segment = DIRTY_TILE_SIZE * 4;
+    int bytes = width * 4;
+    for (int x = 0, tx = 0; x < bytes; x += segment, tx++) {
+        uint64_t lo, hi;
+        copy_hash(dst + x, src + x, std::min(segment, bytes - x), &lo, &hi);
+        h[tx] = (h[tx] ^ lo) * HASH_PRIME;
+        h[tx] = (h[tx] ^ hi) * HASH_PRIME;
+    }
+}
+
+int dirty_changes(const dirty_hashes *contents, const dirty_hashes *frame, const SDL_Rect &area,
+        std::vector<SDL_Rect> *rects, int *total)
+{
+    int tx0 = area.x / DIRTY_TILE_SIZE, tx1 = (area.x + area.w - 1) / DIRTY_TILE_SIZE;
+    int ty0 = area.y / DIRTY_TILE_SIZE, ty1 = (area.y + area.h - 1) / DIRTY_TILE_SIZE;
+    *total = (tx1 - tx0 + 1) * (ty1 - ty0 + 1);
+    if (rects)
+        rects->clear();
+
+    bool known = contents->valid && contents->width == frame->width &&
+        contents->height == frame->height && contents->area.x == area.x &&
+        contents->area.y == area.y && contents->area.w == area.w && contents->area.h == area.h;
+    if (!known) {
+        if (rects)
+            rects->push_back(area);
+        return *total;
+    }
+
+    int changed = 0;
+    for (int ty = ty0; ty <= ty1; ty++) {
+        const uint64_t *a = &contents->hash[ty * frame->tiles_x];
+        const uint64_t *b = &frame->hash[ty * frame->tiles_x];
+        for (int tx = tx0; tx <= tx1; tx++) {
+            if (a[tx] == b[tx])
+                continue;
+            // merge the run of changed tiles along the row
+            int end = tx;
+            while (end < tx1 && a[end + 1] != b[end + 1])
+                end++;
+            changed += end - tx + 1;
+            if (rects) {
+                SDL_Rect r;
+                r.x = std::max(area.x, tx * DIRTY_TILE_SIZE);
+                r.y = std::max(area.y, ty * DIRTY_TILE_SIZE);
+                r.w = std::min(area.x + area.w, (end + 1) * DIRTY_TILE_SIZE) - r.x;
+                r.h = std::min(area.y + area.h, (ty + 1) * DIRTY_TILE_SIZE) - r.y;
+                rects->push_back(r);
+            }
+            tx = end;
+        }
+    }
+    return changed;
+}
+
+void dirty_commit(dirty_hashes *contents, const dirty_hashes *frame, const SDL_Rect &area)
+{
+    contents->width = frame->width;
+    contents->height = frame->height;
+    contents->tiles_x = frame->tiles_x;
+    contents->tiles_y = frame->tiles_y;
+    contents->hash = frame->hash;
+    contents->valid = true;
+    contents->area = area;
+}
+
+void dirty_record(int changed, int total)
+{
+    frames++;
+    if (!changed)
+        duplicates++;
+    if (total)
+        ratio_ppm += (unsigned long long)changed * 1000000 / total;
+}
+
+void dirty_stats(unsigned int *frame_count, unsigned int *duplicate_count, double *changed_ratio)
+{
+    *frame_count = frames.exchange(0);
+    *duplicate_count = duplicates.exchange(0);
+    unsigned long long ppm = ratio_ppm.exchange(0);
+    *changed_ratio = *frame_count ? ppm / 1e6 / *frame_count : 0;
+}
@@ -0,0 +1,50 @@
+#ifndef DIRTY_H
+#define DIRTY_H
+
+#include <stdint.h>
+#include <vector>
+
+#include <SDL2/SDL.h>
+
+// Dirty tiles.
+//
+// While unlock() copies a decoded frame row by row into the staging buffer,
+// dirty_copy_row() folds every row segment into a 64 bit hash of the
+// DIRTY_TILE_SIZE squared tile it belongs to (SSE2 where available), at
+// next to no cost over the copy itself.  Each texture remembers the hashes
+// of what it holds, so an upload only has to cover the tiles that differ,
+// merged into runs along tile rows, and a frame identical to the texture
+// needs no upload at all.  Screen recordings, slideshows and animation
+// mostly change a few tiles, if any.
+
+#define DIRTY_TILE_SIZE 64 // pixels
+
+struct dirty_hashes {
+    int width, height;   // pixels
+    int tiles_x, tiles_y;
+    std::vector<uint64_t> hash;
+    // textures: contents known, and the staging buffer area they came from
+    bool valid;
+    SDL_Rect area;
+};
+
+// Size a frame's hashes and reset them for the rows that follow.
+void dirty_begin(dirty_hashes *frame, int width, int height);
+// Copy a BGRA row of width pixels, dst may be src, and hash it as row y.
+void dirty_copy_row(uint8_t *dst, const uint8_t *src, int width, int y, dirty_hashes *frame);
+
+// Rectangles of area (staging buffer pixels, rows as stored) whose tiles
+// differ between a texture's contents and frame, all of area when the
+// contents are unknown or came from another area.  rects may be 0.
+// Returns the changed tiles, *total the tiles of area.
+int dirty_changes(const dirty_hashes *contents, const dirty_hashes *frame, const SDL_Rect &area,
+        std::vector<SDL_Rect> *rects, int *total);
+// The texture now holds frame's area.
+void dirty_commit(dirty_hashes *contents, const dirty_hashes *frame, const SDL_Rect &area);
+
+// Per frame that was compared, changed 0 for a duplicate.  Any thread.
+void dirty_record(int changed, int total);
+// Since the previous call: frames, duplicates and mean changed tile ratio.
+void dirty_stats(unsigned int *frames, unsigned int *duplicates, double *changed_ratio);
+
+#endif // DIRTY_H
@@ -0,0 +1,289 @@
+
+#include <cstring>
+#include <cstdlib>
+#include <atomic>
+
+#include <sys/mman.h>
+
+#include <SDL2/SDL_mutex.h>
+
+#include "frame_arena.h"
+
+#define ARENA_MAX_BLOCKS 64
+#define MEM_MAX_GPU_ENTRIES 32
+#define MEM_MAX_SUBSYSTEMS 16
+
+struct arena_block {
+    void *ptr;
+    size_t capacity;
+    size_t used;
+    const char *owner; // subsystem name, static string
+    bool in_use;
+    bool mapped;       // came from mmap rather than posix_memalign
+    bool hugetlb;      // explicit huge pages
+};
+
+struct gpu_entry {
+    const char *subsystem;
+    const char *what;
+    size_t bytes;
+};
+
+static struct _arena {
+    SDL_mutex *mutex;
+    arena_block blocks[ARENA_MAX_BLOCKS];
+    gpu_entry gpu[MEM_MAX_GPU_ENTRIES];
+    unsigned int reused;
+    unsigned int mapped;
+} arena;
+
+// kept apart from the blocks so the totals can be read without the mutex
+static std::atomic<size_t> cpu_total, gpu_total;
+
+static size_t round_up(size_t x, size_t to)
+{
+    return (x + to - 1) / to * to;
+}
+
+void arena_init()
+{
+    memset(&arena, 0, sizeof arena);
+    arena.mutex = SDL_CreateMutex();
+    cpu_total = 0;
+    gpu_total = 0;
+}
+
+static void release_block(arena_block *b)
+{
+    if (b->mapped)
+        munmap(b->ptr, b->capacity);
+    else
+        free(b->ptr);
+    cpu_total -= b->capacity;
+    memset(b, 0, sizeof *b);
+}
+
+void arena_shutdown()
+{
+    for (int i = 0; i < ARENA_MAX_BLOCKS; i++) {
+        if (arena.blocks[i].ptr)
+            release_block(&arena.blocks[i]);
+    }
+    SDL_DestroyMutex(arena.mutex);
+    arena.mutex = 0;
+}
+
+static bool map_block(arena_block *b, size_t bytes)
+{
+    if (bytes < ARENA_HUGE_PAGE_SIZE) {
+        if (posix_memalign(&b->ptr, ARENA_ALIGNMENT, bytes))
+            return false;
+        b->capacity = bytes;
+        b->mapped = false;
+        b->hugetlb = false;
+        return true;
+    }
+
+    size_t len = round_up(bytes, ARENA_HUGE_PAGE_SIZE);
+    void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    // only succeeds when the admin reserved pages in /proc/sys/vm/nr_hugepages
+    p = mmap(0, len, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    b->hugetlb = p != MAP_FAILED;
+#endif
+    if (p == MAP_FAILED) {
+        p = mmap(0, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            return false;
+#ifdef MADV_HUGEPAGE
+        madvise(p, len, MADV_HUGEPAGE); // transparent huge pages, best effort
+#endif
+    }
+    b->ptr = p;
+    b->capacity = len;
+    b->mapped = true;
+    return true;
+}
+
+void* arena_alloc(size_t bytes, const char *subsystem)
+{
+    bytes = round_up(bytes, ARENA_ALIGNMENT);
+
+    SDL_LockMutex(arena.mutex);
+
+    // smallest cached block that fits
+    arena_block *best = 0;
+    arena_block *empty = 0;
+    for (int i = 0; i < ARENA_MAX_BLOCKS; i++) {
+        arena_block *b = &arena.blocks[i];
+        if (!b->ptr) {
+            if (!empty) empty = b;
+        } else if (!b->in_use && b->capacity >= bytes) {
+            if (!best || b->capacity < best->capacity)
+                best = b;
+        }
+    }
+
+    if (best) {
+        arena.reused++;
+    } else if (empty && map_block(empty, bytes)) {
+        best = empty;
+        arena.mapped++;
+        cpu_total += best->capacity;
+    } else {
+        SDL_UnlockMutex(arena.mutex);
+        fprintf(stderr, "arena: failed to allocate %zu bytes for %s\n", bytes, subsystem);
+        return 0;
+    }
+
+    best->in_use = true;
+    best->used = bytes;
+    best->owner = subsystem;
+    void *ptr = best->ptr;
+
+    SDL_UnlockMutex(arena.mutex);
+
+    memset(ptr, 0, bytes);
+    return ptr;
+}
+
+void arena_free(void *ptr)
+{
+    if (!ptr)
+        return;
+
+    SDL_LockMutex(arena.mutex);
+    for (int i = 0; i < ARENA_MAX_BLOCKS; i++) {
+        if (arena.blocks[i].ptr == ptr) {
+            arena.blocks[i].in_use = false;
+            arena.blocks[i].used = 0;
+            break;
+        }
+    }
+    SDL_UnlockMutex(arena.mutex);
+}
+
+void arena_trim()
+{
+    SDL_LockMutex(arena.mutex);
+    for (int i = 0; i < ARENA_MAX_BLOCKS; i++) {
+        if (arena.blocks[i].ptr && !arena.blocks[i].in_use)
+            release_block(&arena.blocks[i]);
+    }
+    SDL_UnlockMutex(arena.mutex);
+}
+
+void mem_track_gpu(const char *subsystem, const char *what, size_t bytes)
+{
+    SDL_LockMutex(arena.mutex);
+
+    gpu_entry *slot = 0;
+    for (int i = 0; i < MEM_MAX_GPU_ENTRIES; i++) {
+        gpu_entry *e = &arena.gpu[i];
+        if (e->subsystem && !strcmp(e->subsystem, subsystem) && !strcmp(e->what, what)) {
+            slot = e;
+            break;
+        }
+        if (!e->subsystem && !slot)
+            slot = e;
+    }
+
+    if (slot) {
+        gpu_total += bytes - slot->bytes; // wraps back for a smaller size
+        if (bytes) {
+            slot->subsystem = subsystem;
+            slot->what = what;
+            slot->bytes = bytes;
+        } else {
+            memset(slot, 0, sizeof *slot);
+        }
+    }
+
+    SDL_UnlockMutex(arena.mutex);
+}
+
+size_t mem_cpu_bytes()
+{
+    return cpu_total;
+}
+
+size_t mem_gpu_bytes()
+{
+    return gpu_total;
+}
+
+#define MB(x) ((x) / (1024.0 * 1024.0))
+
+void mem_report(FILE *out)
+{
+    const char *names[MEM_MAX_SUBSYSTEMS];
+    size_t cpu[MEM_MAX_SUBSYSTEMS], gpu[MEM_MAX_SUBSYSTEMS];
+    int nsub = 0;
+    size_t cached = 0, huge = 0;
+
+    SDL_LockMutex(arena.mutex);
+
+    fprintf(out, "memory report:\n");
+    for (int i = 0; i < ARENA_MAX_BLOCKS; i++) {
+        arena_block *b = &arena.blocks[i];
+        if (!b->ptr)
+            continue;
+        if (b->hugetlb)
+            huge += b->capacity;
+        if (!b->in_use) {
+            cached += b->capacity;
+            continue;
+        }
+        fprintf(out, "\tcpu %-10s %8.2f MB (%.2f MB used)%s\n", b->owner,
+                MB(b->capacity), MB(b->used), b->hugetlb ? " hugetlb" : "");
+    }
+    for (int i = 0; i < MEM_MAX_GPU_ENTRIES; i++) {
+        gpu_entry *e = &arena.gpu[i];
+        if (e->subsystem)
+            fprintf(out, "\tgpu %-10s %8.2f MB %s\n", e->subsystem, MB(e->bytes), e->what);
+    }
+
+    // per subsystem totals
+    for (int pass = 0; pass < 2; pass++) {
+        int n = pass == 0 ? ARENA_MAX_BLOCKS : MEM_MAX_GPU_ENTRIES;
+        for (int i = 0; i < n; i++) {
+            const char *owner;
+            size_t bytes;
+            if (pass == 0) {
+                if (!arena.blocks[i].in_use) continue;
+                owner = arena.blocks[i].owner;
+                bytes = arena.blocks[i].capacity;
+            } else {
+                if (!arena.gpu[i].subsystem) continue;
+                owner = arena.gpu[i].subsystem;
+                bytes = arena.gpu[i].bytes;
+            }
+            int s;
+            for (s = 0; s < nsub; s++) {
+                if (!strcmp(names[s], owner))
+                    break;
+            }
+            if (s == nsub) {
+                if (nsub == MEM_MAX_SUBSYSTEMS)
+                    continue;
+                names[s] = owner;
+                cpu[s] = gpu[s] = 0;
+                nsub++;
+            }
+            (pass == 0 ? cpu : gpu)[s] += bytes;
+        }
+    }
+
+    size_t cpu_total = 0, gpu_total = 0;
+    for (int s = 0; s < nsub; s++) {
+        fprintf(out, "\t%-14s cpu %8.2f MB  gpu %8.2f MB\n", names[s], MB(cpu[s]), MB(gpu[s]));
+        cpu_total += cpu[s];
+        gpu_total += gpu[s];
+    }
+    fprintf(out, "\t%-14s cpu %8.2f MB  gpu %8.2f MB\n", "total", MB(cpu_total), MB(gpu_total));
+    fprintf(out, "\tarena: %.2f MB cached for reuse, %.2f MB on huge pages, %u maps, %u reuses\n",
+            MB(cached), MB(huge), arena.mapped, arena.reused);
+
+    SDL_UnlockMutex(arena.mutex);
+}
@@ -0,0 +1,40 @@
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <cstddef>
+#include <cstdio>
+
+// Aligned arena for CPU side frame buffers.
+//
+// Large blocks are backed by huge pages where the kernel allows it (explicit
+// MAP_HUGETLB first, then transparent huge pages via madvise) to cut TLB
+// misses on full frame copies.  Released blocks stay mapped and are handed
+// back out to the next request that fits, so a resolution change reuses the
+// memory of the previous one instead of going back to the kernel.
+//
+// The arena also keeps the memory accounting for the player: every CPU block
+// is tagged with its owning subsystem and GPU allocations are registered with
+// mem_track_gpu() so mem_report() can itemize the real footprint.
+
+#define ARENA_ALIGNMENT 64
+#define ARENA_HUGE_PAGE_SIZE (2 << 20)
+
+void arena_init();
+void arena_shutdown();
+
+// returns a zeroed, ARENA_ALIGNMENT aligned buffer of at least bytes.
+void* arena_alloc(size_t bytes, const char *subsystem);
+void arena_free(void *ptr);
+
+// unmap cached blocks that are not in use.
+void arena_trim();
+
+// record (or replace) the size of a named GPU allocation; 0 removes it.
+void mem_track_gpu(const char *subsystem, const char *what, size_t bytes);
+
+// totals, lock free so the metrics server can read them any time
+size_t mem_cpu_bytes();
+size_t mem_gpu_bytes();
+void mem_report(FILE *out);
+
+#endif // FRAME_ARENA_H
@@ -0,0 +1,262 @@
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#include <SDL2/SDL_mutex.h>
+#ifdef HAVE_LZ4
+# include <lz4.h>
+#endif
+
+#include "framecache.h"
+#include "frame_arena.h"
+#include "log.h"
+
+static const char *storage_names[MAX_FRAMECACHE_STORAGE] = { "raw", "lz4", "gpu" };
+
+struct cached_frame {
+    uint8_t *data;  // tightly packed or compressed, 0 once it is a texture
+    size_t size;    // what it counts against the budget
+    GLuint texture;
+};
+
+static struct _cache {
+    SDL_mutex *mutex;
+    size_t budget;
+    framecache_storage_t storage;
+    int width, height;
+    std::vector<cached_frame> frames;
+    std::vector<GLuint> dead; // textures to delete on the render thread
+    size_t bytes;             // stored, compressed
+    int uploaded;             // frames before this one are textures
+    size_t tracked;           // texture bytes last given to mem_track_gpu
+    bool overflowed;
+    std::vector<uint8_t> packed, compressed; // decoding thread scratch
+    std::vector<uint8_t> unpacked;           // render thread scratch
+} cache;
+
+#define MB(x) ((x) / (1024.0 * 1024.0))
+
+bool framecache_parse(const char *arg, size_t *budget, framecache_storage_t *storage)
+{
+    char *end;
+    long mb = strtol(arg, &end, 10);
+    if (end == arg || mb <= 0)
+        return false;
+    *budget = (size_t)mb << 20;
+    *storage = FRAMECACHE_RAW;
+    if (!*end)
+        return true;
+    if (*end != ',')
+        return false;
+    for (int i = 0; i < MAX_FRAMECACHE_STORAGE; i++) {
+        if (!strcmp(end + 1, storage_names[i])) {
+            *storage = (framecache_storage_t)i;
+#ifndef HAVE_LZ4
+            if (*storage == FRAMECACHE_LZ4) {
+                fprintf(stderr, "frame cache: built without liblz4.\n");
+                return false;
+            }
+#endif
+            return true;
+        }
+    }
+    return false;
+}
+
+void framecache_init(size_t budget, framecache_storage_t storage)
+{
+    cache.mutex = SDL_CreateMutex();
+    cache.budget = budget;
+    cache.storage = storage;
+}
+
+// with cache.mutex held
+static void drop_frames()
+{
+    for (size_t i = 0; i < cache.frames.size(); i++) {
+        free(cache.frames[i].data);
+        if (cache.frames[i].texture)
+            cache.dead.push_back(cache.frames[i].texture);
+    }
+    cache.frames.clear();
+    cache.bytes = 0;
+    cache.uploaded = 0;
+}
+
+void framecache_reset(int width, int height)
+{
+    SDL_LockMutex(cache.mutex);
+    drop_frames();
+    if (width != cache.width || height != cache.height)
+        cache.overflowed = false; // another size might fit
+    cache.width = width;
+    cache.height = height;
+    SDL_UnlockMutex(cache.mutex);
+}
+
+bool framecache_add(const uint8_t *pixels, int pitch)
+{
+    // framecache_reset() may change these on the render thread
+    SDL_LockMutex(cache.mutex);
+    bool overflowed = cache.overflowed;
+    int width = cache.width, height = cache.height;
+    SDL_UnlockMutex(cache.mutex);
+    if (overflowed)
+        return false;
+
+    // pack the rows, and compress them for LZ4 storage
+    size_t row = width * 4;
+    size_t raw = row * height;
+    cache.packed.resize(raw);
+    for (int y = 0; y < height; y++)
+        memcpy(&cache.packed[y * row], pixels + y * pitch, row);
+    const uint8_t *src = &cache.packed[0];
+    size_t size = raw;
+#ifdef HAVE_LZ4
+    if (cache.storage == FRAMECACHE_LZ4) {
+        cache.compressed.resize(LZ4_compressBound(raw));
+        int n = LZ4_compress_default((const char*)src, (char*)&cache.compressed[0], raw,
+                cache.compressed.size());
+        if (n > 0 && (size_t)n < raw) { // stored as is otherwise
+            src = &cache.compressed[0];
+            size = n;
+        }
+    }
+#endif
+
+    // the copy is made before taking the lock, which the render thread
+    // takes every frame
+    uint8_t *data = (uint8_t*)malloc(size);
+    if (data)
+        memcpy(data, src, size);
+
+    SDL_LockMutex(cache.mutex);
+    if (cache.overflowed || width != cache.width || height != cache.height) {
+        // reset meanwhile, the frame is of the cache before
+        overflowed = cache.overflowed;
+        SDL_UnlockMutex(cache.mutex);
+        free(data);
+        return !overflowed;
+    }
+    if (!data || cache.bytes + size > cache.budget) {
+        free(data);
+        fprintf(stderr, "frame cache: %.0f MB budget exceeded after %d frames, decoding every pass.\n",
+                MB(cache.budget), (int)cache.frames.size());
+        drop_frames();
+        cache.overflowed = true;
+        SDL_UnlockMutex(cache.mutex);
+        return false;
+    }
+    cached_frame f = { data, size, 0 };
+    cache.frames.push_back(f);
+    cache.bytes += size;
+    SDL_UnlockMutex(cache.mutex);
+    return true;
+}
+
+bool framecache_overflowed()
+{
+    SDL_LockMutex(cache.mutex);
+    bool overflowed = cache.overflowed;
+    SDL_UnlockMutex(cache.mutex);
+    return overflowed;
+}
+
+int framecache_count()
+{
+    SDL_LockMutex(cache.mutex);
+    int count = cache.frames.size();
+    SDL_UnlockMutex(cache.mutex);
+    return count;
+}
+
+void framecache_update()
+{
+    SDL_LockMutex(cache.mutex);
+    if (!cache.dead.empty()) {
+        glDeleteTextures(cache.dead.size(), &cache.dead[0]);
+        cache.dead.clear();
+    }
+    if (cache.storage == FRAMECACHE_GPU) {
+        int end = std::min((int)cache.frames.size(), cache.uploaded + FRAMECACHE_UPLOADS_PER_FRAME);
+        for (; cache.uploaded < end; cache.uploaded++) {
+            cached_frame &f = cache.frames[cache.uploaded];
+            glGenTextures(1, &f.texture);
+            glBindTexture(GL_TEXTURE_2D, f.texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, cache.width, cache.height, 0,
+                    GL_BGRA, GL_UNSIGNED_BYTE, f.data);
+            free(f.data);
+            f.data = 0;
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        size_t bytes = (size_t)cache.uploaded * cache.width * cache.height * 4;
+        if (bytes != cache.tracked) {
+            mem_track_gpu("framecache", "frames", bytes);
+            cache.tracked = bytes;
+        }
+    }
+    SDL_UnlockMutex(cache.mutex);
+}
+
+bool framecache_read(int index, uint8_t *pixels, int pitch)
+{
+    SDL_LockMutex(cache.mutex);
+    if (index < 0 || index >= (int)cache.frames.size() || !cache.frames[index].data) {
+        SDL_UnlockMutex(cache.mutex);
+        return false;
+    }
+    const cached_frame &f = cache.frames[index];
+    size_t row = cache.width * 4;
+    const uint8_t *src = f.data;
+#ifdef HAVE_LZ4
+    if (cache.storage == FRAMECACHE_LZ4 && f.size < row * cache.height) {
+        cache.unpacked.resize(row * cache.height);
+        LZ4_decompress_safe((const char*)f.data, (char*)&cache.unpacked[0], f.size,
+                cache.unpacked.size());
+        src = &cache.unpacked[0];
+    }
+#endif
+    for (int y = 0; y < cache.height; y++)
+        memcpy(pixels + y * pitch, src + y * row, row);
+    SDL_UnlockMutex(cache.mutex);
+    return true;
+}
+
+GLuint framecache_texture(int index)
+{
+    SDL_LockMutex(cache.mutex);
+    GLuint texture = index >= 0 && index < (int)cache.frames.size() ? cache.frames[index].texture : 0;
+    SDL_UnlockMutex(cache.mutex);
+    return texture;
+}
+
+static void describe(char *text, size_t size)
+{
+    SDL_LockMutex(cache.mutex);
+    size_t raw = (size_t)cache.frames.size() * cache.width * cache.height * 4;
+    snprintf(text, size, "frame cache: %d frames %dx%d, %s, %.1f MB of %.0f MB (%.1f MB decoded)%s",
+            (int)cache.frames.size(), cache.width, cache.height, storage_names[cache.storage],
+            MB(cache.bytes), MB(cache.budget), MB(raw), cache.overflowed ? ", over budget" : "");
+    SDL_UnlockMutex(cache.mutex);
+}
+
+void framecache_report(FILE *out)
+{
+    if (!cache.mutex)
+        return;
+    char text[256];
+    describe(text, sizeof text);
+    fprintf(out, "%s\n", text);
+}
+
+void framecache_log()
+{
+    if (!cache.mutex)
+        return;
+    char text[256];
+    describe(text, sizeof text);
+    log_info("%s", text);
+}
@@ -0,0 +1,57 @@
+#ifndef FRAMECACHE_H
+#define FRAMECACHE_H
+
+#include <cstdio>
+#include <cstddef>
+#include <stdint.h>
+
+#include <GL/glew.h>
+
+// Decoded frames of a looping clip.
+//
+// During the first pass every frame is copied out of the staging buffer as
+// it was prepared for upload (BGRA, bottom row first, or the YUV rows of -b)
+// and kept in order, either as is, LZ4 compressed (when built with liblz4)
+// or, BGRA only, as a texture of its own.  Later passes and frame stepping take frames from here instead of
+// decoding them.  When the next frame would exceed the memory budget the
+// cache is dropped and stays off, playback keeps decoding.
+//
+// Frames are added on VLC's decoding thread and read on the render thread.
+// GPU storage keeps a frame in memory until framecache_update() on the
+// render thread has made it a texture, textures are also only deleted there.
+
+#define FRAMECACHE_DEFAULT_BUDGET (1024 << 20) // bytes
+#define FRAMECACHE_UPLOADS_PER_FRAME 2         // frames moved into textures per framecache_update()
+
+typedef enum {
+    FRAMECACHE_RAW,
+    FRAMECACHE_LZ4,
+    FRAMECACHE_GPU,
+    MAX_FRAMECACHE_STORAGE
+} framecache_storage_t;
+
+// "<MB>[,raw|lz4|gpu]", false for anything else or lz4 without liblz4
+bool framecache_parse(const char *arg, size_t *budget, framecache_storage_t *storage);
+void framecache_init(size_t budget, framecache_storage_t storage);
+
+// Drop every frame and start over with frames of width x height.
+void framecache_reset(int width, int height);
+// Keep a copy of a frame, rows pitch bytes apart.  false once the budget is
+// exceeded, the cache is empty and disabled from then on.
+bool framecache_add(const uint8_t *pixels, int pitch);
+bool framecache_overflowed();
+int framecache_count();
+
+// Render thread, every frame: textures for GPU storage, deferred deletes.
+void framecache_update();
+// Copy frame index into pixels (pitch bytes per row), false when it is only
+// available as a texture.
+bool framecache_read(int index, uint8_t *pixels, int pitch);
+// The frame's texture, width x height, 0 unless stored on the GPU.
+GLuint framecache_texture(int index);
+
+void framecache_report(FILE *out);
+// The same line through the logger, for the render thread.
+void framecache_log();
+
+#endif // FRAMECACHE_H
@@ -0,0 +1,590 @@
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <dirent.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_mutex.h>
+#ifdef HAVE_PNG
+# include <png.h>
+#endif
+
+#include "imageseq.h"
+#include "log.h"
+
+#define STALL_WAIT_MS 100 // for a missing frame, between checks for shutdown
+#define MB(x) ((x) / (1024.0 * 1024.0))
+
+struct seq_frame {
+    uint8_t *pixels; // BGRA, 0 until decoded
+    bool decoding;
+    bool failed;     // unreadable or of another size, the frame before stays
+    int pinned;      // being delivered
+};
+
+struct seq_worker {
+    SDL_Thread *thread;
+    unsigned int frames;
+    unsigned long long read_bytes;
+    Uint64 busy; // performance counter ticks reading and decoding
+};
+
+static struct _seq {
+    std::vector<std::string> paths;
+    std::vector<seq_frame> frames;
+    int width, height;
+    size_t frame_bytes;
+    double fps;
+    size_t budget;
+    size_t bytes; // cached and being decoded
+    int nworkers;
+    seq_worker workers[IMAGESEQ_MAX_WORKERS];
+    SDL_Thread *player;
+    imageseq_deliver_cb deliver;
+
+    SDL_mutex *mutex;
+    SDL_cond *work;    // playhead moved, cache room, shutdown
+    SDL_cond *decoded; // a frame arrived
+    SDL_cond *control; // seek, pause, step, shutdown
+    bool stop;
+    int playhead;      // frame due
+    int shown;         // delivered last, -1 none
+    int stalled;       // frame the clock is held for, -1 none
+    bool paused;
+    double start;      // ticks the playhead became due
+
+    unsigned int delivered, stalls, failures;
+    unsigned int scrub_hits, scrub_misses;
+    Uint32 stall_ms;
+} seq;
+
+bool imageseq_parse(const char *arg, double *fps, size_t *budget, int *workers)
+{
+    double f = IMAGESEQ_DEFAULT_FPS;
+    int mb = IMAGESEQ_DEFAULT_BUDGET >> 20, n = 0;
+    if (sscanf(arg, "%lf,%d,%d", &f, &mb, &n) < 1 || f <= 0 || mb <= 0 || n < 0)
+        return false;
+    *fps = f;
+    *budget = (size_t)mb << 20;
+    *workers = std::min(n, IMAGESEQ_MAX_WORKERS);
+    return true;
+}
+
+bool imageseq_is_sequence(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// Decoders: the frame's size into *width, *height, and with pixels set the
+// frame as BGRA, top row first, when it is seq.width x seq.height.
+
+static bool decode_ppm(const std::vector<uint8_t> &file, uint8_t *pixels, int *width, int *height)
+{
+    size_t pos = 2;
+    int v[3];
+    for (int i = 0; i < 3; i++) {
+        while (pos < file.size() && (isspace(file[pos]) || file[pos] == '#')) {
+            if (file[pos] == '#') {
+                while (pos < file.size() && file[pos] != '\n')
+                    pos++;
+            } else {
+                pos++;
+            }
+        }
+        if (pos >= file.size() || !isdigit(file[pos]))
+            return false;
+        for (v[i] = 0; pos < file.size() && isdigit(file[pos]); pos++)
+            v[i] = v[i] * 10 + file[pos] - '0';
+    }
+    pos++; // one whitespace before the samples
+    *width = v[0];
+    *height = v[1];
+    int maxval = v[2];
+    if (maxval <= 0 || maxval > 65535)
+        return false;
+    if (!pixels)
+        return true;
+
+    // 16 bit samples are big endian
+    int bytes = maxval < 256 ? 1 : 2;
+    size_t count = (size_t)v[0] * v[1];
+    if (v[0] != seq.width || v[1] != seq.height || file.size() < pos + count * 3 * bytes)
+        return false;
+    const uint8_t *src = &file[pos];
+    for (size_t i = 0; i < count; i++, src += 3 * bytes) {
+        for (int c = 0; c < 3; c++) {
+            int s = bytes == 1 ? src[c] : src[2 * c] << 8 | src[2 * c + 1];
+            pixels[4 * i + 2 - c] = s * 255 / maxval;
+        }
+        pixels[4 * i + 3] = 255;
+    }
+    return true;
+}
+
+// SMPTE 268M, RGB(A) elements of 8, 10 (filled, method A) or 16 bits
+static bool decode_dpx(const std::vector<uint8_t> &file, uint8_t *pixels, int *width, int *height)
+{
+    if (file.size() < 812)
+        return false;
+    bool big = file[0] == 'S';
+    const uint8_t *d = &file[0];
+    #define DPX32(o) (big ? (uint32_t)d[o] << 24 | d[(o) + 1] << 16 | d[(o) + 2] << 8 | d[(o) + 3] : \
+            (uint32_t)d[(o) + 3] << 24 | d[(o) + 2] << 16 | d[(o) + 1] << 8 | d[o])
+    #define DPX16(o) (big ? d[o] << 8 | d[(o) + 1] : d[(o) + 1] << 8 | d[o])
+
+    *width = DPX32(772);
+    *height = DPX32(776);
+    int descriptor = d[800], bits = d[803];
+    int packing = DPX16(804), encoding = DPX16(806);
+    uint32_t offset = DPX32(808);
+    if (!offset)
+        offset = DPX32(4);
+    int channels = descriptor == 50 ? 3 : descriptor == 51 ? 4 : 0;
+    if (!channels || encoding != 0 || (bits != 8 && bits != 10 && bits != 16) ||
+            (bits == 10 && (channels != 3 || packing != 1)))
+        return false;
+    if (!pixels)
+        return true;
+    if (*width != seq.width || *height != seq.height)
+        return false;
+
+    size_t row = bits == 10 ? (size_t)*width * 4 : (size_t)*width * channels * bits / 8;
+    if (packing == 1)
+        row = (row + 3) & ~(size_t)3;
+    if (file.size() < offset + row * *height)
+        return false;
+    for (int y = 0; y < *height; y++) {
+        const uint8_t *src = d + offset + y * row;
+        uint8_t *dst = pixels + (size_t)y * *width * 4;
+        for (int x = 0; x < *width; x++, dst += 4) {
+            int r, g, b, a = 255;
+            if (bits == 10) {
+                uint32_t w = big ? (uint32_t)src[4 * x] << 24 | src[4 * x + 1] << 16 |
+                    src[4 * x + 2] << 8 | src[4 * x + 3] :
+                    (uint32_t)src[4 * x + 3] << 24 | src[4 * x + 2] << 16 |
+                    src[4 * x + 1] << 8 | src[4 * x];
+                r = w >> 24;
+                g = w >> 14 & 0xff;
+                b = w >> 4 & 0xff;
+            } else if (bits == 8) {
+                const uint8_t *p = src + x * channels;
+                r = p[0];
+                g = p[1];
+                b = p[2];
+                if (channels == 4)
+                    a = p[3];
+            } else {
+                // the high byte of each sample
+                const uint8_t *p = src + x * channels * 2 + (big ? 0 : 1);
+                r = p[0];
+                g = p[2];
+                b = p[4];
+                if (channels == 4)
+                    a = p[6];
+            }
+            dst[0] = b;
+            dst[1] = g;
+            dst[2] = r;
+            dst[3] = a;
+        }
+    }
+    return true;
+    #undef DPX32
+    #undef DPX16
+}
+
+#ifdef HAVE_PNG
+static bool decode_png(const std::vector<uint8_t> &file, uint8_t *pixels, int *width, int *height)
+{
+    png_image image;
+    memset(&image, 0, sizeof image);
+    image.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_memory(&image, &file[0], file.size()))
+        return false;
+    *width = image.width;
+    *height = image.height;
+    if (!pixels || *width != seq.width || *height != seq.height) {
+        png_image_free(&image);
+        return !pixels;
+    }
+    image.format = PNG_FORMAT_BGRA;
+    return png_image_finish_read(&image, 0, pixels, seq.width * 4, 0) != 0;
+}
+#endif
+
+static bool decode_file(const char *path, uint8_t *pixels, int *width, int *height, size_t *read)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return false;
+    std::vector<uint8_t> file;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size > 0) {
+        file.resize(size);
+        file.resize(fread(&file[0], 1, size, f));
+    }
+    fclose(f);
+    *read = file.size();
+    if (file.size() < 8)
+        return false;
+
+    if (file[0] == 'P' && file[1] == '6')
+        return decode_ppm(file, pixels, width, height);
+    if (!memcmp(&file[0], "SDPX", 4) || !memcmp(&file[0], "XPDS", 4))
+        return decode_dpx(file, pixels, width, height);
+#ifdef HAVE_PNG
+    if (!memcmp(&file[0], "\x89PNG", 4))
+        return decode_png(file, pixels, width, height);
+#endif
+    return false;
+}
+
+static bool playable(const char *name)
+{
+    const char *ext = strrchr(name, '.');
+    if (!ext)
+        return false;
+#ifdef HAVE_PNG
+    if (!strcasecmp(ext, ".png"))
+        return true;
+#endif
+    return !strcasecmp(ext, ".dpx") || !strcasecmp(ext, ".ppm");
+}
+
+static bool by_number(const std::string &a, const std::string &b)
+{
+    return strverscmp(a.c_str(), b.c_str()) < 0;
+}
+
+bool imageseq_open(const char *dir, double fps, size_t budget, int workers)
+{
+    DIR *d = opendir(dir);
+    if (!d)
+        return false;
+    struct dirent *e;
+    while ((e = readdir(d)) != 0) {
+        if (playable(e->d_name))
+            seq.paths.push_back(std::string(dir) + "/" + e->d_name);
+    }
+    closedir(d);
+    if (seq.paths.empty()) {
+        fprintf(stderr, "image sequence: no .dpx or .ppm%s frames in %s\n",
+#ifdef HAVE_PNG
+                " or .png",
+#else
+                "",
+#endif
+                dir);
+        return false;
+    }
+    std::sort(seq.paths.begin(), seq.paths.end(), by_number);
+
+    size_t read;
+    if (!decode_file(seq.paths[0].c_str(), 0, &seq.width, &seq.height, &read) ||
+            seq.width <= 0 || seq.height <= 0) {
+        fprintf(stderr, "image sequence: can't read %s\n", seq.paths[0].c_str());
+        return false;
+    }
+    seq.frame_bytes = (size_t)seq.width * seq.height * 4;
+    seq.frames.assign(seq.paths.size(), seq_frame());
+    seq.fps = fps;
+    seq.budget = std::max(budget, seq.frame_bytes * 2);
+    seq.nworkers = workers ? workers :
+        std::max(1, std::min(SDL_GetCPUCount() - 1, IMAGESEQ_MAX_WORKERS));
+    seq.shown = seq.stalled = -1;
+    seq.mutex = SDL_CreateMutex();
+    seq.work = SDL_CreateCond();
+    seq.decoded = SDL_CreateCond();
+    seq.control = SDL_CreateCond();
+    printf("image sequence: %d frames %dx%d at %g fps, %d decode workers, %.0f MB cache\n",
+            (int)seq.frames.size(), seq.width, seq.height, seq.fps, seq.nworkers, MB(seq.budget));
+    return true;
+}
+
+int imageseq_width() { return seq.width; }
+int imageseq_height() { return seq.height; }
+int imageseq_frames() { return seq.frames.size(); }
+double imageseq_fps() { return seq.fps; }
+
+static int wrap(int i)
+{
+    int n = seq.frames.size();
+    return (i % n + n) % n;
+}
+
+// Position in the prefetch order around the playhead, two ahead for each
+// one behind, -1 outside the window.  With seq.mutex held.
+static int window_rank(int i)
+{
+    int ahead = wrap(i - seq.playhead), behind = wrap(seq.playhead - i);
+    int rank = -1;
+    if (ahead <= IMAGESEQ_AHEAD)
+        rank = ahead + ahead / 2;
+    if (behind > 0 && behind <= IMAGESEQ_BEHIND && (rank < 0 || 3 * behind - 1 < rank))
+        rank = 3 * behind - 1;
+    return rank;
+}
+
+// How readily a cached frame gives up its memory, higher first: outside
+// the window by distance, then by rank.
+static int evict_score(int i)
+{
+    int rank = window_rank(i);
+    if (rank >= 0)
+        return rank;
+    return 3 * (IMAGESEQ_AHEAD + IMAGESEQ_BEHIND) +
+        std::min(wrap(i - seq.playhead), wrap(seq.playhead - i));
+}
+
+// Next frame to decode, with room made for it, -1 when there's none.
+static int next_job()
+{
+    int n = seq.frames.size();
+    int best = -1, best_rank = 0;
+    for (int d = -std::min(IMAGESEQ_BEHIND, n - 1); d <= std::min(IMAGESEQ_AHEAD, n - 1); d++) {
+        int i = wrap(seq.playhead + d);
+        const seq_frame &f = seq.frames[i];
+        if (f.pixels || f.decoding || f.failed)
+            continue;
+        int rank = window_rank(i);
+        if (rank >= 0 && (best < 0 || rank < best_rank)) {
+            best = i;
+            best_rank = rank;
+        }
+    }
+    if (best < 0)
+        return -1;
+
+    while (seq.bytes + seq.frame_bytes > seq.budget) {
+        int victim = -1, victim_score = best_rank;
+        for (int i = 0; i < n; i++) {
+            const seq_frame &f = seq.frames[i];
+            if (f.pixels && !f.pinned && evict_score(i) > victim_score) {
+                victim = i;
+                victim_score = evict_score(i);
+            }
+        }
+        if (victim < 0)
+            return -1; // everything cached is nearer
+        free(seq.frames[victim].pixels);
+        seq.frames[victim].pixels = 0;
+        seq.bytes -= seq.frame_bytes;
+    }
+    return best;
+}
+
+static int worker_main(void *arg)
+{
+    seq_worker *w = (seq_worker*)arg;
+
+    SDL_LockMutex(seq.mutex);
+    while (!seq.stop) {
+        int index = next_job();
+        if (index < 0) {
+            SDL_CondWait(seq.work, seq.mutex);
+            continue;
+        }
+        seq.frames[index].decoding = true;
+        seq.bytes += seq.frame_bytes;
+        std::string path = seq.paths[index];
+        SDL_UnlockMutex(seq.mutex);
+
+        Uint64 t0 = SDL_GetPerformanceCounter();
+        uint8_t *pixels = (uint8_t*)malloc(seq.frame_bytes);
+        int width, height;
+        size_t read = 0;
+        bool ok = pixels && decode_file(path.c_str(), pixels, &width, &height, &read);
+        Uint64 t1 = SDL_GetPerformanceCounter();
+
+        SDL_LockMutex(seq.mutex);
+        w->busy += t1 - t0;
+        w->frames++;
+        w->read_bytes += read;
+        seq_frame &f = seq.frames[index];
+        f.decoding = false;
+        if (ok) {
+            f.pixels = pixels;
+        } else {
+            if (!seq.failures++)
+                log_warn("image sequence: can't read %s as a %dx%d frame, skipped",
+                        path.c_str(), seq.width, seq.height);
+            free(pixels);
+            f.failed = true;
+            seq.bytes -= seq.frame_bytes;
+        }
+        SDL_CondBroadcast(seq.decoded);
+    }
+    SDL_UnlockMutex(seq.mutex);
+    return 0;
+}
+
+static int player_main(void *)
+{
+    SDL_LockMutex(seq.mutex);
+    while (!seq.stop) {
+        double now = SDL_GetTicks();
+        double period = 1000 / seq.fps;
+        if (!seq.paused && seq.shown == seq.playhead && now - seq.start >= period) {
+            // frames are skipped only if delivering fell behind the clock
+            int due = (int)((now - seq.start) / period);
+            seq.playhead = wrap(seq.playhead + due);
+            seq.start += due * period;
+            SDL_CondBroadcast(seq.work);
+        }
+
+        int index = seq.playhead;
+        if (index != seq.shown) {
+            seq_frame &f = seq.frames[index];
+            if (f.failed) {
+                seq.shown = index;
+                continue;
+            }
+            if (!f.pixels) {
+                // the clock holds until the frame is there
+                if (seq.stalled != index) {
+                    seq.stalled = index;
+                    seq.stalls++;
+                }
+                Uint32 t = SDL_GetTicks();
+                SDL_CondWaitTimeout(seq.decoded, seq.mutex, STALL_WAIT_MS);
+                seq.stall_ms += SDL_GetTicks() - t;
+                seq.start = SDL_GetTicks();
+                continue;
+            }
+            f.pinned++;
+            SDL_UnlockMutex(seq.mutex);
+            seq.deliver(f.pixels, seq.width * 4);
+            SDL_LockMutex(seq.mutex);
+            f.pinned--;
+            seq.shown = index;
+            seq.stalled = -1;
+            seq.delivered++;
+            continue;
+        }
+
+        double wait = seq.paused ? STALL_WAIT_MS : seq.start + period - SDL_GetTicks();
+        SDL_CondWaitTimeout(seq.control, seq.mutex, (Uint32)std::max(1.0, wait));
+    }
+    SDL_UnlockMutex(seq.mutex);
+    return 0;
+}
+
+void imageseq_start(imageseq_deliver_cb deliver)
+{
+    seq.deliver = deliver;
+    seq.start = SDL_GetTicks();
+    for (int i = 0; i < seq.nworkers; i++)
+        seq.workers[i].thread = SDL_CreateThread(worker_main, "imageseq", &seq.workers[i]);
+    seq.player = SDL_CreateThread(player_main, "imageseq play", 0);
+}
+
+void imageseq_close()
+{
+    if (!seq.mutex)
+        return;
+    SDL_LockMutex(seq.mutex);
+    seq.stop = true;
+    SDL_CondBroadcast(seq.work);
+    SDL_CondBroadcast(seq.decoded);
+    SDL_CondBroadcast(seq.control);
+    SDL_UnlockMutex(seq.mutex);
+    for (int i = 0; i < seq.nworkers; i++) {
+        if (seq.workers[i].thread)
+            SDL_WaitThread(seq.workers[i].thread, 0);
+        seq.workers[i].thread = 0;
+    }
+    if (seq.player)
+        SDL_WaitThread(seq.player, 0);
+    seq.player = 0;
+    for (size_t i = 0; i < seq.frames.size(); i++) {
+        free(seq.frames[i].pixels);
+        seq.frames[i].pixels = 0;
+    }
+    seq.bytes = 0;
+}
+
+long long imageseq_time()
+{
+    return (long long)(seq.playhead * 1000 / seq.fps);
+}
+
+long long imageseq_length()
+{
+    return (long long)(seq.frames.size() * 1000 / seq.fps);
+}
+
+// with seq.mutex held
+static void move_playhead(int index)
+{
+    seq.playhead = wrap(index);
+    seq.start = SDL_GetTicks();
+    SDL_CondBroadcast(seq.work);
+    SDL_CondBroadcast(seq.control);
+}
+
+void imageseq_seek(long long ms)
+{
+    SDL_LockMutex(seq.mutex);
+    int index = std::min((int)seq.frames.size() - 1, std::max(0, (int)(ms * seq.fps / 1000)));
+    if (seq.frames[index].pixels)
+        seq.scrub_hits++;
+    else
+        seq.scrub_misses++;
+    move_playhead(index);
+    SDL_UnlockMutex(seq.mutex);
+}
+
+void imageseq_set_pause(bool paused)
+{
+    SDL_LockMutex(seq.mutex);
+    seq.paused = paused;
+    move_playhead(seq.playhead);
+    SDL_UnlockMutex(seq.mutex);
+}
+
+bool imageseq_paused()
+{
+    return seq.paused;
+}
+
+void imageseq_step(int delta)
+{
+    SDL_LockMutex(seq.mutex);
+    seq.paused = true;
+    move_playhead((seq.shown >= 0 ? seq.shown : seq.playhead) + delta);
+    SDL_UnlockMutex(seq.mutex);
+}
+
+void imageseq_report(FILE *out)
+{
+    if (!seq.mutex)
+        return;
+    SDL_LockMutex(seq.mutex);
+    int cached = 0;
+    for (size_t i = 0; i < seq.frames.size(); i++)
+        cached += seq.frames[i].pixels != 0;
+    fprintf(out, "image sequence: %u frames shown, %u stalls (%.1fs), %u unreadable, "
+            "scrubs %u cached / %u not, %d frames %.0f MB of %.0f MB cached\n",
+            seq.delivered, seq.stalls, seq.stall_ms / 1000.0, seq.failures,
+            seq.scrub_hits, seq.scrub_misses, cached, MB(seq.bytes), MB(seq.budget));
+    double total = 0;
+    for (int i = 0; i < seq.nworkers; i++) {
+        const seq_worker &w = seq.workers[i];
+        double seconds = (double)w.busy / SDL_GetPerformanceFrequency();
+        double fps = seconds > 0 ? w.frames / seconds : 0;
+        total += fps;
+        fprintf(out, "  worker %d: %u frames, %.1f fps, %.1f MB/s read\n", i, w.frames, fps,
+                seconds > 0 ? MB(w.read_bytes) / seconds : 0);
+    }
+    fprintf(out, "  decode capacity %.1f fps for %g fps playback\n", total, seq.fps);
+    SDL_UnlockMutex(seq.mutex);
+}
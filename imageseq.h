@@ -0,0 +1,62 @@
+#ifndef IMAGESEQ_H
+#define IMAGESEQ_H
+
+#include <cstdio>
+#include <cstddef>
+#include <stdint.h>
+
+// Image sequences.
+//
+// A directory of per frame renders (PNG when built with libpng, DPX, binary
+// PPM), in file name order, played as a video.  VLC reads these one file at a
+// time with no lookahead; here a pool of workers decodes frames to BGRA into
+// a cache of at most a byte budget, nearest to the playhead first, two
+// ahead for each one behind, within IMAGESEQ_AHEAD frames ahead and
+// IMAGESEQ_BEHIND behind.  Frames stay cached until the budget needs room,
+// which frames outside the window and then the farthest give up first, so
+// scrubbing anywhere near or already played is instant.
+//
+// A playback thread paced by the sequence's frame rate hands the frame due
+// to a callback, which feeds it through the same path as VLC's decoded
+// frames.  A frame that isn't decoded yet holds the clock (a stall) instead
+// of being skipped.  The sequence loops.
+
+#define IMAGESEQ_AHEAD 48  // frames
+#define IMAGESEQ_BEHIND 24
+#define IMAGESEQ_MAX_WORKERS 16
+#define IMAGESEQ_DEFAULT_FPS 24
+#define IMAGESEQ_DEFAULT_BUDGET (2048ULL << 20) // bytes
+
+// Playback thread: BGRA, top row first, rows pitch bytes apart.
+typedef void (*imageseq_deliver_cb)(const uint8_t *pixels, int pitch);
+
+// "<fps>[,<MB>[,<workers>]]", workers 0 for the CPU count
+bool imageseq_parse(const char *arg, double *fps, size_t *budget, int *workers);
+// a directory, played as a sequence
+bool imageseq_is_sequence(const char *path);
+
+// Lists the frames and reads the first one for the size; false when there
+// is nothing playable.
+bool imageseq_open(const char *dir, double fps, size_t budget, int workers);
+int imageseq_width();
+int imageseq_height();
+int imageseq_frames();
+double imageseq_fps();
+
+// Workers and playback from frame 0.
+void imageseq_start(imageseq_deliver_cb deliver);
+void imageseq_close();
+
+// Any thread.  Times are ms into the sequence.
+long long imageseq_time();
+long long imageseq_length();
+void imageseq_seek(long long ms);
+void imageseq_set_pause(bool paused);
+bool imageseq_paused();
+// Pause and show the frame delta frames from the one shown.
+void imageseq_step(int delta);
+
+// Decode throughput per worker, stalls and cache use.
+void imageseq_report(FILE *out);
+
+#endif // IMAGESEQ_H
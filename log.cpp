@@ -0,0 +1,187 @@
+#include <cstdio>
+#include <cstdarg>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+#include <SDL2/SDL.h>
+
+#include "log.h"
+
+struct log_record {
+    unsigned long long seq; // across threads, for the write order
+    int level;
+    bool more;              // the line goes on in the next record
+    char text[LOG_TEXT];
+};
+
+// single producer (the owning thread), single consumer (the flush thread)
+struct log_ring {
+    std::atomic<bool> owned;
+    std::atomic<unsigned int> head; // next record written
+    std::atomic<unsigned int> tail; // next record flushed
+    log_record records[LOG_RING];
+};
+
+static std::atomic<log_ring*> rings[LOG_MAX_THREADS];
+static std::atomic<unsigned long long> seq;
+static std::atomic<unsigned long long> dropped;
+static std::atomic<bool> running, stop;
+static SDL_Thread *flusher;
+
+// Gives the ring back when its thread exits, another thread may take it
+// over with whatever it still holds.
+struct log_owner {
+    log_ring *ring;
+    ~log_owner()
+    {
+        if (ring)
+            ring->owned = false;
+    }
+};
+static thread_local log_owner owner;
+
+static log_ring *claim_ring()
+{
+    for (int i = 0; i < LOG_MAX_THREADS; i++) {
+        log_ring *r = rings[i];
+        if (!r) {
+            log_ring *fresh = (log_ring*)calloc(1, sizeof(log_ring));
+            if (!fresh)
+                return 0;
+            fresh->owned = true;
+            if (rings[i].compare_exchange_strong(r, fresh))
+                return fresh;
+            free(fresh); // another thread got the slot first
+        }
+        bool free_ring = false;
+        if (r->owned.compare_exchange_strong(free_ring, true))
+            return r;
+    }
+    return 0;
+}
+
+static void write_text(int level, const char *text, bool more)
+{
+    FILE *out = level >= LOG_WARN ? stderr : stdout;
+    if (out == stderr)
+        fflush(stdout); // keeps the order on a shared terminal
+    fputs(text, out);
+    if (!more)
+        fputc('\n', out);
+}
+
+void log_write(int level, const char *format, ...)
+{
+    char line[LOG_LINE];
+    va_list ap;
+    va_start(ap, format);
+    vsnprintf(line, sizeof line, format, ap);
+    va_end(ap);
+    if (!running) {
+        write_text(level, line, false);
+        return;
+    }
+
+    log_ring *r = owner.ring;
+    if (!r)
+        r = owner.ring = claim_ring();
+    if (!r) {
+        dropped++;
+        return;
+    }
+    // all records of the line, or none
+    size_t length = strlen(line);
+    unsigned int parts = length ? (length + LOG_TEXT - 2) / (LOG_TEXT - 1) : 1;
+    unsigned int head = r->head.load(std::memory_order_relaxed);
+    if (head - r->tail.load(std::memory_order_acquire) + parts > LOG_RING) {
+        dropped++;
+        return;
+    }
+    unsigned long long n = seq++;
+    for (unsigned int i = 0; i < parts; i++) {
+        log_record &rec = r->records[(head + i) % LOG_RING];
+        size_t chunk = std::min(length - i * (LOG_TEXT - 1), (size_t)LOG_TEXT - 1);
+        rec.seq = n;
+        rec.level = level;
+        rec.more = i + 1 < parts;
+        memcpy(rec.text, line + i * (LOG_TEXT - 1), chunk);
+        rec.text[chunk] = 0;
+    }
+    r->head.store(head + parts, std::memory_order_release);
+}
+
+static bool by_seq(const log_record &a, const log_record &b)
+{
+    return a.seq < b.seq;
+}
+
+// Everything queued, in the order it was written.
+static void flush()
+{
+    std::vector<log_record> batch;
+    for (int i = 0; i < LOG_MAX_THREADS; i++) {
+        log_ring *r = rings[i];
+        if (!r)
+            continue;
+        unsigned int tail = r->tail.load(std::memory_order_relaxed);
+        unsigned int head = r->head.load(std::memory_order_acquire);
+        for (; tail != head; tail++)
+            batch.push_back(r->records[tail % LOG_RING]);
+        r->tail.store(tail, std::memory_order_release);
+    }
+    if (batch.empty())
+        return;
+    // the records of a line share its seq and stay in order
+    std::stable_sort(batch.begin(), batch.end(), by_seq);
+    for (size_t i = 0; i < batch.size(); i++)
+        write_text(batch[i].level, batch[i].text, batch[i].more);
+    fflush(stdout);
+    fflush(stderr);
+}
+
+static int flush_main(void *)
+{
+    while (!stop) {
+        SDL_Delay(LOG_FLUSH_MS);
+        flush();
+    }
+    return 0;
+}
+
+void log_open()
+{
+    if (running)
+        return;
+    stop = false;
+    flusher = SDL_CreateThread(flush_main, "log", 0);
+    if (!flusher)
+        return;
+    running = true;
+    static bool registered = false;
+    if (!registered)
+        atexit(log_close);
+    registered = true;
+}
+
+void log_close()
+{
+    if (!running)
+        return;
+    stop = true;
+    SDL_WaitThread(flusher, 0);
+    flusher = 0;
+    // lines written meanwhile go straight out, then whatever is left
+    running = false;
+    flush();
+    if (dropped)
+        fprintf(stderr, "log: %llu lines dropped, the flush thread fell behind\n",
+                (unsigned long long)dropped);
+}
+
+unsigned long long log_dropped()
+{
+    return dropped;
+}
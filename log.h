@@ -0,0 +1,50 @@
+#ifndef LOG_H
+#define LOG_H
+
+// Console logging that never blocks the caller.
+//
+// stdout may be a pipe (journald) that stalls for a while, and a printf from
+// the render thread then costs frames.  Each thread writing a log line
+// formats it into fixed size records (one, or several for a long line) of
+// a ring of its own, a single producer, single consumer queue of atomics
+// with no lock; a flush thread drains all rings every LOG_FLUSH_MS, in the
+// order the lines were written, and does the writes.  A full ring drops the
+// line and counts it rather than wait.  Lines below LOG_LEVEL compile to
+// nothing.
+//
+// Until log_open() and after log_close() lines are written straight away.
+// Errors and warnings go to stderr, the rest to stdout.
+
+#define LOG_DEBUG 0
+#define LOG_INFO 1
+#define LOG_WARN 2
+#define LOG_ERROR 3
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_INFO // -DLOG_LEVEL=0 for debug lines
+#endif
+
+#define LOG_TEXT 240        // bytes of a record, a longer line takes several
+#define LOG_LINE 1024       // bytes of a line, longer ones are cut
+#define LOG_RING 128        // records per thread
+#define LOG_MAX_THREADS 32  // threads logging at the same time
+#define LOG_FLUSH_MS 50
+
+// Starts the flush thread, log_close() is also registered with atexit.
+void log_open();
+// Writes what is queued and stops the flush thread.
+void log_close();
+
+void log_write(int level, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+// lines lost to full rings so far
+unsigned long long log_dropped();
+
+#define LOG_AT(level, ...) \
+    do { if ((level) >= LOG_LEVEL) log_write((level), __VA_ARGS__); } while (0)
+#define log_debug(...) LOG_AT(LOG_DEBUG, __VA_ARGS__)
+#define log_info(...) LOG_AT(LOG_INFO, __VA_ARGS__)
+#define log_warn(...) LOG_AT(LOG_WARN, __VA_ARGS__)
+#define log_error(...) LOG_AT(LOG_ERROR, __VA_ARGS__)
+
+#endif // LOG_H
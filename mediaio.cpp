@@ -0,0 +1,421 @@
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_mutex.h>
+
+#include "mediaio.h"
+#include "frame_arena.h"
+
+static const char *backend_names[MAX_MEDIAIO_BACKEND] = { "vlc", "mmap", "readahead" };
+
+// One per path for the whole run, a reopened file keeps counting.
+struct file_entry {
+    char *path;
+    mediaio_backend_t backend;
+    size_t window;
+    std::atomic<unsigned long long> read_bytes, hit_bytes, fetch_bytes;
+    std::atomic<unsigned long long> reads, seeks, stall_us;
+};
+
+static file_entry files[MEDIAIO_MAX_FILES];
+static std::atomic<int> file_count;
+
+typedef enum {
+    BLOCK_EMPTY,
+    BLOCK_QUEUED,
+    BLOCK_LOADING,
+    BLOCK_READY,
+} block_state_t;
+
+// Readahead ring slot, block k of the file lives in slot k % nblocks.
+struct block {
+    int64_t index;
+    block_state_t state;
+    ssize_t bytes; // valid after READY, short at the end, -1 on a read error
+    uint8_t *data;
+};
+
+struct open_file {
+    file_entry *entry;
+    int fd;
+    uint64_t size;
+    uint64_t pos;
+
+    // mmap
+    const uint8_t *map;
+    uint64_t advised; // end of the last MADV_WILLNEED range
+    size_t page;
+
+    // readahead
+    uint8_t *ring;
+    std::vector<block> blocks;
+    int64_t scheduled; // read position block of the last schedule()
+    SDL_mutex *mutex;
+    SDL_cond *work;    // blocks queued
+    SDL_cond *ready;   // a block arrived
+    SDL_Thread *threads[MEDIAIO_THREADS];
+    bool stop;
+};
+
+static Uint64 elapsed_us(Uint64 start)
+{
+    return (SDL_GetPerformanceCounter() - start) * 1000000 / SDL_GetPerformanceFrequency();
+}
+
+// mmap backend
+
+static void advise_window(open_file *f)
+{
+    uint64_t start = f->pos & ~(uint64_t)(f->page - 1);
+    if (start >= f->size)
+        return;
+    size_t len = (size_t)std::min<uint64_t>(f->entry->window, f->size - start);
+    madvise((void*)(f->map + start), len, MADV_WILLNEED);
+    f->advised = start + len;
+}
+
+static ssize_t mmap_read(open_file *f, unsigned char *buf, size_t len)
+{
+    if (f->pos >= f->size)
+        return 0;
+    len = (size_t)std::min<uint64_t>(len, f->size - f->pos);
+
+    // renew the hint once half of the window has been consumed
+    if (f->pos + f->entry->window / 2 > f->advised)
+        advise_window(f);
+
+    uint64_t first = f->pos & ~(uint64_t)(f->page - 1);
+    size_t pages = (size_t)((f->pos + len - first + f->page - 1) / f->page);
+    unsigned char resident_vec[64];
+    size_t resident = 0, checked = std::min(pages, sizeof resident_vec);
+    if (mincore((void*)(f->map + first), checked * f->page, resident_vec) == 0) {
+        for (size_t i = 0; i < checked; i++)
+            resident += resident_vec[i] & 1;
+    }
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    memcpy(buf, f->map + f->pos, len);
+    if (resident < checked)
+        f->entry->stall_us += elapsed_us(start); // faulted in on the way
+    f->entry->hit_bytes += checked ? len * resident / checked : len;
+
+    f->pos += len;
+    return len;
+}
+
+// readahead backend
+
+static int readahead_worker(void *data)
+{
+    open_file *f = (open_file*)data;
+
+    SDL_LockMutex(f->mutex);
+    while (!f->stop) {
+        // nearest queued block first
+        block *b = 0;
+        for (size_t i = 0; i < f->blocks.size(); i++) {
+            block *q = &f->blocks[i];
+            if (q->state == BLOCK_QUEUED && (!b || q->index < b->index))
+                b = q;
+        }
+        if (!b) {
+            SDL_CondWait(f->work, f->mutex);
+            continue;
+        }
+        b->state = BLOCK_LOADING;
+        int64_t index = b->index;
+        SDL_UnlockMutex(f->mutex);
+
+        // a LOADING slot isn't reassigned, its data stays ours
+        uint64_t offset = (uint64_t)index * MEDIAIO_BLOCK;
+        size_t want = (size_t)std::min<uint64_t>(MEDIAIO_BLOCK, f->size - offset);
+        ssize_t got = 0;
+        while ((size_t)got < want) {
+            ssize_t n = pread(f->fd, b->data + got, want - got, offset + got);
+            if (n <= 0) {
+                if (n < 0)
+                    got = -1;
+                break;
+            }
+            got += n;
+        }
+        if (got > 0)
+            f->entry->fetch_bytes += got;
+
+        SDL_LockMutex(f->mutex);
+        b->bytes = got;
+        b->state = BLOCK_READY;
+        SDL_CondBroadcast(f->ready);
+    }
+    SDL_UnlockMutex(f->mutex);
+    return 0;
+}
+
+// Queue the window from block first on, dropping blocks behind it.  With
+// f->mutex held.
+static void schedule(open_file *f, int64_t first)
+{
+    if (first == f->scheduled)
+        return;
+    f->scheduled = first;
+
+    int64_t n = f->blocks.size();
+    int64_t last = f->size ? (int64_t)((f->size - 1) / MEDIAIO_BLOCK) : -1;
+    for (int64_t k = first; k < first + n && k <= last; k++) {
+        block *b = &f->blocks[k % n];
+        if (b->index == k || b->state == BLOCK_LOADING)
+            continue; // there, or busy with an old block until next time
+        b->index = k;
+        b->state = BLOCK_QUEUED;
+    }
+    SDL_CondBroadcast(f->work);
+}
+
+static ssize_t readahead_read(open_file *f, unsigned char *buf, size_t len)
+{
+    if (f->pos >= f->size)
+        return 0;
+    len = (size_t)std::min<uint64_t>(len, f->size - f->pos);
+
+    size_t copied = 0;
+    bool error = false;
+    SDL_LockMutex(f->mutex);
+    while (copied < len) {
+        int64_t k = f->pos / MEDIAIO_BLOCK;
+        block *b = &f->blocks[k % f->blocks.size()];
+        schedule(f, k);
+
+        bool waited = false;
+        Uint64 start = SDL_GetPerformanceCounter();
+        while (b->index != k || b->state != BLOCK_READY) {
+            if (b->index != k && b->state != BLOCK_LOADING) {
+                b->index = k; // behind the window, or the slot was busy
+                b->state = BLOCK_QUEUED;
+                SDL_CondBroadcast(f->work);
+            }
+            SDL_CondWait(f->ready, f->mutex);
+            waited = true;
+        }
+        if (waited)
+            f->entry->stall_us += elapsed_us(start);
+
+        size_t offset = f->pos - (uint64_t)k * MEDIAIO_BLOCK;
+        if (b->bytes < 0 || offset >= (size_t)b->bytes) {
+            error = b->bytes < 0;
+            b->state = BLOCK_EMPTY; // retried on the next read
+            b->index = -1;
+            break;
+        }
+        size_t chunk = std::min(len - copied, (size_t)b->bytes - offset);
+        memcpy(buf + copied, b->data + offset, chunk);
+        if (!waited)
+            f->entry->hit_bytes += chunk;
+        copied += chunk;
+        f->pos += chunk;
+    }
+    SDL_UnlockMutex(f->mutex);
+
+    if (!copied && error)
+        return -1;
+    return copied;
+}
+
+// libvlc callbacks
+
+static int media_open(void *opaque, void **datap, uint64_t *sizep)
+{
+    file_entry *entry = (file_entry*)opaque;
+    int fd = open(entry->path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(entry->path);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    open_file *f = new open_file();
+    f->entry = entry;
+    f->fd = fd;
+    f->size = st.st_size;
+    f->page = sysconf(_SC_PAGESIZE);
+
+    if (entry->backend == MEDIAIO_MMAP) {
+        void *map = f->size ? mmap(0, f->size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+        if (map == MAP_FAILED) {
+            perror(entry->path);
+            close(fd);
+            delete f;
+            return -1;
+        }
+        f->map = (const uint8_t*)map;
+        madvise(map, f->size, MADV_SEQUENTIAL);
+        advise_window(f);
+    } else {
+        size_t n = std::max<size_t>(2, entry->window / MEDIAIO_BLOCK);
+        f->ring = (uint8_t*)arena_alloc(n * MEDIAIO_BLOCK, "mediaio");
+        if (!f->ring) {
+            close(fd);
+            delete f;
+            return -1;
+        }
+        f->blocks.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            f->blocks[i].index = -1;
+            f->blocks[i].state = BLOCK_EMPTY;
+            f->blocks[i].data = f->ring + i * MEDIAIO_BLOCK;
+        }
+        f->scheduled = -1;
+        f->mutex = SDL_CreateMutex();
+        f->work = SDL_CreateCond();
+        f->ready = SDL_CreateCond();
+        for (int i = 0; i < MEDIAIO_THREADS; i++)
+            f->threads[i] = SDL_CreateThread(readahead_worker, "readahead", f);
+        SDL_LockMutex(f->mutex);
+        schedule(f, 0);
+        SDL_UnlockMutex(f->mutex);
+    }
+
+    *datap = f;
+    *sizep = f->size;
+    return 0;
+}
+
+static ssize_t media_read(void *opaque, unsigned char *buf, size_t len)
+{
+    open_file *f = (open_file*)opaque;
+    ssize_t n;
+    if (f->entry->backend == MEDIAIO_MMAP)
+        n = mmap_read(f, buf, len);
+    else
+        n = readahead_read(f, buf, len);
+    if (n > 0) {
+        f->entry->read_bytes += n;
+        f->entry->reads++;
+    }
+    return n;
+}
+
+static int media_seek(void *opaque, uint64_t offset)
+{
+    open_file *f = (open_file*)opaque;
+    f->entry->seeks++;
+    if (f->entry->backend == MEDIAIO_MMAP) {
+        f->pos = offset;
+        advise_window(f); // before the demuxer asks for it
+    } else {
+        SDL_LockMutex(f->mutex);
+        f->pos = offset;
+        schedule(f, offset / MEDIAIO_BLOCK);
+        SDL_UnlockMutex(f->mutex);
+    }
+    return 0;
+}
+
+static void media_close(void *opaque)
+{
+    open_file *f = (open_file*)opaque;
+    if (f->entry->backend == MEDIAIO_MMAP) {
+        munmap((void*)f->map, f->size);
+    } else {
+        SDL_LockMutex(f->mutex);
+        f->stop = true;
+        SDL_CondBroadcast(f->work);
+        SDL_UnlockMutex(f->mutex);
+        for (int i = 0; i < MEDIAIO_THREADS; i++)
+            SDL_WaitThread(f->threads[i], 0);
+        SDL_DestroyCond(f->work);
+        SDL_DestroyCond(f->ready);
+        SDL_DestroyMutex(f->mutex);
+        arena_free(f->ring);
+    }
+    close(f->fd);
+    delete f;
+}
+
+bool mediaio_parse_backend(const char *name, mediaio_backend_t *backend)
+{
+    for (int i = 0; i < MAX_MEDIAIO_BACKEND; i++) {
+        if (!strcmp(name, backend_names[i])) {
+            *backend = (mediaio_backend_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+libvlc_media_t* mediaio_media_new(libvlc_instance_t *vlc, const char *path,
+        mediaio_backend_t backend, size_t window)
+{
+    if (strstr(path, "://")) {
+        // network streams go through VLC's access modules
+        if (backend != MEDIAIO_VLC)
+            fprintf(stderr, "mediaio: %s is a location, read by VLC\n", path);
+        return libvlc_media_new_location(vlc, path);
+    }
+    if (backend == MEDIAIO_VLC)
+        return libvlc_media_new_path(vlc, path);
+
+    int count = file_count.load();
+    file_entry *entry = 0;
+    for (int i = 0; i < count; i++) {
+        if (!strcmp(files[i].path, path) && files[i].backend == backend)
+            entry = &files[i];
+    }
+    if (!entry) {
+        if (count == MEDIAIO_MAX_FILES) {
+            fprintf(stderr, "mediaio: too many files, %s is read by VLC\n", path);
+            return libvlc_media_new_path(vlc, path);
+        }
+        entry = &files[count];
+        entry->path = strdup(path);
+        entry->backend = backend;
+        entry->window = window ? window : MEDIAIO_DEFAULT_WINDOW;
+        file_count.store(count + 1); // after the entry is complete, for the metrics thread
+    }
+    return libvlc_media_new_callbacks(vlc, media_open, media_read, media_seek, media_close, entry);
+}
+
+int mediaio_count()
+{
+    return file_count.load();
+}
+
+void mediaio_get_stats(int index, mediaio_stats *stats)
+{
+    const file_entry &e = files[index];
+    stats->path = e.path;
+    stats->backend = backend_names[e.backend];
+    stats->read_bytes = e.read_bytes.load();
+    stats->hit_bytes = e.hit_bytes.load();
+    stats->fetch_bytes = e.fetch_bytes.load();
+    stats->reads = e.reads.load();
+    stats->seeks = e.seeks.load();
+    stats->stall_seconds = e.stall_us.load() / 1e6;
+}
+
+void mediaio_report(FILE *out)
+{
+    for (int i = 0; i < mediaio_count(); i++) {
+        mediaio_stats s;
+        mediaio_get_stats(i, &s);
+        fprintf(out, "io: %s (%s, %zu MB window): read %.1f MB in %llu reads, %llu seeks,"
+                " stalled %.2fs, readahead hits %.1f%%",
+                s.path, s.backend, files[i].window >> 20, s.read_bytes / 1048576.0, s.reads,
+                s.seeks, s.stall_seconds,
+                s.read_bytes ? s.hit_bytes * 100.0 / s.read_bytes : 0.0);
+        if (files[i].backend == MEDIAIO_READAHEAD)
+            fprintf(out, ", fetched %.1f MB", s.fetch_bytes / 1048576.0);
+        fprintf(out, "\n");
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef MEDIAIO_H
+#define MEDIAIO_H
+
+#include <cstdio>
+#include <cstddef>
+
+#include <vlc/vlc.h>
+
+// Media input through libvlc_media_new_callbacks.
+//
+// VLC's own file access reads on demand, so after a seek into a cold part of
+// a 400 Mbit/s master on spinning disks the demuxer stalls on every read.
+// Two backends read ahead of it instead:
+//
+// mmap: the file is mapped with MADV_SEQUENTIAL and the window ahead of the
+// read position is handed to the kernel with MADV_WILLNEED, renewed every
+// half window and right after a seek.  Hits are the requested pages already
+// resident (mincore) when VLC asks for them.
+//
+// readahead: a pool of MEDIAIO_THREADS threads preads MEDIAIO_BLOCK sized
+// blocks of the window ahead of the read position into a ring, nearest
+// first.  Hits are the requested bytes whose block had arrived already.
+//
+// Statistics are kept per file for the whole run, for sizing storage.
+
+#define MEDIAIO_BLOCK (1 << 20)           // readahead unit
+#define MEDIAIO_THREADS 4                 // readahead workers per open file
+#define MEDIAIO_DEFAULT_WINDOW (64 << 20) // bytes ahead of the read position
+#define MEDIAIO_MAX_FILES 8
+
+typedef enum {
+    MEDIAIO_VLC,       // VLC's own access module, no statistics
+    MEDIAIO_MMAP,
+    MEDIAIO_READAHEAD,
+    MAX_MEDIAIO_BACKEND
+} mediaio_backend_t;
+
+struct mediaio_stats {
+    const char *path;
+    const char *backend;
+    unsigned long long read_bytes;  // handed to VLC
+    unsigned long long hit_bytes;   // of those, already in memory when asked for
+    unsigned long long fetch_bytes; // read from storage by the readahead pool
+    unsigned long long reads, seeks;
+    double stall_seconds;           // VLC waiting inside read callbacks
+};
+
+// "vlc", "mmap" or "readahead", false for anything else
+bool mediaio_parse_backend(const char *name, mediaio_backend_t *backend);
+
+// window: bytes to read ahead, MEDIAIO_DEFAULT_WINDOW when 0.  Locations
+// (scheme://...) are always opened by VLC.
+libvlc_media_t* mediaio_media_new(libvlc_instance_t *vlc, const char *path,
+        mediaio_backend_t backend, size_t window);
+
+// files opened so far, index < mediaio_count()
+int mediaio_count();
+void mediaio_get_stats(int index, mediaio_stats *stats);
+void mediaio_report(FILE *out);
+
+#endif // MEDIAIO_H
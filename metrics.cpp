@@ -0,0 +1,343 @@
+#include <cstdio>
+#include <cstdarg>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <SDL2/SDL.h>
+
+#include "metrics.h"
+#include "frame_arena.h"
+#include "mediaio.h"
+
+#define METRICS_POLL_MS 200       // how often the server checks for shutdown
+#define METRICS_REQUEST_WAIT_MS 50 // for an HTTP request line after accepting
+
+static struct _metrics {
+    bool active;
+    std::string path;
+    int fd;
+    SDL_Thread *thread;
+    std::atomic<bool> stop;
+
+    // render thread
+    std::atomic<unsigned long long> frames;
+    std::atomic<unsigned long long> upload_bytes;
+    std::atomic<unsigned long long> repeated;
+    std::atomic<unsigned long long> tiles, changed_tiles, duplicates;
+    std::atomic<unsigned int> frame_us[METRICS_FRAME_RING];
+    Uint64 last_frame;
+
+    // decoder thread
+    std::atomic<unsigned long long> dropped;
+    std::atomic<int> queue_depth;
+
+    std::atomic<unsigned int> width, height;
+    std::atomic<const char*> distortion;
+
+    // server thread, for the rates between two scrapes
+    Uint32 prev_ticks;
+    unsigned long long prev_bytes;
+} metrics;
+
+void metrics_frame()
+{
+    if (!metrics.active)
+        return;
+    Uint64 now = SDL_GetPerformanceCounter();
+    unsigned long long n = metrics.frames.load(std::memory_order_relaxed);
+    if (metrics.last_frame) {
+        Uint64 us = (now - metrics.last_frame) * 1000000 / SDL_GetPerformanceFrequency();
+        metrics.frame_us[n % METRICS_FRAME_RING].store((unsigned int)us, std::memory_order_relaxed);
+        metrics.frames.store(n + 1, std::memory_order_release);
+    }
+    metrics.last_frame = now;
+}
+
+void metrics_upload(size_t bytes)
+{
+    metrics.upload_bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void metrics_tiles(unsigned int changed, unsigned int total)
+{
+    metrics.tiles.fetch_add(total, std::memory_order_relaxed);
+    metrics.changed_tiles.fetch_add(changed, std::memory_order_relaxed);
+    if (!changed)
+        metrics.duplicates.fetch_add(1, std::memory_order_relaxed);
+}
+
+void metrics_repeated()
+{
+    metrics.repeated.fetch_add(1, std::memory_order_relaxed);
+}
+
+void metrics_dropped()
+{
+    metrics.dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+unsigned long long metrics_dropped_count()
+{
+    return metrics.dropped.load(std::memory_order_relaxed);
+}
+
+void metrics_queue_depth(int frames)
+{
+    metrics.queue_depth.store(frames, std::memory_order_relaxed);
+}
+
+void metrics_video(unsigned int width, unsigned int height)
+{
+    metrics.width.store(width, std::memory_order_relaxed);
+    metrics.height.store(height, std::memory_order_relaxed);
+}
+
+void metrics_distortion(const char *name)
+{
+    metrics.distortion.store(name, std::memory_order_relaxed);
+}
+
+static void append(std::string *page, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void append(std::string *page, const char *fmt, ...)
+{
+    char line[256];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(line, sizeof line, fmt, args);
+    va_end(args);
+    *page += line;
+}
+
+static std::string render_page()
+{
+    std::string page;
+
+    // the ring may be overwritten while it is copied, a few mixed samples
+    // don't matter for percentiles
+    unsigned long long frames = metrics.frames.load(std::memory_order_acquire);
+    unsigned int count = (unsigned int)std::min<unsigned long long>(frames, METRICS_FRAME_RING);
+    std::vector<unsigned int> times(count);
+    double sum = 0;
+    for (unsigned int i = 0; i < count; i++) {
+        times[i] = metrics.frame_us[(frames - 1 - i) % METRICS_FRAME_RING].load(std::memory_order_relaxed);
+        sum += times[i];
+    }
+    std::sort(times.begin(), times.end());
+
+    append(&page, "# HELP vlcvr_frames_total Frames rendered.\n");
+    append(&page, "# TYPE vlcvr_frames_total counter\n");
+    append(&page, "vlcvr_frames_total %llu\n", frames);
+
+    append(&page, "# HELP vlcvr_render_fps Render rate over the last %u frames.\n", count);
+    append(&page, "# TYPE vlcvr_render_fps gauge\n");
+    append(&page, "vlcvr_render_fps %.2f\n", sum > 0 ? count / (sum / 1e6) : 0.0);
+
+    append(&page, "# HELP vlcvr_frame_time_seconds Interval between rendered frames.\n");
+    append(&page, "# TYPE vlcvr_frame_time_seconds summary\n");
+    static const double quantiles[] = { 0.5, 0.9, 0.99 };
+    for (int i = 0; i < 3; i++) {
+        double t = count ? times[std::min(count - 1, (unsigned int)(quantiles[i] * count))] / 1e6 : 0;
+        append(&page, "vlcvr_frame_time_seconds{quantile=\"%g\"} %.6f\n", quantiles[i], t);
+    }
+    append(&page, "vlcvr_frame_time_seconds_sum %.6f\n", sum / 1e6);
+    append(&page, "vlcvr_frame_time_seconds_count %u\n", count);
+
+    unsigned long long bytes = metrics.upload_bytes.load(std::memory_order_relaxed);
+    Uint32 now = SDL_GetTicks();
+    double rate = 0;
+    if (metrics.prev_ticks && now > metrics.prev_ticks)
+        rate = (bytes - metrics.prev_bytes) / ((now - metrics.prev_ticks) / 1000.0);
+    metrics.prev_ticks = now;
+    metrics.prev_bytes = bytes;
+
+    append(&page, "# HELP vlcvr_upload_bytes_total Video texture bytes uploaded.\n");
+    append(&page, "# TYPE vlcvr_upload_bytes_total counter\n");
+    append(&page, "vlcvr_upload_bytes_total %llu\n", bytes);
+    append(&page, "# HELP vlcvr_upload_mbytes_per_second Upload rate since the previous scrape.\n");
+    append(&page, "# TYPE vlcvr_upload_mbytes_per_second gauge\n");
+    append(&page, "vlcvr_upload_mbytes_per_second %.2f\n", rate / (1024.0 * 1024.0));
+
+    append(&page, "# HELP vlcvr_upload_tiles_total Picture tiles of the frames compared for changes (-H).\n");
+    append(&page, "# TYPE vlcvr_upload_tiles_total counter\n");
+    append(&page, "vlcvr_upload_tiles_total %llu\n", metrics.tiles.load(std::memory_order_relaxed));
+    append(&page, "# HELP vlcvr_upload_changed_tiles_total Of those, tiles that changed and were uploaded.\n");
+    append(&page, "# TYPE vlcvr_upload_changed_tiles_total counter\n");
+    append(&page, "vlcvr_upload_changed_tiles_total %llu\n", metrics.changed_tiles.load(std::memory_order_relaxed));
+    append(&page, "# HELP vlcvr_duplicate_frames_total Decoded frames identical to the uploaded one.\n");
+    append(&page, "# TYPE vlcvr_duplicate_frames_total counter\n");
+    append(&page, "vlcvr_duplicate_frames_total %llu\n", metrics.duplicates.load(std::memory_order_relaxed));
+
+    append(&page, "# HELP vlcvr_dropped_frames_total Decoded frames replaced before they were uploaded.\n");
+    append(&page, "# TYPE vlcvr_dropped_frames_total counter\n");
+    append(&page, "vlcvr_dropped_frames_total %llu\n", metrics.dropped.load(std::memory_order_relaxed));
+    append(&page, "# HELP vlcvr_repeated_frames_total Rendered frames without a new video frame.\n");
+    append(&page, "# TYPE vlcvr_repeated_frames_total counter\n");
+    append(&page, "vlcvr_repeated_frames_total %llu\n", metrics.repeated.load(std::memory_order_relaxed));
+    append(&page, "# HELP vlcvr_decode_queue_depth Decoded frames waiting for upload.\n");
+    append(&page, "# TYPE vlcvr_decode_queue_depth gauge\n");
+    append(&page, "vlcvr_decode_queue_depth %d\n", metrics.queue_depth.load(std::memory_order_relaxed));
+
+    append(&page, "# HELP vlcvr_video_width Decoded video width in pixels.\n");
+    append(&page, "# TYPE vlcvr_video_width gauge\n");
+    append(&page, "vlcvr_video_width %u\n", metrics.width.load(std::memory_order_relaxed));
+    append(&page, "# HELP vlcvr_video_height Decoded video height in pixels.\n");
+    append(&page, "# TYPE vlcvr_video_height gauge\n");
+    append(&page, "vlcvr_video_height %u\n", metrics.height.load(std::memory_order_relaxed));
+
+    const char *distortion = metrics.distortion.load(std::memory_order_relaxed);
+    append(&page, "# HELP vlcvr_distortion_info Current screen distortion mode.\n");
+    append(&page, "# TYPE vlcvr_distortion_info gauge\n");
+    append(&page, "vlcvr_distortion_info{mode=\"%s\"} 1\n", distortion ? distortion : "unknown");
+
+    append(&page, "# HELP vlcvr_memory_bytes Tracked memory by kind.\n");
+    append(&page, "# TYPE vlcvr_memory_bytes gauge\n");
+    append(&page, "vlcvr_memory_bytes{type=\"cpu\"} %zu\n", mem_cpu_bytes());
+    append(&page, "vlcvr_memory_bytes{type=\"gpu\"} %zu\n", mem_gpu_bytes());
+
+    int files = mediaio_count();
+    if (files) {
+        std::vector<mediaio_stats> io(files);
+        for (int i = 0; i < files; i++)
+            mediaio_get_stats(i, &io[i]);
+        // label values need quotes and backslashes escaped
+        std::vector<std::string> labels(files);
+        for (int i = 0; i < files; i++) {
+            std::string path;
+            for (const char *c = io[i].path; *c; c++) {
+                if (*c == '"' || *c == '\\')
+                    path += '\\';
+                path += *c;
+            }
+            labels[i] = "file=\"" + path + "\",backend=\"" + io[i].backend + "\"";
+        }
+
+        append(&page, "# HELP vlcvr_io_read_bytes_total Media bytes handed to the demuxer.\n");
+        append(&page, "# TYPE vlcvr_io_read_bytes_total counter\n");
+        for (int i = 0; i < files; i++)
+            page += "vlcvr_io_read_bytes_total{" + labels[i] + "} " + std::to_string(io[i].read_bytes) + "\n";
+        append(&page, "# HELP vlcvr_io_hit_bytes_total Media bytes already in memory when the demuxer asked.\n");
+        append(&page, "# TYPE vlcvr_io_hit_bytes_total counter\n");
+        for (int i = 0; i < files; i++)
+            page += "vlcvr_io_hit_bytes_total{" + labels[i] + "} " + std::to_string(io[i].hit_bytes) + "\n";
+        append(&page, "# HELP vlcvr_io_fetch_bytes_total Media bytes read from storage ahead of the demuxer.\n");
+        append(&page, "# TYPE vlcvr_io_fetch_bytes_total counter\n");
+        for (int i = 0; i < files; i++)
+            page += "vlcvr_io_fetch_bytes_total{" + labels[i] + "} " + std::to_string(io[i].fetch_bytes) + "\n";
+        append(&page, "# HELP vlcvr_io_stall_seconds_total Time the demuxer waited for storage.\n");
+        append(&page, "# TYPE vlcvr_io_stall_seconds_total counter\n");
+        for (int i = 0; i < files; i++) {
+            char value[32];
+            snprintf(value, sizeof value, "%.6f", io[i].stall_seconds);
+            page += "vlcvr_io_stall_seconds_total{" + labels[i] + "} " + value + "\n";
+        }
+        append(&page, "# HELP vlcvr_io_seeks_total Seeks by the demuxer.\n");
+        append(&page, "# TYPE vlcvr_io_seeks_total counter\n");
+        for (int i = 0; i < files; i++)
+            page += "vlcvr_io_seeks_total{" + labels[i] + "} " + std::to_string(io[i].seeks) + "\n";
+    }
+
+    return page;
+}
+
+static void write_all(int fd, const char *data, size_t size)
+{
+    while (size) {
+        ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        data += n;
+        size -= n;
+    }
+}
+
+static void serve(int client)
+{
+    // wait briefly for a request, socat may not send anything
+    char request[512];
+    ssize_t n = 0;
+    struct pollfd p = { client, POLLIN, 0 };
+    if (poll(&p, 1, METRICS_REQUEST_WAIT_MS) > 0)
+        n = recv(client, request, sizeof request - 1, 0);
+
+    std::string page = render_page();
+    if (n >= 4 && memcmp(request, "GET ", 4) == 0) {
+        char header[128];
+        snprintf(header, sizeof header, "HTTP/1.0 200 OK\r\n"
+                "Content-Type: text/plain; version=0.0.4\r\n"
+                "Content-Length: %zu\r\n\r\n", page.size());
+        write_all(client, header, strlen(header));
+    }
+    write_all(client, page.data(), page.size());
+}
+
+static int metrics_server(void *)
+{
+    while (!metrics.stop.load()) {
+        struct pollfd p = { metrics.fd, POLLIN, 0 };
+        if (poll(&p, 1, METRICS_POLL_MS) <= 0)
+            continue;
+        int client = accept(metrics.fd, 0, 0);
+        if (client < 0)
+            continue;
+        serve(client);
+        close(client);
+    }
+    return 0;
+}
+
+bool metrics_open(const char *path)
+{
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof addr.sun_path) {
+        fprintf(stderr, "metrics: socket path too long: %s\n", path);
+        return false;
+    }
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    metrics.fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (metrics.fd < 0) {
+        perror("metrics: socket");
+        return false;
+    }
+    unlink(path); // left over from a previous run
+    if (bind(metrics.fd, (struct sockaddr*)&addr, sizeof addr) < 0 || listen(metrics.fd, 4) < 0) {
+        perror(path);
+        close(metrics.fd);
+        return false;
+    }
+
+    metrics.path = path;
+    metrics.stop = false;
+    metrics.prev_ticks = SDL_GetTicks();
+    metrics.prev_bytes = metrics.upload_bytes.load();
+    metrics.active = true;
+    metrics.thread = SDL_CreateThread(metrics_server, "metrics", 0);
+    printf("metrics: serving on %s\n", path);
+    return true;
+}
+
+void metrics_close()
+{
+    if (!metrics.active)
+        return;
+    metrics.stop = true;
+    SDL_WaitThread(metrics.thread, 0);
+    close(metrics.fd);
+    unlink(metrics.path.c_str());
+    metrics.active = false;
+}
@@ -0,0 +1,39 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <cstddef>
+
+// Live metrics over a Unix domain socket.
+//
+// The render thread only bumps atomic counters and writes frame times into a
+// ring; a server thread accepts connections on the socket and answers each
+// with a Prometheus text exposition page, computing rates and percentiles
+// from the counters at that point.  A plain connection (socat) gets the bare
+// page, an HTTP GET (curl --unix-socket) gets it with a response header.
+
+#define METRICS_FRAME_RING 1024 // frame times kept for the percentiles
+
+bool metrics_open(const char *path);
+void metrics_close();
+
+// render thread, once per presented frame
+void metrics_frame();
+void metrics_upload(size_t bytes);
+// upload thread or render thread with -H, per compared frame: tiles that
+// changed (0 for a duplicate) of those in the picture
+void metrics_tiles(unsigned int changed, unsigned int total);
+// a rendered frame that showed no new video frame
+void metrics_repeated();
+
+// decoder thread: a decoded frame replaced one that was never uploaded
+void metrics_dropped();
+// any thread, dropped frames so far
+unsigned long long metrics_dropped_count();
+// decoded frames waiting for upload
+void metrics_queue_depth(int frames);
+
+void metrics_video(unsigned int width, unsigned int height);
+// name must be a static string
+void metrics_distortion(const char *name);
+
+#endif // METRICS_H
@@ -0,0 +1,343 @@
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "overlay.h"
+
+// Latin-1, anything else is drawn as '?'
+#define FIRST_CHAR 32
+#define LAST_CHAR 255
+#define NUM_CHARS (LAST_CHAR - FIRST_CHAR + 1)
+#define ATLAS_COLS 16
+#define GLYPH_PADDING 2 // texels between cells so filtering doesn't bleed
+#define PANEL_MARGIN 0.25f // of a line height
+#define PANEL_COLOR 0x000000a0
+
+struct glyph {
+    int x, y;           // cell origin in the atlas
+    int width, height;  // bitmap size
+    int left, top;      // bitmap offset from the pen position and baseline
+    int advance;
+};
+
+static struct _font {
+    glyph glyphs[NUM_CHARS];
+    uint8_t *atlas;
+    int atlas_width, atlas_height;
+    int ascender, line_height; // pixels
+    bool loaded;
+} font;
+
+static std::vector<overlay_vertex> batch;
+
+struct subtitle_cue {
+    int64_t start, end; // ms
+    std::string text;
+};
+static std::vector<subtitle_cue> cues;
+
+bool overlay_init_font(const char *path, int pixel_size)
+{
+    FT_Library library;
+    FT_Face face;
+
+    if (FT_Init_FreeType(&library))
+        return false;
+    if (FT_New_Face(library, path, 0, &face)) {
+        fprintf(stderr, "overlay: can't load font %s\n", path);
+        FT_Done_FreeType(library);
+        return false;
+    }
+    FT_Set_Pixel_Sizes(face, 0, pixel_size);
+
+    font.ascender = face->size->metrics.ascender >> 6;
+    font.line_height = face->size->metrics.height >> 6;
+
+    // fixed cells, big enough for every glyph
+    int cell_w = 0, cell_h = 0;
+    for (int c = FIRST_CHAR; c <= LAST_CHAR; c++) {
+        if (FT_Load_Char(face, c, FT_LOAD_DEFAULT))
+            continue;
+        cell_w = std::max(cell_w, (int)(face->glyph->metrics.width >> 6) + 1);
+        cell_h = std::max(cell_h, (int)(face->glyph->metrics.height >> 6) + 1);
+    }
+    cell_w += GLYPH_PADDING;
+    cell_h += GLYPH_PADDING;
+
+    font.atlas_width = ATLAS_COLS * cell_w;
+    font.atlas_height = (NUM_CHARS + ATLAS_COLS - 1) / ATLAS_COLS * cell_h;
+    font.atlas = (uint8_t*)calloc(font.atlas_width * font.atlas_height, 1);
+
+    for (int i = 0; i < NUM_CHARS; i++) {
+        glyph *g = &font.glyphs[i];
+        g->x = (i % ATLAS_COLS) * cell_w + GLYPH_PADDING;
+        g->y = (i / ATLAS_COLS) * cell_h + GLYPH_PADDING;
+
+        if (FT_Load_Char(face, FIRST_CHAR + i, FT_LOAD_RENDER))
+            continue;
+        FT_GlyphSlot slot = face->glyph;
+        g->width = std::min((int)slot->bitmap.width, cell_w - GLYPH_PADDING);
+        g->height = std::min((int)slot->bitmap.rows, cell_h - GLYPH_PADDING);
+        g->left = slot->bitmap_left;
+        g->top = slot->bitmap_top;
+        g->advance = slot->advance.x >> 6;
+
+        for (int y = 0; y < g->height; y++) {
+            memcpy(font.atlas + (g->y + y) * font.atlas_width + g->x,
+                    slot->bitmap.buffer + y * slot->bitmap.pitch, g->width);
+        }
+    }
+
+    // solid block for the panels, in the space glyph's empty cell
+    for (int y = 0; y < GLYPH_PADDING * 2; y++)
+        memset(font.atlas + y * font.atlas_width, 0xff, GLYPH_PADDING * 2);
+
+    FT_Done_Face(face);
+    FT_Done_FreeType(library);
+
+    font.loaded = true;
+    printf("overlay: %s at %dpx, %dx%d atlas\n", path, pixel_size,
+            font.atlas_width, font.atlas_height);
+    return true;
+}
+
+const uint8_t* overlay_atlas(int *width, int *height)
+{
+    *width = font.atlas_width;
+    *height = font.atlas_height;
+    return font.atlas;
+}
+
+void overlay_free_atlas()
+{
+    free(font.atlas);
+    font.atlas = 0;
+}
+
+void overlay_begin()
+{
+    batch.clear();
+}
+
+// next code point of a UTF-8 string, invalid sequences map to '?'
+static unsigned int next_char(const char **p)
+{
+    const unsigned char *s = (const unsigned char*)*p;
+    unsigned int c = *s++;
+    int extra = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : c >= 0xc0 ? 1 : 0;
+
+    if (c >= 0x80 && c < 0xc0) {
+        c = '?';
+    } else if (extra) {
+        c &= 0x3f >> extra;
+        for (; extra && (*s & 0xc0) == 0x80; extra--)
+            c = (c << 6) | (*s++ & 0x3f);
+        if (extra)
+            c = '?';
+    }
+    *p = (const char*)s;
+    return c;
+}
+
+static const glyph* find_glyph(unsigned int c)
+{
+    if (c < FIRST_CHAR || c > LAST_CHAR)
+        c = '?';
+    return &font.glyphs[c - FIRST_CHAR];
+}
+
+static int line_width(const char *s)
+{
+    int w = 0;
+    while (*s && *s != '\n')
+        w += find_glyph(next_char(&s))->advance;
+    return w;
+}
+
+static void push_quad(float x0, float y0, float x1, float y1,
+        float s0, float t0, float s1, float t1, uint32_t rgba)
+{
+    overlay_vertex v[4];
+    float pos[4][4] = {
+        { x0, y0, s0, t1 },
+        { x1, y0, s1, t1 },
+        { x1, y1, s1, t0 },
+        { x0, y1, s0, t0 },
+    };
+    for (int i = 0; i < 4; i++) {
+        v[i].x = pos[i][0];
+        v[i].y = pos[i][1];
+        v[i].s = pos[i][2];
+        v[i].t = pos[i][3];
+        v[i].color[0] = rgba >> 24;
+        v[i].color[1] = rgba >> 16;
+        v[i].color[2] = rgba >> 8;
+        v[i].color[3] = rgba;
+    }
+    // two triangles, the whole batch is drawn with one GL_TRIANGLES call
+    static const int order[6] = { 0, 1, 2, 0, 2, 3 };
+    for (int i = 0; i < 6; i++)
+        batch.push_back(v[order[i]]);
+}
+
+float overlay_text(float x, float y, float line_height, const char *text,
+        bool centered, uint32_t rgba)
+{
+    if (!font.loaded || !*text)
+        return 0;
+
+    float scale = line_height / font.line_height;
+    float sw = 1.0f / font.atlas_width, th = 1.0f / font.atlas_height;
+
+    int lines = 1, widest = 0;
+    for (const char *s = text; *s; s++) {
+        if (*s == '\n')
+            lines++;
+    }
+    for (const char *s = text; s; s = strchr(s, '\n')) {
+        if (*s == '\n')
+            s++;
+        widest = std::max(widest, line_width(s));
+    }
+
+    float margin = line_height * PANEL_MARGIN;
+    float panel_w = widest * scale + 2 * margin;
+    float panel_h = lines * line_height + 2 * margin;
+    float panel_x = centered ? x - panel_w / 2 : x - margin;
+    push_quad(panel_x, y - panel_h, panel_x + panel_w, y,
+            GLYPH_PADDING * sw, GLYPH_PADDING * th, GLYPH_PADDING * sw, GLYPH_PADDING * th,
+            PANEL_COLOR);
+
+    float baseline = y - margin - font.ascender * scale;
+    const char *s = text;
+    while (*s) {
+        float pen = centered ? x - line_width(s) * scale / 2 : x;
+        while (*s && *s != '\n') {
+            const glyph *g = find_glyph(next_char(&s));
+            if (g->width && g->height) {
+                float x0 = pen + g->left * scale;
+                float y1 = baseline + g->top * scale;
+                push_quad(x0, y1 - g->height * scale, x0 + g->width * scale, y1,
+                        g->x * sw, g->y * th, (g->x + g->width) * sw, (g->y + g->height) * th,
+                        rgba);
+            }
+            pen += g->advance * scale;
+        }
+        if (*s == '\n')
+            s++;
+        baseline -= line_height;
+    }
+
+    return panel_h;
+}
+
+const overlay_vertex* overlay_vertices(int *count)
+{
+    *count = batch.size();
+    return batch.empty() ? 0 : &batch[0];
+}
+
+static bool parse_timestamp(const char *s, int64_t *ms)
+{
+    int h, m, sec, frac;
+    if (sscanf(s, "%d:%d:%d%*[,.]%d", &h, &m, &sec, &frac) != 4)
+        return false;
+    *ms = ((int64_t)h * 3600 + m * 60 + sec) * 1000 + frac;
+    return true;
+}
+
+// drop <i>, <b>, <font ...> and {\an8} style markup
+static std::string strip_tags(const std::string &line)
+{
+    std::string out;
+    char close = 0;
+    for (size_t i = 0; i < line.size(); i++) {
+        char c = line[i];
+        if (close) {
+            if (c == close)
+                close = 0;
+        } else if (c == '<') {
+            close = '>';
+        } else if (c == '{' && i + 1 < line.size() && line[i + 1] == '\\') {
+            close = '}';
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+static bool cue_before(const subtitle_cue &a, const subtitle_cue &b)
+{
+    return a.start < b.start;
+}
+
+bool subtitles_load(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return false;
+
+    cues.clear();
+    char buf[1024];
+    subtitle_cue cue;
+    bool in_cue = false;
+
+    while (fgets(buf, sizeof buf, f)) {
+        std::string line = buf;
+        if (line.compare(0, 3, "\xef\xbb\xbf") == 0)
+            line.erase(0, 3); // BOM
+        while (!line.empty() && (line[line.size() - 1] == '\n' || line[line.size() - 1] == '\r'))
+            line.erase(line.size() - 1);
+
+        size_t arrow = line.find("-->");
+        if (arrow != std::string::npos) {
+            if (parse_timestamp(line.c_str(), &cue.start) &&
+                    parse_timestamp(line.c_str() + arrow + 3 + strspn(line.c_str() + arrow + 3, " "), &cue.end)) {
+                cue.text.clear();
+                in_cue = true;
+            }
+        } else if (line.empty()) {
+            if (in_cue && !cue.text.empty())
+                cues.push_back(cue);
+            in_cue = false;
+        } else if (in_cue) {
+            if (!cue.text.empty())
+                cue.text += '\n';
+            cue.text += strip_tags(line);
+        }
+    }
+    if (in_cue && !cue.text.empty())
+        cues.push_back(cue);
+    fclose(f);
+
+    std::stable_sort(cues.begin(), cues.end(), cue_before);
+    printf("subtitles: %d cues from %s\n", (int)cues.size(), path);
+    return !cues.empty();
+}
+
+const char* subtitles_at(int64_t ms)
+{
+    subtitle_cue key;
+    key.start = ms;
+
+    // last cue starting at or before ms
+    std::vector<subtitle_cue>::const_iterator it =
+        std::upper_bound(cues.begin(), cues.end(), key, cue_before);
+    if (it == cues.begin())
+        return 0;
+    --it;
+    return ms < it->end ? it->text.c_str() : 0;
+}
+
+int subtitles_count()
+{
+    return cues.size();
+}
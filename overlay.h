@@ -0,0 +1,44 @@
+#ifndef OVERLAY_H
+#define OVERLAY_H
+
+#include <stdint.h>
+
+// In-headset text overlay.
+//
+// The glyphs of a TrueType font are rasterized once into a single channel
+// atlas.  Each frame the text to show is laid out into one batch of textured
+// triangles (with a translucent panel behind each block, drawn from a solid
+// texel of the atlas) that the renderer uploads and draws with a single
+// call per eye.  Coordinates are in the overlay plane, y up, in the same
+// units as the virtual screen.
+//
+// External .srt subtitles are parsed here too, so they can be shown on the
+// overlay instead of VLC blending them into every decoded frame.
+
+#define OVERLAY_DEFAULT_FONT "/usr/share/fonts/truetype/dejavu/DejaVuSansMono.ttf"
+#define OVERLAY_FONT_PIXELS 32 // rasterized size, the atlas is sampled with filtering
+
+struct overlay_vertex {
+    float x, y;
+    float s, t;
+    uint8_t color[4]; // rgba
+};
+
+bool overlay_init_font(const char *path, int pixel_size);
+// The atlas, top row first, valid until overlay_free_atlas().
+const uint8_t* overlay_atlas(int *width, int *height);
+void overlay_free_atlas();
+
+void overlay_begin();
+// Lay out UTF-8 text with the top of its first line at y, each line centered
+// on x or starting at it.  Returns the height used including the panel.
+float overlay_text(float x, float y, float line_height, const char *text,
+        bool centered, uint32_t rgba);
+const overlay_vertex* overlay_vertices(int *count);
+
+bool subtitles_load(const char *path);
+// Text of the cue showing at ms, or 0.
+const char* subtitles_at(int64_t ms);
+int subtitles_count();
+
+#endif // OVERLAY_H
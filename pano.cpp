@@ -0,0 +1,539 @@
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <map>
+#include <vector>
+#include <algorithm>
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pano.h"
+#include "frame_arena.h"
+
+#define PANO_MAGIC "VRPANO1"
+#define PANO_ALIGN 4096 // tiles start on page boundaries
+#define TILE_BYTES (PANO_TILE_SIZE * PANO_TILE_SIZE * 4)
+#define ATLAS_SIZE (PANO_ATLAS_TILES * PANO_TILE_SIZE)
+#define ATLAS_SLOTS (PANO_ATLAS_TILES * PANO_ATLAS_TILES)
+#define CONE_MARGIN 0.15f // radians, the pose still moves after pano_update()
+
+struct pano_header {
+    char magic[8];
+    uint32_t width, height; // level 0
+    uint32_t tile_size;
+    uint32_t levels;
+    uint64_t level_offset[PANO_MAX_LEVELS]; // first tile of each level, tiles row by row
+};
+
+struct pano_level {
+    int width, height; // pixels
+    int cols, rows;    // tiles
+    uint64_t offset;
+};
+
+struct visible_tile {
+    float angle; // from the view direction, uploads go center first
+    int col, row;
+};
+
+static struct _pano {
+    bool active;
+    int fd;
+    const uint8_t *map;
+    size_t map_size;
+    int levels;
+    pano_level level[PANO_MAX_LEVELS];
+
+    GLuint atlas;
+    std::map<uint64_t, int> resident; // tile key -> atlas slot
+    uint64_t slot_key[ATLAS_SLOTS];
+    unsigned int slot_used[ATLAS_SLOTS]; // frame of the last use
+    bool slot_taken[ATLAS_SLOTS];
+    bool slot_pinned[ATLAS_SLOTS];
+    unsigned int frame;
+
+    std::vector<pano_vertex> batch;
+    int draw_level, visible;
+    unsigned int uploads;
+} pano;
+
+// Level sizes and file offsets for an image, returns the number of levels.
+static int layout_levels(int width, int height, pano_level *levels)
+{
+    uint64_t offset = PANO_ALIGN;
+    int n = 0;
+    while (n < PANO_MAX_LEVELS) {
+        pano_level *l = &levels[n];
+        l->width = std::max(1, (width + (1 << n) - 1) >> n);
+        l->height = std::max(1, (height + (1 << n) - 1) >> n);
+        l->cols = (l->width + PANO_TILE_SIZE - 1) / PANO_TILE_SIZE;
+        l->rows = (l->height + PANO_TILE_SIZE - 1) / PANO_TILE_SIZE;
+        l->offset = offset;
+        offset += (uint64_t)l->cols * l->rows * TILE_BYTES;
+        n++;
+        if (l->cols == 1 && l->rows == 1)
+            break;
+    }
+    return n;
+}
+
+static uint64_t tile_offset(const pano_level *l, int col, int row)
+{
+    return l->offset + ((uint64_t)row * l->cols + col) * TILE_BYTES;
+}
+
+// Builder
+
+static bool read_ppm_header(FILE *f, int *width, int *height)
+{
+    int values[3], n = 0;
+    if (fgetc(f) != 'P' || fgetc(f) != '6')
+        return false;
+    while (n < 3) {
+        int c = fgetc(f);
+        if (c == '#') {
+            while (c != '\n' && c != EOF)
+                c = fgetc(f);
+        } else if (c >= '0' && c <= '9') {
+            ungetc(c, f);
+            if (fscanf(f, "%d", &values[n++]) != 1)
+                return false;
+        } else if (c == EOF) {
+            return false;
+        }
+    }
+    fgetc(f); // the single whitespace before the pixels
+    *width = values[0];
+    *height = values[1];
+    return values[0] > 0 && values[1] > 0 && values[2] == 255;
+}
+
+static bool write_tile(int fd, const uint8_t *tile, uint64_t offset)
+{
+    return pwrite(fd, tile, TILE_BYTES, offset) == TILE_BYTES;
+}
+
+bool pano_build(const char *ppm_path, const char *out_path)
+{
+    FILE *in = fopen(ppm_path, "rb");
+    if (!in) {
+        perror(ppm_path);
+        return false;
+    }
+    int width, height;
+    if (!read_ppm_header(in, &width, &height)) {
+        fprintf(stderr, "pano: %s is not an 8 bit binary PPM\n", ppm_path);
+        fclose(in);
+        return false;
+    }
+
+    pano_level levels[PANO_MAX_LEVELS];
+    int nlevels = layout_levels(width, height, levels);
+    const pano_level &top = levels[nlevels - 1];
+
+    int fd = open(out_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(out_path);
+        fclose(in);
+        return false;
+    }
+    if (ftruncate(fd, tile_offset(&top, 0, 0) + TILE_BYTES) < 0) {
+        perror(out_path);
+        close(fd);
+        fclose(in);
+        return false;
+    }
+
+    pano_header header;
+    memset(&header, 0, sizeof header);
+    memcpy(header.magic, PANO_MAGIC, sizeof PANO_MAGIC);
+    header.width = width;
+    header.height = height;
+    header.tile_size = PANO_TILE_SIZE;
+    header.levels = nlevels;
+    for (int i = 0; i < nlevels; i++)
+        header.level_offset[i] = levels[i].offset;
+    bool ok = pwrite(fd, &header, sizeof header, 0) == sizeof header;
+
+    // level 0, one strip of tile rows at a time
+    std::vector<uint8_t> strip((size_t)width * 3 * PANO_TILE_SIZE);
+    std::vector<uint8_t> tile(TILE_BYTES);
+    const pano_level &l0 = levels[0];
+    for (int row = 0; ok && row < l0.rows; row++) {
+        int lines = std::min(PANO_TILE_SIZE, height - row * PANO_TILE_SIZE);
+        if (fread(&strip[0], (size_t)width * 3, lines, in) != (size_t)lines) {
+            fprintf(stderr, "pano: %s is truncated\n", ppm_path);
+            ok = false;
+            break;
+        }
+        for (int col = 0; ok && col < l0.cols; col++) {
+            int x0 = col * PANO_TILE_SIZE;
+            int w = std::min(PANO_TILE_SIZE, width - x0);
+            std::fill(tile.begin(), tile.end(), 0);
+            for (int y = 0; y < lines; y++) {
+                const uint8_t *src = &strip[((size_t)y * width + x0) * 3];
+                uint8_t *dst = &tile[y * PANO_TILE_SIZE * 4];
+                for (int x = 0; x < w; x++, src += 3, dst += 4) {
+                    dst[0] = src[2];
+                    dst[1] = src[1];
+                    dst[2] = src[0];
+                    dst[3] = 255;
+                }
+            }
+            ok = write_tile(fd, &tile[0], tile_offset(&l0, col, row));
+        }
+    }
+    fclose(in);
+
+    // every further level from the 2x2 children of the one before, edges clamped
+    std::vector<uint8_t> quad(TILE_BYTES * 4);
+    for (int n = 1; ok && n < nlevels; n++) {
+        const pano_level &src = levels[n - 1];
+        const pano_level &dst = levels[n];
+        for (int row = 0; ok && row < dst.rows; row++) {
+            for (int col = 0; ok && col < dst.cols; col++) {
+                std::fill(quad.begin(), quad.end(), 0);
+                for (int q = 0; q < 4; q++) {
+                    int c = col * 2 + (q & 1), r = row * 2 + (q >> 1);
+                    if (c >= src.cols || r >= src.rows)
+                        continue;
+                    uint8_t *t = &tile[0];
+                    if (pread(fd, t, TILE_BYTES, tile_offset(&src, c, r)) != TILE_BYTES) {
+                        ok = false;
+                        break;
+                    }
+                    for (int y = 0; y < PANO_TILE_SIZE; y++) {
+                        memcpy(&quad[(((q >> 1) * PANO_TILE_SIZE + y) * PANO_TILE_SIZE * 2 +
+                                    (q & 1) * PANO_TILE_SIZE) * 4],
+                                t + y * PANO_TILE_SIZE * 4, PANO_TILE_SIZE * 4);
+                    }
+                }
+
+                // valid part of the quad in the source level
+                int valid_w = std::min(PANO_TILE_SIZE * 2, src.width - col * PANO_TILE_SIZE * 2);
+                int valid_h = std::min(PANO_TILE_SIZE * 2, src.height - row * PANO_TILE_SIZE * 2);
+                std::fill(tile.begin(), tile.end(), 0);
+                for (int y = 0; y < PANO_TILE_SIZE && y * 2 < valid_h; y++) {
+                    int y0 = y * 2, y1 = std::min(y * 2 + 1, valid_h - 1);
+                    for (int x = 0; x < PANO_TILE_SIZE && x * 2 < valid_w; x++) {
+                        int x0 = x * 2, x1 = std::min(x * 2 + 1, valid_w - 1);
+                        const uint8_t *p[4] = {
+                            &quad[(y0 * PANO_TILE_SIZE * 2 + x0) * 4],
+                            &quad[(y0 * PANO_TILE_SIZE * 2 + x1) * 4],
+                            &quad[(y1 * PANO_TILE_SIZE * 2 + x0) * 4],
+                            &quad[(y1 * PANO_TILE_SIZE * 2 + x1) * 4],
+                        };
+                        uint8_t *d = &tile[(y * PANO_TILE_SIZE + x) * 4];
+                        for (int ch = 0; ch < 4; ch++)
+                            d[ch] = (p[0][ch] + p[1][ch] + p[2][ch] + p[3][ch] + 2) >> 2;
+                    }
+                }
+                ok = write_tile(fd, &tile[0], tile_offset(&dst, col, row));
+            }
+        }
+        printf("pano: level %d %dx%d, %dx%d tiles\n", n, dst.width, dst.height, dst.cols, dst.rows);
+    }
+
+    close(fd);
+    if (!ok) {
+        fprintf(stderr, "pano: failed to write %s\n", out_path);
+        return false;
+    }
+    printf("pano: %s, %dx%d in %d levels\n", out_path, width, height, nlevels);
+    return true;
+}
+
+// Viewer
+
+bool pano_open(const char *path)
+{
+    pano_header header;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    if (pread(fd, &header, sizeof header, 0) != sizeof header ||
+            memcmp(header.magic, PANO_MAGIC, sizeof PANO_MAGIC) != 0) {
+        close(fd);
+        return false;
+    }
+    if (header.tile_size != PANO_TILE_SIZE) {
+        fprintf(stderr, "pano: %s has %u pixel tiles, %d are supported\n",
+                path, header.tile_size, PANO_TILE_SIZE);
+        close(fd);
+        return false;
+    }
+
+    pano.levels = layout_levels(header.width, header.height, pano.level);
+    struct stat st;
+    const pano_level &top = pano.level[pano.levels - 1];
+    if (pano.levels != (int)header.levels || fstat(fd, &st) < 0 ||
+            (uint64_t)st.st_size < tile_offset(&top, 0, 0) + TILE_BYTES) {
+        fprintf(stderr, "pano: %s is truncated\n", path);
+        close(fd);
+        return false;
+    }
+
+    // tiles are looked up all over the file, readahead of neighbours in the
+    // file wouldn't be the neighbours on the sphere
+    void *map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror(path);
+        close(fd);
+        return false;
+    }
+    madvise(map, st.st_size, MADV_RANDOM);
+
+    pano.fd = fd;
+    pano.map = (const uint8_t*)map;
+    pano.map_size = st.st_size;
+    pano.active = true;
+    printf("pano: %s, %ux%u in %d levels of %d pixel tiles\n", path,
+            header.width, header.height, pano.levels, PANO_TILE_SIZE);
+    return true;
+}
+
+void pano_close()
+{
+    if (!pano.active)
+        return;
+    munmap((void*)pano.map, pano.map_size);
+    close(pano.fd);
+    if (pano.atlas)
+        glDeleteTextures(1, &pano.atlas);
+    pano.resident.clear();
+    pano.active = false;
+}
+
+bool pano_active()
+{
+    return pano.active;
+}
+
+GLuint pano_atlas()
+{
+    return pano.atlas;
+}
+
+static uint64_t tile_key(int level, int col, int row)
+{
+    return ((uint64_t)level << 48) | ((uint64_t)row << 24) | col;
+}
+
+// Upload a tile into a free or the least recently used slot, -1 when every
+// slot was used this frame.
+static int upload_tile(int level, int col, int row, bool pin)
+{
+    int slot = -1;
+    for (int i = 0; i < ATLAS_SLOTS; i++) {
+        if (!pano.slot_taken[i]) {
+            slot = i;
+            break;
+        }
+        if (!pano.slot_pinned[i] && pano.slot_used[i] != pano.frame &&
+                (slot < 0 || pano.slot_used[i] < pano.slot_used[slot]))
+            slot = i;
+    }
+    if (slot < 0)
+        return -1;
+    if (pano.slot_taken[slot])
+        pano.resident.erase(pano.slot_key[slot]);
+
+    const uint8_t *pixels = pano.map + tile_offset(&pano.level[level], col, row);
+    glBindTexture(GL_TEXTURE_2D, pano.atlas);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, (slot % PANO_ATLAS_TILES) * PANO_TILE_SIZE,
+            (slot / PANO_ATLAS_TILES) * PANO_TILE_SIZE, PANO_TILE_SIZE, PANO_TILE_SIZE,
+            GL_BGRA, GL_UNSIGNED_BYTE, pixels);
+
+    uint64_t key = tile_key(level, col, row);
+    pano.resident[key] = slot;
+    pano.slot_key[slot] = key;
+    pano.slot_taken[slot] = true;
+    pano.slot_pinned[slot] = pin;
+    pano.slot_used[slot] = pano.frame;
+    pano.uploads++;
+    return slot;
+}
+
+bool pano_init_cache()
+{
+    if (ATLAS_SIZE > 4096) {
+        GLint max_size;
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+        if (max_size < ATLAS_SIZE)
+            return false;
+    }
+
+    glGenTextures(1, &pano.atlas);
+    glBindTexture(GL_TEXTURE_2D, pano.atlas);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, ATLAS_SIZE, ATLAS_SIZE, 0,
+            GL_BGRA, GL_UNSIGNED_BYTE, 0);
+    mem_track_gpu("pano", "tile atlas", (size_t)ATLAS_SIZE * ATLAS_SIZE * 4);
+
+    // the coarsest level is a single tile and stays
+    if (upload_tile(pano.levels - 1, 0, 0, true) < 0)
+        return false;
+    pano.uploads = 0;
+    return true;
+}
+
+// Direction to an equirectangular coordinate, u = 0.5 straight ahead (-z).
+static void sphere_dir(float u, float v, float *dir)
+{
+    float lon = (u - 0.5f) * 2 * M_PI;
+    float lat = (0.5f - v) * M_PI;
+    dir[0] = cosf(lat) * sinf(lon);
+    dir[1] = sinf(lat);
+    dir[2] = -cosf(lat) * cosf(lon);
+}
+
+static float angle_between(const float *a, const float *b)
+{
+    float d = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    return acosf(std::max(-1.0f, std::min(1.0f, d)));
+}
+
+// Sphere patch of a tile at level, textured from the finest resident level.
+static void emit_patch(int level, int col, int row)
+{
+    const pano_level &l = pano.level[level];
+
+    int src = level, scol = col, srow = row;
+    std::map<uint64_t, int>::iterator it;
+    while ((it = pano.resident.find(tile_key(src, scol, srow))) == pano.resident.end()) {
+        src++;
+        scol /= 2;
+        srow /= 2;
+    }
+    int slot = it->second;
+    pano.slot_used[slot] = pano.frame;
+
+    // the tile in level pixels, and the same area in the source tile
+    float x0 = col * PANO_TILE_SIZE, x1 = std::min((col + 1) * PANO_TILE_SIZE, l.width);
+    float y0 = row * PANO_TILE_SIZE, y1 = std::min((row + 1) * PANO_TILE_SIZE, l.height);
+    float k = 1.0f / (1 << (src - level));
+    const pano_level &sl = pano.level[src];
+    float valid_w = std::min(PANO_TILE_SIZE, sl.width - scol * PANO_TILE_SIZE);
+    float valid_h = std::min(PANO_TILE_SIZE, sl.height - srow * PANO_TILE_SIZE);
+    float atlas_x = (slot % PANO_ATLAS_TILES) * PANO_TILE_SIZE;
+    float atlas_y = (slot / PANO_ATLAS_TILES) * PANO_TILE_SIZE;
+
+    pano_vertex grid[PANO_PATCH_STEPS + 1][PANO_PATCH_STEPS + 1];
+    for (int j = 0; j <= PANO_PATCH_STEPS; j++) {
+        for (int i = 0; i <= PANO_PATCH_STEPS; i++) {
+            float x = x0 + (x1 - x0) * i / PANO_PATCH_STEPS;
+            float y = y0 + (y1 - y0) * j / PANO_PATCH_STEPS;
+            float dir[3];
+            sphere_dir(x / l.width, y / l.height, dir);
+
+            // half a texel in, linear filtering must not reach the next slot
+            float sx = std::max(0.5f, std::min(valid_w - 0.5f, x * k - scol * PANO_TILE_SIZE));
+            float sy = std::max(0.5f, std::min(valid_h - 0.5f, y * k - srow * PANO_TILE_SIZE));
+
+            pano_vertex *v = &grid[j][i];
+            v->x = dir[0] * PANO_RADIUS;
+            v->y = dir[1] * PANO_RADIUS;
+            v->z = dir[2] * PANO_RADIUS;
+            v->s = (atlas_x + sx) / ATLAS_SIZE;
+            v->t = (atlas_y + sy) / ATLAS_SIZE;
+        }
+    }
+
+    for (int j = 0; j < PANO_PATCH_STEPS; j++) {
+        for (int i = 0; i < PANO_PATCH_STEPS; i++) {
+            pano.batch.push_back(grid[j][i]);
+            pano.batch.push_back(grid[j + 1][i]);
+            pano.batch.push_back(grid[j + 1][i + 1]);
+            pano.batch.push_back(grid[j][i]);
+            pano.batch.push_back(grid[j + 1][i + 1]);
+            pano.batch.push_back(grid[j][i + 1]);
+        }
+    }
+}
+
+const pano_vertex* pano_update(const float forward[3], float cone, float pixels_per_radian,
+        int *count)
+{
+    pano.frame++;
+    pano.batch.clear();
+
+    // coarsest level that still has a texel per eye buffer pixel
+    int level = 0;
+    while (level + 1 < pano.levels &&
+            pano.level[level + 1].width / (2 * M_PI) >= pixels_per_radian)
+        level++;
+    pano.draw_level = level;
+
+    const pano_level &l = pano.level[level];
+    std::vector<visible_tile> tiles, missing;
+    for (int row = 0; row < l.rows; row++) {
+        for (int col = 0; col < l.cols; col++) {
+            float x0 = (float)col * PANO_TILE_SIZE / l.width;
+            float x1 = std::min(1.0f, (float)(col + 1) * PANO_TILE_SIZE / l.width);
+            float y0 = (float)row * PANO_TILE_SIZE / l.height;
+            float y1 = std::min(1.0f, (float)(row + 1) * PANO_TILE_SIZE / l.height);
+
+            // the farthest of the corners and edge midpoints bounds the tile
+            float center[3], p[3], radius = 0;
+            sphere_dir((x0 + x1) / 2, (y0 + y1) / 2, center);
+            for (int i = 0; i < 9; i++) {
+                sphere_dir(x0 + (x1 - x0) * (i % 3) / 2, y0 + (y1 - y0) * (i / 3) / 2, p);
+                radius = std::max(radius, angle_between(center, p));
+            }
+
+            visible_tile t;
+            t.angle = angle_between(forward, center);
+            t.col = col;
+            t.row = row;
+            if (t.angle > cone + radius + CONE_MARGIN)
+                continue;
+            tiles.push_back(t);
+
+            std::map<uint64_t, int>::iterator it = pano.resident.find(tile_key(level, col, row));
+            if (it != pano.resident.end())
+                pano.slot_used[it->second] = pano.frame;
+            else
+                missing.push_back(t);
+        }
+    }
+    pano.visible = tiles.size();
+
+    // center of the view first; the rest are read ahead so their upload
+    // doesn't fault on a later frame
+    std::vector<visible_tile>::iterator m;
+    for (m = missing.begin(); m != missing.end(); ++m) {
+        std::vector<visible_tile>::iterator best = m;
+        for (std::vector<visible_tile>::iterator n = m + 1; n != missing.end(); ++n) {
+            if (n->angle < best->angle)
+                best = n;
+        }
+        std::swap(*m, *best);
+
+        if (m - missing.begin() < PANO_UPLOADS_PER_FRAME) {
+            upload_tile(level, m->col, m->row, false);
+        } else {
+            madvise((void*)(pano.map + tile_offset(&l, m->col, m->row)), TILE_BYTES, MADV_WILLNEED);
+        }
+    }
+
+    for (std::vector<visible_tile>::iterator t = tiles.begin(); t != tiles.end(); ++t)
+        emit_patch(level, t->col, t->row);
+
+    *count = pano.batch.size();
+    return pano.batch.empty() ? 0 : &pano.batch[0];
+}
+
+void pano_stats(int *level, int *visible, unsigned int *uploads)
+{
+    *level = pano.draw_level;
+    *visible = pano.visible;
+    *uploads = pano.uploads;
+    pano.uploads = 0;
+}
@@ -0,0 +1,59 @@
+#ifndef PANO_H
+#define PANO_H
+
+#include <cstdio>
+
+#include <GL/glew.h>
+
+// Gigapixel equirectangular stills.
+//
+// A panorama is viewed from a tile pyramid file built once with
+// pano_build(): BGRA tiles of PANO_TILE_SIZE squared, top row first, level 0
+// at full resolution and every further level half the size of the previous
+// one, down to a level that fits into a single tile.  The file is memory
+// mapped, so opening it only reads the header whatever the image size, and
+// tiles are paged in by the kernel when they are first uploaded.
+//
+// The GPU side is a fixed atlas texture of PANO_ATLAS_TILES squared tiles.
+// Every frame pano_update() picks the level whose texel density matches the
+// eye buffer, finds that level's tiles inside the view cone, uploads at most
+// PANO_UPLOADS_PER_FRAME missing ones into the least recently used slots
+// (asking the kernel to read the others ahead), and emits sphere patches
+// for every visible tile, textured from the finest level that is resident.
+// The coarsest level is pinned, so the whole sphere always shows something.
+
+#define PANO_TILE_SIZE 256
+#define PANO_MAX_LEVELS 16
+#define PANO_ATLAS_TILES 16      // atlas of 16x16 tiles, 4096 texels squared
+#define PANO_UPLOADS_PER_FRAME 8 // tiles, the rest are read ahead for later frames
+#define PANO_PATCH_STEPS 8       // quads along each side of a tile's sphere patch
+#define PANO_RADIUS 10.0f        // meters, far enough for head motion not to matter
+
+struct pano_vertex {
+    float x, y, z;
+    float s, t; // atlas coordinates
+};
+
+// Convert a binary PPM (P6, 8 bit) into a tile pyramid, streaming, so the
+// source can be far bigger than memory.
+bool pano_build(const char *ppm_path, const char *out_path);
+
+// false when path isn't a tile pyramid
+bool pano_open(const char *path);
+void pano_close();
+bool pano_active();
+
+// Create the atlas and upload the pinned coarsest level, needs a GL context.
+bool pano_init_cache();
+GLuint pano_atlas();
+
+// forward: unit view direction.  cone: half angle around it that has to be
+// covered, radians.  pixels_per_radian: eye buffer density at the center.
+// Returns this frame's triangles, valid until the next call.
+const pano_vertex* pano_update(const float forward[3], float cone, float pixels_per_radian,
+        int *count);
+
+// level drawn, visible tiles and uploads since the last call
+void pano_stats(int *level, int *visible, unsigned int *uploads);
+
+#endif // PANO_H
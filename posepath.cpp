@@ -0,0 +1,94 @@
+
+#include <cstdio>
+#include <cmath>
+#include <vector>
+
+#include "posepath.h"
+
+struct keyframe {
+    double time;
+    float yaw, pitch, roll; // radians
+};
+
+static std::vector<keyframe> keys;
+
+bool posepath_load(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+
+    char line[256];
+    int lineno = 0;
+    keys.clear();
+    while (fgets(line, sizeof line, f)) {
+        lineno++;
+        keyframe k;
+        char c;
+        if (sscanf(line, " %c", &c) != 1 || c == '#')
+            continue;
+        if (sscanf(line, "%lf %f %f %f", &k.time, &k.yaw, &k.pitch, &k.roll) != 4) {
+            fprintf(stderr, "%s:%d: expected <seconds> <yaw> <pitch> <roll>\n", path, lineno);
+            continue;
+        }
+        if (!keys.empty() && k.time < keys.back().time) {
+            fprintf(stderr, "%s:%d: keyframes must be in time order\n", path, lineno);
+            continue;
+        }
+        k.yaw *= M_PI / 180;
+        k.pitch *= M_PI / 180;
+        k.roll *= M_PI / 180;
+        keys.push_back(k);
+    }
+    fclose(f);
+
+    printf("pose path: %d keyframes from %s\n", (int)keys.size(), path);
+    return !keys.empty();
+}
+
+bool posepath_loaded()
+{
+    return !keys.empty();
+}
+
+// a * b
+static void quat_mul(const float *a, const float *b, float *out)
+{
+    float r[4];
+    r[0] = a[3] * b[0] + a[0] * b[3] + a[1] * b[2] - a[2] * b[1];
+    r[1] = a[3] * b[1] - a[0] * b[2] + a[1] * b[3] + a[2] * b[0];
+    r[2] = a[3] * b[2] + a[0] * b[1] - a[1] * b[0] + a[2] * b[3];
+    r[3] = a[3] * b[3] - a[0] * b[0] - a[1] * b[1] - a[2] * b[2];
+    for (int i = 0; i < 4; i++)
+        out[i] = r[i];
+}
+
+void posepath_sample(double seconds, float *quat)
+{
+    float yaw = 0, pitch = 0, roll = 0;
+
+    if (!keys.empty()) {
+        size_t i = 0;
+        while (i + 1 < keys.size() && keys[i + 1].time <= seconds)
+            i++;
+        const keyframe &a = keys[i];
+        const keyframe &b = i + 1 < keys.size() ? keys[i + 1] : a;
+        float t = 0;
+        if (b.time > a.time && seconds > a.time)
+            t = (seconds - a.time) / (b.time - a.time);
+        if (t > 1)
+            t = 1;
+        yaw = a.yaw + (b.yaw - a.yaw) * t;
+        pitch = a.pitch + (b.pitch - a.pitch) * t;
+        roll = a.roll + (b.roll - a.roll) * t;
+    }
+
+    // yaw about Y, then pitch about X, then roll about Z
+    float qy[4] = { 0, sinf(yaw / 2), 0, cosf(yaw / 2) };
+    float qx[4] = { sinf(pitch / 2), 0, 0, cosf(pitch / 2) };
+    float qz[4] = { 0, 0, sinf(roll / 2), cosf(roll / 2) };
+    quat_mul(qy, qx, quat);
+    quat_mul(quat, qz, quat);
+}
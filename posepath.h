@@ -0,0 +1,22 @@
+#ifndef POSEPATH_H
+#define POSEPATH_H
+
+// Scripted camera path for offline rendering.
+//
+// A text file of keyframes, one per line:
+//
+//   # seconds  yaw  pitch  roll   (degrees)
+//   0          0    0      0
+//   12.5       90   -10    0
+//
+// Angles follow the OVR convention: positive yaw turns left, positive pitch
+// looks up, positive roll tilts the head to the left.  Between keyframes the
+// angles are interpolated linearly, outside them the first or last keyframe
+// holds.
+
+bool posepath_load(const char *path);
+bool posepath_loaded();
+// orientation quaternion (x, y, z, w) at the given media time
+void posepath_sample(double seconds, float *quat);
+
+#endif // POSEPATH_H
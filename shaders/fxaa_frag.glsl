@@ -1,8 +1,17 @@
+//! permute PROFILE COMPAT CORE
+//! permute AA 0 1
+//! version PROFILE=CORE 330 core
 
 uniform sampler2D u_texture0;
 uniform vec2 resolution;
-uniform bool enabled;
+#if PROFILE == PROFILE_CORE
+in vec2 f_texcoord;
+out vec4 frag_color;
+#define texture2D texture
+#else
 varying vec2 f_texcoord;
+#define frag_color gl_FragColor
+#endif
 
 #ifndef FXAA_REDUCE_MIN
     #define FXAA_REDUCE_MIN   (1.0/ 128.0)
@@ -89,13 +98,10 @@ vec4 apply(sampler2D tex, vec2 fragCoord, vec2 resolution) {
 }
 
 void main() {
-	if (enabled) {
-	    vec2 fragCoord = f_texcoord * resolution;
-	    //vec2 fragCoord = gl_TexCoord[0].st * resolution;
-   		//vec2 fragCoord = gl_FragCoord.xy;
-  	  	gl_FragColor = apply(u_texture0, fragCoord, resolution);
-	} else {
-		gl_FragColor = texture2D(u_texture0, gl_TexCoord[0].st);
-	}
+#if AA
+	vec2 fragCoord = f_texcoord * resolution;
+	frag_color = apply(u_texture0, fragCoord, resolution);
+#else
+	frag_color = texture2D(u_texture0, f_texcoord);
+#endif
 }
-
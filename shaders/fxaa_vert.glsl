@@ -1,11 +1,17 @@
+//! permute PROFILE COMPAT CORE
+//! version PROFILE=CORE 330 core
 
+#if PROFILE == PROFILE_CORE
+in vec2 v_coord;
+out vec2 f_texcoord;
+#else
 attribute vec2 v_coord;
-uniform sampler2D fbo_texture;
 varying vec2 f_texcoord;
+#endif
+uniform sampler2D fbo_texture;
  
 void main(void) {
   gl_Position = vec4(v_coord, 0.0, 1.0);
   f_texcoord = (v_coord + 1.0) / 2.0;
 }
 
-
@@ -0,0 +1,16 @@
+//! permute PROFILE COMPAT CORE
+//! version PROFILE=CORE 330 core
+
+uniform sampler2D layer_texture;
+#if PROFILE == PROFILE_CORE
+in vec4 f_layer;
+out vec4 frag_color;
+#define texture2DProj textureProj
+#else
+varying vec4 f_layer;
+#define frag_color gl_FragColor
+#endif
+
+void main(void) {
+    frag_color = texture2DProj(layer_texture, f_layer);
+}
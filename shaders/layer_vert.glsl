@@ -0,0 +1,29 @@
+//! permute PROFILE COMPAT CORE
+//! version PROFILE=CORE 330 core
+
+// Mono eye render: the screen was drawn once, from between the eyes, into a
+// shared layer.  Each eye draws the screen's plane again and looks it up in
+// the layer through the shared view's projection, which for a plane is an
+// exact reprojection with this eye's disparity.
+
+uniform float eye; // 0 = left, 1 = right
+uniform mat4 layer_matrix; // mesh to layer texture coordinates, projective
+
+#if PROFILE == PROFILE_CORE
+layout(std140) uniform EyeMatrices {
+    mat4 view_proj[2];
+};
+uniform mat4 model;
+in vec4 a_position;
+out vec4 f_layer;
+#define MVP (view_proj[int(eye)] * model)
+#else
+#define a_position gl_Vertex
+#define MVP gl_ModelViewProjectionMatrix
+varying vec4 f_layer;
+#endif
+
+void main(void) {
+    gl_Position = MVP * a_position;
+    f_layer = layer_matrix * a_position;
+}
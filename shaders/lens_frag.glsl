@@ -0,0 +1,44 @@
+//! permute PROFILE COMPAT CORE
+//! permute STEREO NONE SBS OVER_UNDER
+//! permute COLORSPACE RGB RGB_LIMITED
+//! version PROFILE=CORE 330 core
+
+uniform sampler2D fbo_texture;
+uniform float eye; // 0 = left, 1 = right
+uniform vec4 tex_rect; // offset and size of the picture inside the video texture
+#if PROFILE == PROFILE_CORE
+in vec2 f_coord_r;
+in vec2 f_coord_g;
+in vec2 f_coord_b;
+in float f_vignette;
+out vec4 frag_color;
+#define texture2D texture
+#else
+varying vec2 f_coord_r;
+varying vec2 f_coord_g;
+varying vec2 f_coord_b;
+varying float f_vignette;
+#define frag_color gl_FragColor
+#endif
+
+// video texel at screen coordinate st, black off the screen
+vec4 video_texel(vec2 st)
+{
+    if (st.x < 0.0 || st.x > 1.0 || st.y < 0.0 || st.y > 1.0)
+        return vec4(0.0);
+#if STEREO == STEREO_SBS
+    st.x = (st.x + eye) * 0.5;
+#elif STEREO == STEREO_OVER_UNDER
+    st.y = (st.y + eye) * 0.5;
+#endif
+    return texture2D(fbo_texture, tex_rect.xy + st * tex_rect.zw);
+}
+
+void main(void) {
+    vec3 color = vec3(video_texel(f_coord_r).r, video_texel(f_coord_g).g, video_texel(f_coord_b).b);
+#if COLORSPACE == COLORSPACE_RGB_LIMITED
+    // expand studio swing (16-235) to full range
+    color = (color - 16.0 / 255.0) * (255.0 / 219.0);
+#endif
+    frag_color = vec4(color * f_vignette, 1.0);
+}
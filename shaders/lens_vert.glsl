@@ -0,0 +1,93 @@
+//! permute PROFILE COMPAT CORE
+//! permute DISTORTION NONE DOME CYLINDER
+//! version PROFILE=CORE 330 core
+
+// Client-side distortion: the SDK's distortion mesh is drawn straight into
+// the HMD backbuffer.  Each vertex carries the tangents of the eye angles it
+// shows for red, green and blue.  After timewarp the ray along each one is
+// intersected with the screen geometry, so lens, chromatic aberration and
+// screen projection resolve to three video texture coordinates per vertex.
+
+uniform mat4 eye_rotation_start; // timewarp, first and last scanline
+uniform mat4 eye_rotation_end;
+uniform mat4 eye_to_mesh;        // inverse of this eye's view * picture
+uniform vec3 mesh_focus;         // focal point of dome
+uniform float mesh_radius;
+uniform float mesh_size;         // the screen mesh spans +-mesh_size/2
+uniform vec4 mesh_crop;          // the crop's offset (xy) and scale (zw) on the mesh
+
+#if PROFILE == PROFILE_CORE
+in vec2 v_coord;   // ScreenPosNDC
+in vec2 a_lens;    // TimeWarpFactor, VignetteFactor
+in vec2 a_tan_r;
+in vec2 a_tan_g;
+in vec2 a_tan_b;
+out vec2 f_coord_r;
+out vec2 f_coord_g;
+out vec2 f_coord_b;
+out float f_vignette;
+#else
+attribute vec2 v_coord;
+attribute vec2 a_lens;
+attribute vec2 a_tan_r;
+attribute vec2 a_tan_g;
+attribute vec2 a_tan_b;
+varying vec2 f_coord_r;
+varying vec2 f_coord_g;
+varying vec2 f_coord_b;
+varying float f_vignette;
+#endif
+
+// 0..1 coordinate on the screen mesh seen along tan, far outside that range
+// when the ray misses the screen
+vec2 screen_coord(vec2 tan, float timewarp)
+{
+    vec4 dir = vec4(tan, 1.0, 0.0);
+    vec3 warped = mix((eye_rotation_start * dir).xyz, (eye_rotation_end * dir).xyz, timewarp);
+    // the SDK's eye space has y down and z forward
+    vec3 ray = (eye_to_mesh * vec4(warped.x, -warped.y, -warped.z, 0.0)).xyz;
+    vec3 origin = (eye_to_mesh * vec4(0.0, 0.0, 0.0, 1.0)).xyz;
+    // intersect the full screen's curve, the crop only picks a part of it
+    ray.xy *= mesh_crop.zw;
+    origin.xy = mesh_crop.xy + origin.xy * mesh_crop.zw;
+    float t = -1.0;
+
+#if DISTORTION == DISTORTION_NONE
+    if (ray.z != 0.0)
+        t = -origin.z / ray.z;
+#else
+#if DISTORTION == DISTORTION_DOME
+    vec3 o = origin - mesh_focus;
+    vec3 r = ray;
+#else
+    // cylinder around the vertical axis through the focus
+    vec3 o = vec3(origin.x - mesh_focus.x, 0.0, origin.z - mesh_focus.z);
+    vec3 r = vec3(ray.x, 0.0, ray.z);
+#endif
+    float a = dot(r, r);
+    float b = dot(o, r);
+    float disc = b * b - a * (dot(o, o) - mesh_radius * mesh_radius);
+    if (a > 0.0 && disc >= 0.0) {
+        // the mesh is the half behind the focus, take the nearest hit on it
+        float t0 = (-b - sqrt(disc)) / a;
+        float t1 = (-b + sqrt(disc)) / a;
+        if (t0 > 0.0 && o.z + t0 * r.z <= 0.0)
+            t = t0;
+        else if (t1 > 0.0 && o.z + t1 * r.z <= 0.0)
+            t = t1;
+    }
+#endif
+
+    if (t <= 0.0)
+        return vec2(-10.0);
+    vec2 hit = ((origin + t * ray).xy - mesh_crop.xy) / mesh_crop.zw;
+    return hit / mesh_size + 0.5;
+}
+
+void main(void) {
+    gl_Position = vec4(v_coord, 0.0, 1.0);
+    f_coord_r = screen_coord(a_tan_r, a_lens.x);
+    f_coord_g = screen_coord(a_tan_g, a_lens.x);
+    f_coord_b = screen_coord(a_tan_b, a_lens.x);
+    f_vignette = a_lens.y;
+}
@@ -0,0 +1,22 @@
+//! permute PROFILE COMPAT CORE
+//! permute COLORSPACE RGB RGB_LIMITED
+//! version PROFILE=CORE 330 core
+
+uniform sampler2D fbo_texture;
+#if PROFILE == PROFILE_CORE
+in vec2 f_texcoord;
+out vec4 frag_color;
+#define texture2D texture
+#else
+varying vec2 f_texcoord;
+#define frag_color gl_FragColor
+#endif
+ 
+void main(void) {
+    vec4 color = texture2D(fbo_texture, f_texcoord);
+#if COLORSPACE == COLORSPACE_RGB_LIMITED
+    // expand studio swing (16-235) to full range
+    color.rgb = (color.rgb - 16.0 / 255.0) * (255.0 / 219.0);
+#endif
+    frag_color = color;
+}
@@ -0,0 +1,52 @@
+//! permute PROFILE COMPAT CORE
+//! permute DISTORTION NONE DOME CYLINDER
+//! permute STEREO NONE SBS OVER_UNDER
+//! version PROFILE=CORE 330 core
+
+uniform vec3 mesh_focus; // focal point of dome
+uniform float mesh_radius;
+uniform vec4 mesh_crop; // the crop's offset (xy) and scale (zw) on the mesh
+uniform float eye; // 0 = left, 1 = right
+uniform vec4 tex_rect; // offset and size of the picture inside the video texture
+
+#if PROFILE == PROFILE_CORE
+// both eyes' view-projection, uploaded once per frame
+layout(std140) uniform EyeMatrices {
+    mat4 view_proj[2];
+};
+uniform mat4 model;
+in vec4 a_position;
+in vec2 a_texcoord;
+out vec2 f_texcoord;
+#define MVP (view_proj[int(eye)] * model)
+#else
+#define a_position gl_Vertex
+#define a_texcoord gl_MultiTexCoord0.st
+#define MVP gl_ModelViewProjectionMatrix
+varying vec2 f_texcoord;
+#endif
+ 
+void main(void) {
+    vec4 vert = a_position;
+    // the curve is the full screen's, the model matrix crops the mesh after
+    vec2 screen = mesh_crop.xy + a_position.xy * mesh_crop.zw;
+#if DISTORTION == DISTORTION_DOME
+    float mesh_dist = distance(screen, vec2(mesh_focus));
+#elif DISTORTION == DISTORTION_CYLINDER
+    float mesh_dist = abs(screen.x - mesh_focus.x);
+#endif
+#if DISTORTION != DISTORTION_NONE
+    float z_delta = sqrt(pow(mesh_radius,2) - pow(mesh_dist,2));
+    vert.z = mesh_focus.z - z_delta;
+#endif
+    gl_Position = MVP * vert;
+
+    // the mesh spans 0..1, pick this eye's half of a stereo frame
+    vec2 st = a_texcoord;
+#if STEREO == STEREO_SBS
+    st.x = (st.x + eye) * 0.5;
+#elif STEREO == STEREO_OVER_UNDER
+    st.y = (st.y + eye) * 0.5;
+#endif
+    f_texcoord = tex_rect.xy + st * tex_rect.zw;
+}
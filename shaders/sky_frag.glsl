@@ -0,0 +1,103 @@
+//! permute PROFILE COMPAT CORE
+//! permute PROJECTION CUBEMAP EAC
+//! permute STEREO NONE SBS OVER_UNDER
+//! permute COLORSPACE RGB RGB_LIMITED
+//! version PROFILE=CORE 330 core
+
+// 360 video packed as six cube faces in a 3x2 grid, sampled straight from
+// the 2D video texture by picking the face along the view direction.
+//
+// CUBEMAP: ffmpeg's c3x2 layout, top row right, left, up, bottom row down,
+// front, back, all upright.
+// EAC: YouTube's equi-angular cubemap, top row left, front, right, bottom
+// row down, back, up turned a quarter clockwise as one strip, and pixels
+// spaced evenly in angle instead of in tangent.
+//
+// Face coordinates run -1..1 left to right and bottom to top as seen from
+// the inside; up has the back at its top edge, down the front.
+
+uniform sampler2D fbo_texture;
+uniform float eye; // 0 = left, 1 = right
+uniform vec4 tex_rect; // offset and size of the picture inside the video texture
+uniform vec2 face_inset; // half a texel in face coordinates, keeps filtering off the next face
+
+#if PROFILE == PROFILE_CORE
+in vec3 f_direction;
+out vec4 frag_color;
+#define texture2D texture
+#else
+varying vec3 f_direction;
+#define frag_color gl_FragColor
+#endif
+
+// grid column, row from the top and clockwise quarter turns of each face
+#if PROJECTION == PROJECTION_CUBEMAP
+#define CELL_RIGHT vec3(0.0, 0.0, 0.0)
+#define CELL_LEFT  vec3(1.0, 0.0, 0.0)
+#define CELL_UP    vec3(2.0, 0.0, 0.0)
+#define CELL_DOWN  vec3(0.0, 1.0, 0.0)
+#define CELL_FRONT vec3(1.0, 1.0, 0.0)
+#define CELL_BACK  vec3(2.0, 1.0, 0.0)
+#else
+#define CELL_LEFT  vec3(0.0, 0.0, 0.0)
+#define CELL_FRONT vec3(1.0, 0.0, 0.0)
+#define CELL_RIGHT vec3(2.0, 0.0, 0.0)
+#define CELL_DOWN  vec3(0.0, 1.0, 3.0)
+#define CELL_BACK  vec3(1.0, 1.0, 1.0)
+#define CELL_UP    vec3(2.0, 1.0, 3.0)
+#endif
+
+void main(void) {
+    vec3 d = f_direction;
+    vec3 a = abs(d);
+    vec2 uv;
+    vec3 cell;
+    if (a.x >= a.y && a.x >= a.z) {
+        if (d.x > 0.0) {
+            uv = vec2(d.z, d.y) / a.x;
+            cell = CELL_RIGHT;
+        } else {
+            uv = vec2(-d.z, d.y) / a.x;
+            cell = CELL_LEFT;
+        }
+    } else if (a.y >= a.z) {
+        if (d.y > 0.0) {
+            uv = vec2(d.x, d.z) / a.y;
+            cell = CELL_UP;
+        } else {
+            uv = vec2(d.x, -d.z) / a.y;
+            cell = CELL_DOWN;
+        }
+    } else {
+        if (d.z < 0.0) {
+            uv = vec2(d.x, d.y) / a.z;
+            cell = CELL_FRONT;
+        } else {
+            uv = vec2(-d.x, d.y) / a.z;
+            cell = CELL_BACK;
+        }
+    }
+#if PROJECTION == PROJECTION_EAC
+    uv = atan(uv) * (4.0 / 3.14159265);
+#endif
+    if (cell.z == 1.0)
+        uv = vec2(uv.y, -uv.x);
+    else if (cell.z == 3.0)
+        uv = vec2(-uv.y, uv.x);
+    uv = clamp(uv, face_inset - 1.0, 1.0 - face_inset);
+
+    // row 0 is the top half, texture t runs bottom to top
+    vec2 st = vec2((cell.x + (uv.x + 1.0) * 0.5) / 3.0,
+                   (1.0 - cell.y + (uv.y + 1.0) * 0.5) * 0.5);
+#if STEREO == STEREO_SBS
+    st.x = (st.x + eye) * 0.5;
+#elif STEREO == STEREO_OVER_UNDER
+    st.y = (st.y + eye) * 0.5;
+#endif
+    vec4 color = texture2D(fbo_texture, tex_rect.xy + st * tex_rect.zw);
+#if COLORSPACE == COLORSPACE_RGB_LIMITED
+    // expand studio swing (16-235) to full range
+    color.rgb = (color.rgb - 16.0 / 255.0) * (255.0 / 219.0);
+#endif
+    frag_color = color;
+}
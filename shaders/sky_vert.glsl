@@ -0,0 +1,22 @@
+//! permute PROFILE COMPAT CORE
+//! version PROFILE=CORE 330 core
+
+// A cube around the viewer, drawn with the head rotation only so the faces
+// are infinitely far away.  The fragment shader looks the video up along
+// the interpolated direction.
+
+#if PROFILE == PROFILE_CORE
+uniform mat4 sky_matrix; // projection * view rotation
+in vec4 a_position;
+out vec3 f_direction;
+#define MVP sky_matrix
+#else
+#define a_position gl_Vertex
+#define MVP gl_ModelViewProjectionMatrix
+varying vec3 f_direction;
+#endif
+
+void main(void) {
+    f_direction = a_position.xyz;
+    gl_Position = MVP * a_position;
+}
@@ -0,0 +1,18 @@
+//! permute PROFILE COMPAT CORE
+//! version PROFILE=CORE 330 core
+
+uniform sampler2D glyph_atlas; // coverage in the red channel
+#if PROFILE == PROFILE_CORE
+in vec2 f_texcoord;
+in vec4 f_color;
+out vec4 frag_color;
+#define texture2D texture
+#else
+varying vec2 f_texcoord;
+varying vec4 f_color;
+#define frag_color gl_FragColor
+#endif
+
+void main(void) {
+    frag_color = vec4(f_color.rgb, f_color.a * texture2D(glyph_atlas, f_texcoord).r);
+}
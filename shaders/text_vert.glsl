@@ -0,0 +1,30 @@
+//! permute PROFILE COMPAT CORE
+//! version PROFILE=CORE 330 core
+
+uniform float eye; // 0 = left, 1 = right
+
+#if PROFILE == PROFILE_CORE
+layout(std140) uniform EyeMatrices {
+    mat4 view_proj[2];
+};
+uniform mat4 model;
+in vec4 a_position;
+in vec2 a_texcoord;
+in vec4 a_color;
+out vec2 f_texcoord;
+out vec4 f_color;
+#define MVP (view_proj[int(eye)] * model)
+#else
+#define a_position gl_Vertex
+#define a_texcoord gl_MultiTexCoord0.st
+#define a_color gl_Color
+#define MVP gl_ModelViewProjectionMatrix
+varying vec2 f_texcoord;
+varying vec4 f_color;
+#endif
+
+void main(void) {
+    gl_Position = MVP * a_position;
+    f_texcoord = a_texcoord;
+    f_color = a_color;
+}
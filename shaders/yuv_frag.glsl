@@ -0,0 +1,101 @@
+//! permute PROFILE COMPAT CORE
+//! permute TRANSFER SDR PQ HLG
+//! version PROFILE=CORE 330 core
+
+// 10 bit 4:2:0 video to RGB, once per decoded frame, into the texture the
+// projection shaders sample (-b).  The source is one 16 bit red texture of
+// the staging buffer: the luma rows, then the chroma rows with Cb and Cr
+// interleaved, top row first.  Output rows are bottom row first with the
+// crop at the origin, as uploaded RGB frames are.
+//
+// SDR: BT.709, the signal stays as it is.
+// PQ, HLG: BT.2020, tone mapped to BT.709 with the reference white at
+// 203 nits and highlights rolled off up to 1000 nits.
+
+uniform sampler2D u_texture0;
+uniform vec2 texture_size;  // texels of u_texture0
+uniform vec2 luma_size;     // picture pixels
+uniform vec4 crop_rect;     // x, y, w, h in picture pixels, top row first
+uniform float sample_scale; // samples to 0..1 of the 10 bit code range
+
+#if PROFILE == PROFILE_CORE
+out vec4 frag_color;
+#define texture2D texture
+#else
+#define frag_color gl_FragColor
+#endif
+
+#define LUMA_2020 vec3(0.2627, 0.6780, 0.0593)
+#define REFERENCE_WHITE 203.0 // nits
+#define PEAK (1000.0 / REFERENCE_WHITE)
+
+float fetch(vec2 texel)
+{
+    return texture2D(u_texture0, (texel + 0.5) / texture_size).r * sample_scale;
+}
+
+vec2 cbcr(vec2 c)
+{
+    return vec2(fetch(vec2(2.0 * c.x, luma_size.y + c.y)),
+            fetch(vec2(2.0 * c.x + 1.0, luma_size.y + c.y)));
+}
+
+// bilinear between the chroma samples around chroma position c
+vec2 chroma(vec2 c)
+{
+    vec2 last = ceil(luma_size / 2.0) - 1.0;
+    c = clamp(c, vec2(0.0), last);
+    vec2 i = floor(c);
+    vec2 j = min(i + 1.0, last);
+    vec2 f = c - i;
+    return mix(mix(cbcr(i), cbcr(vec2(j.x, i.y)), f.x),
+            mix(cbcr(vec2(i.x, j.y)), cbcr(j), f.x), f.y);
+}
+
+#if TRANSFER == TRANSFER_PQ
+// SMPTE ST 2084, nits
+vec3 eotf(vec3 e)
+{
+    vec3 p = pow(e, vec3(1.0 / 78.84375));
+    return 10000.0 * pow(max(p - 0.8359375, 0.0) / (18.8515625 - 18.6875 * p),
+            vec3(1.0 / 0.1593017578125));
+}
+#elif TRANSFER == TRANSFER_HLG
+// ARIB STD-B67 inverse OETF and the BT.2100 OOTF of a 1000 nit display
+vec3 eotf(vec3 e)
+{
+    vec3 lo = e * e / 3.0;
+    vec3 hi = (exp((e - 0.55991073) / 0.17883277) + 0.28466892) / 12.0;
+    vec3 scene = mix(lo, hi, step(0.5, e));
+    return 1000.0 * scene * pow(max(dot(scene, LUMA_2020), 1e-6), 0.2);
+}
+#endif
+
+void main(void) {
+    // picture position of this fragment, rows from the top
+    vec2 p = vec2(crop_rect.x + gl_FragCoord.x, crop_rect.y + crop_rect.w - gl_FragCoord.y);
+    float y = fetch(floor(p));
+    // chroma sited left of its luma pair, centered between its rows
+    vec2 c = chroma(vec2(p.x * 0.5 - 0.25, p.y * 0.5 - 0.5));
+
+    // studio swing
+    y = (y - 64.0 / 1023.0) * (1023.0 / 876.0);
+    c = (c - 512.0 / 1023.0) * (1023.0 / 896.0);
+
+#if TRANSFER == TRANSFER_SDR
+    vec3 rgb = vec3(y + 1.5748 * c.y, y - 0.1873 * c.x - 0.4681 * c.y, y + 1.8556 * c.x);
+#else
+    vec3 rgb = vec3(y + 1.4746 * c.y, y - 0.16455 * c.x - 0.57135 * c.y, y + 1.8814 * c.x);
+    vec3 light = eotf(clamp(rgb, 0.0, 1.0)) / REFERENCE_WHITE;
+
+    // extended Reinhard on the luminance, the peak maps to white
+    float l = dot(light, LUMA_2020);
+    light *= (1.0 + l / (PEAK * PEAK)) / (1.0 + l);
+
+    light = vec3(dot(light, vec3(1.6605, -0.5876, -0.0728)),
+            dot(light, vec3(-0.1246, 1.1329, -0.0083)),
+            dot(light, vec3(-0.0182, -0.1006, 1.1187)));
+    rgb = pow(clamp(light, 0.0, 1.0), vec3(1.0 / 2.4));
+#endif
+    frag_color = vec4(clamp(rgb, 0.0, 1.0), 1.0);
+}
@@ -0,0 +1,185 @@
+
+#include <cstdio>
+#include <cstring>
+
+#include "trace.h"
+
+#define TRACE_BUFFER_SIZE (1 << 16)
+
+struct trace_file_header {
+    char magic[4];
+    uint32_t version;
+} __attribute__((packed));
+
+static struct _trace {
+    FILE *file;
+    bool recording;
+    bool replaying;
+    bool eof;
+
+    // replay lookahead: the next unread record
+    uint8_t next_type;
+    trace_event next_event;
+    trace_frame next_frame;
+
+    // the frame record handed out last, so it can be asked for again
+    bool have_current;
+    trace_frame current;
+
+    unsigned int events;
+    unsigned int frames;
+} trace;
+
+static void read_next()
+{
+    uint8_t type;
+
+    trace.next_type = 0;
+    if (fread(&type, 1, 1, trace.file) != 1) {
+        trace.eof = true;
+        return;
+    }
+
+    size_t ok = 0;
+    if (type == TRACE_EVENT)
+        ok = fread(&trace.next_event, sizeof trace.next_event, 1, trace.file);
+    else if (type == TRACE_FRAME)
+        ok = fread(&trace.next_frame, sizeof trace.next_frame, 1, trace.file);
+
+    if (ok != 1) {
+        fprintf(stderr, "trace: truncated or unknown record (type %u)\n", type);
+        trace.eof = true;
+        return;
+    }
+    trace.next_type = type;
+}
+
+bool trace_record(const char *path)
+{
+    trace_file_header header;
+
+    memset(&trace, 0, sizeof trace);
+    trace.file = fopen(path, "wb");
+    if (!trace.file) {
+        perror(path);
+        return false;
+    }
+    setvbuf(trace.file, 0, _IOFBF, TRACE_BUFFER_SIZE);
+
+    memcpy(header.magic, TRACE_MAGIC, 4);
+    header.version = TRACE_VERSION;
+    fwrite(&header, sizeof header, 1, trace.file);
+
+    trace.recording = true;
+    printf("Recording pose and input trace to %s\n", path);
+    return true;
+}
+
+bool trace_replay(const char *path)
+{
+    trace_file_header header;
+
+    memset(&trace, 0, sizeof trace);
+    trace.file = fopen(path, "rb");
+    if (!trace.file) {
+        perror(path);
+        return false;
+    }
+    setvbuf(trace.file, 0, _IOFBF, TRACE_BUFFER_SIZE);
+
+    if (fread(&header, sizeof header, 1, trace.file) != 1 ||
+            memcmp(header.magic, TRACE_MAGIC, 4) || header.version != TRACE_VERSION) {
+        fprintf(stderr, "%s is not a version %d vlc-vr trace\n", path, TRACE_VERSION);
+        fclose(trace.file);
+        trace.file = 0;
+        return false;
+    }
+
+    trace.replaying = true;
+    read_next();
+    printf("Replaying pose and input trace from %s\n", path);
+    return true;
+}
+
+void trace_close()
+{
+    if (!trace.file)
+        return;
+
+    fclose(trace.file);
+    printf("trace: %s %u frames, %u events\n",
+            trace.recording ? "recorded" : "replayed", trace.frames, trace.events);
+    trace.file = 0;
+    trace.recording = trace.replaying = false;
+}
+
+bool trace_is_recording()
+{
+    return trace.recording;
+}
+
+bool trace_is_replaying()
+{
+    return trace.replaying;
+}
+
+void trace_write_event(const trace_event *ev)
+{
+    uint8_t type = TRACE_EVENT;
+
+    if (!trace.recording)
+        return;
+    fwrite(&type, 1, 1, trace.file);
+    fwrite(ev, sizeof *ev, 1, trace.file);
+    trace.events++;
+}
+
+void trace_write_frame(const trace_frame *fr)
+{
+    uint8_t type = TRACE_FRAME;
+
+    if (!trace.recording)
+        return;
+    fwrite(&type, 1, 1, trace.file);
+    fwrite(fr, sizeof *fr, 1, trace.file);
+    trace.frames++;
+}
+
+bool trace_next_event(uint32_t frame, trace_event *ev)
+{
+    if (!trace.replaying || trace.next_type != TRACE_EVENT || trace.next_event.frame > frame)
+        return false;
+
+    *ev = trace.next_event;
+    trace.events++;
+    read_next();
+    return true;
+}
+
+bool trace_get_frame(uint32_t frame, trace_frame *fr)
+{
+    if (!trace.replaying)
+        return false;
+
+    if (trace.have_current && trace.current.frame == frame) {
+        *fr = trace.current;
+        return true;
+    }
+
+    // skip anything recorded before this frame, events included
+    while (!trace.eof) {
+        if (trace.next_type == TRACE_FRAME && trace.next_frame.frame >= frame)
+            break;
+        read_next();
+    }
+    if (trace.eof || trace.next_frame.frame != frame)
+        return false;
+
+    trace.current = trace.next_frame;
+    trace.have_current = true;
+    trace.frames++;
+    read_next();
+
+    *fr = trace.current;
+    return true;
+}
@@ -0,0 +1,68 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Head pose and input trace.
+//
+// A recording captures, per rendered frame, the eye poses the frame was drawn
+// with, the tracked head pose and the media position, plus every key event
+// and every committed seek tagged with the frame it arrived before.
+// Replaying feeds those back in place of ovrHmd_GetEyePoses(), SDL key
+// events and the seek debounce so a session renders the same frames again
+// without anyone wearing the HMD.
+//
+// File layout: a trace_file_header followed by packed records, each starting
+// with a one byte type.  Everything is host byte order.
+
+#define TRACE_MAGIC "VVRT"
+#define TRACE_VERSION 2 // 2: seek commits
+
+typedef enum {
+    TRACE_EVENT = 1,
+    TRACE_FRAME = 2,
+} trace_record_type_t;
+
+struct trace_pose {
+    float orientation[4]; // quaternion x, y, z, w
+    float position[3];
+} __attribute__((packed));
+
+struct trace_event {
+    uint32_t frame;      // frame the event was handled before
+    uint32_t ticks;      // SDL_GetTicks() when recorded
+    uint32_t type;       // SDL_KEYDOWN / SDL_KEYUP, or TRACE_SEEK_COMMIT
+    int32_t  sym;
+    uint16_t mod;
+    uint8_t  repeat;
+} __attribute__((packed));
+
+// trace_event type: the pending seek was handed to the player
+#define TRACE_SEEK_COMMIT 0xffff
+
+struct trace_frame {
+    uint32_t frame;
+    double   time;       // ovr_GetTimeInSeconds() of the pose sample
+    int64_t  media_time; // libvlc_media_player_get_time(), ms
+    trace_pose eye[2];
+    trace_pose head;
+    uint32_t status;     // trackingState.StatusFlags
+} __attribute__((packed));
+
+bool trace_record(const char *path);
+bool trace_replay(const char *path);
+void trace_close();
+
+bool trace_is_recording();
+bool trace_is_replaying();
+
+void trace_write_event(const trace_event *ev);
+void trace_write_frame(const trace_frame *fr);
+
+// Replay: returns the next recorded event handled before frame, if any.
+bool trace_next_event(uint32_t frame, trace_event *ev);
+// Replay: the record for frame, can be asked for repeatedly.  False once the
+// trace is exhausted.
+bool trace_get_frame(uint32_t frame, trace_frame *fr);
+
+#endif // TRACE_H
@@ -1,9 +1,15 @@
 
 #include <iostream>
 #include <cstdio>
+#include <cstdarg>
+#include <cstddef> // offsetof
 
 #include <unistd.h> // getopt
 
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
 #include <GL/glew.h>
 #include <GL/glx.h>
 
@@ -25,14 +31,35 @@
 
 #include <vlc/vlc.h>
 
-#include "shaders/cylinder_distort_frag.glsl.h"
-#include "shaders/cylinder_distort_vert.glsl.h"
-#include "shaders/dome_distort_frag.glsl.h"
-#include "shaders/dome_distort_vert.glsl.h"
-#include "shaders/passthrough_frag.glsl.h"
-#include "shaders/passthrough_vert.glsl.h"
+#include "frame_arena.h"
+#include "vrmath.h"
+#include "trace.h"
+#include "capture.h"
+#include "overlay.h"
+#include "posepath.h"
+#include "analyze.h"
+#include "metrics.h"
+#include "pano.h"
+#include "mediaio.h"
+#include "dirty.h"
+#include "framecache.h"
+#include "abr.h"
+#include "log.h"
+#include "imageseq.h"
+
+#include "shaders/screen_frag.glsl.h"
+#include "shaders/screen_vert.glsl.h"
 #include "shaders/fxaa_frag.glsl.h"
 #include "shaders/fxaa_vert.glsl.h"
+#include "shaders/text_frag.glsl.h"
+#include "shaders/text_vert.glsl.h"
+#include "shaders/lens_frag.glsl.h"
+#include "shaders/lens_vert.glsl.h"
+#include "shaders/sky_frag.glsl.h"
+#include "shaders/sky_vert.glsl.h"
+#include "shaders/layer_frag.glsl.h"
+#include "shaders/layer_vert.glsl.h"
+#include "shaders/yuv_frag.glsl.h"
 
 using namespace std;
 
@@ -55,6 +82,16 @@ unsigned int hmd_caps;
 unsigned int frame_index;
 ovrPosef eyePose[2];
 ovrTrackingState trackingState;
+ovrFrameTiming frameTiming;
+double poseSampleTime; // ovr_GetTimeInSeconds() of the last eyePose sample
+
+// How old the pose used for drawing is when the frame reaches the display,
+// for the sample at the top of RenderFrame() and the late latched one.
+struct _pose_latency {
+    double early_sum;
+    double late_sum;
+    unsigned int count;
+} pose_latency;
 
 // jdt: reverse projection for "look-at" GUI selection.
 //bool lookAtValid;
@@ -73,10 +110,6 @@ unsigned int fbo, fb_tex[2], fb_depth;
 unsigned int fb_width, fb_height;
 int fb_tex_width, fb_tex_height;
 //unsigned int stereo_gl_list;
-GLuint fxaa_prog;
-GLuint dome_distort_prog;
-GLuint cylinder_distort_prog;
-GLuint passthrough_prog;
 
 typedef enum {
     STEREO_NONE,
@@ -91,11 +124,155 @@ typedef enum {
     DISTORTION_CYLINDER,
     MAX_DISTORTION
 } distortion_t;
+static const char *distortion_names[MAX_DISTORTION] = { "none", "dome", "cylinder" };
+
+typedef enum {
+    COLORSPACE_RGB,         // full range RGB as vlc delivers it
+    COLORSPACE_RGB_LIMITED, // studio swing RGB, expanded in the shader
+    MAX_COLORSPACE
+} colorspace_t;
+
+typedef enum {
+    PROJECTION_SCREEN,  // flat video on the virtual screen, bent by the distortion
+    PROJECTION_CUBEMAP, // 360 video, 3x2 cube faces
+    PROJECTION_EAC,     // 360 video, 3x2 equi-angular cube faces
+    MAX_PROJECTION
+} projection_t;
+static const char *projection_names[MAX_PROJECTION] = { "screen", "cubemap", "eac" };
+
+typedef enum {
+    TRANSFER_SDR, // BT.709
+    TRANSFER_PQ,  // SMPTE ST 2084, BT.2020
+    TRANSFER_HLG, // ARIB STD-B67, BT.2020
+    MAX_TRANSFER
+} transfer_t;
+static const char *transfer_names[MAX_TRANSFER] = { "sdr", "pq", "hlg" };
+
+// Specialized shader variants generated by cmake/shaders.cmake, the enums
+// above list their values in the same order as the //! permute axes.
+GLuint screen_prog[MAX_DISTORTION][MAX_STEREO_MODE][MAX_COLORSPACE];
+GLuint sky_prog[MAX_PROJECTION - 1][MAX_STEREO_MODE][MAX_COLORSPACE]; // [projection - 1]
+GLuint fxaa_prog[2]; // [use_fxaa]
+GLuint layer_prog;   // mono eye render composite
+GLuint yuv_prog[MAX_TRANSFER]; // 10 bit frames to the video texture, -b
+
+// Core profile path: no matrix stack or immediate mode, geometry lives in
+// VAOs and both eyes' view-projection matrices in one uniform buffer.
+#define EYE_MATRICES_BINDING 0
+#define ATTRIB_POSITION 0
+#define ATTRIB_TEXCOORD 1
+#define ATTRIB_COLOR 2
+#define ATTRIB_LENS 3 // client distortion mesh: timewarp and vignette factors
+#define ATTRIB_TAN_R 4
+#define ATTRIB_TAN_G 5
+#define ATTRIB_TAN_B 6
+GLuint eye_ubo;
+GLuint screen_vao, screen_vbo, screen_ibo;
+GLsizei screen_index_count;
+GLuint quad_vao, quad_vbo; // unit quad for overlays
+GLuint post_vao, post_vbo; // full screen quad for post processing
+GLuint sky_vao, sky_vbo;   // cube around the viewer for 360 layouts
+
+// In-headset text: status after key presses, the seek target and subtitles.
+// Drawn on a plane of its own in front of the screen so it keeps a
+// comfortable depth whatever the screen distance.
+#define OVERLAY_STATUS_MS 3000
+#define OVERLAY_MAX_DEPTH 1.5f    // meters from the viewer
+#define OVERLAY_LINE_HEIGHT 0.03f // per meter of distance, about 1.7 degrees
+struct _overlay {
+    bool enabled;
+    GLuint atlas;
+    GLuint prog;
+    GLuint vao, vbo;
+    int count; // vertices in this frame's batch
+    float bounds[4]; // x0, y0, x1, y1 of the batch in the overlay plane
+    char status[256];
+    Uint32 status_time;
+    mat4 model;
+} overlay;
+
+// Client-side distortion: instead of drawing the eyes into fb_tex[0],
+// running FXAA into fb_tex[1] and letting ovrHmd_EndFrame distort that, the
+// SDK's distortion meshes are drawn straight into the backbuffer with the
+// video texture, see shaders/lens_vert.glsl.  No eye render targets exist
+// in this mode, so neither do the overlay, the thumbnail strip or FXAA.
+struct _lens {
+    bool enabled;
+    GLuint prog[MAX_DISTORTION][MAX_STEREO_MODE][MAX_COLORSPACE];
+    GLuint vao[2], vbo[2], ibo[2];
+    GLsizei index_count[2];
+} lens;
+
+// A tile pyramid instead of a video, see pano.h.  The player stays empty
+// and the sphere around the viewer is drawn in place of the screen.
+struct _panorama {
+    bool enabled;
+    GLuint vao, vbo; // core profile, this frame's tile patches
+    const pano_vertex *verts;
+    int count;
+} panorama;
+
+// Mono eye render (-m): with 2D video on the flat screen both eyes see the
+// same picture from slightly different positions.  The screen is drawn and
+// anti-aliased once, from between the eyes, into a shared layer; each eye
+// then draws the screen's plane sampling the layer through the shared
+// view's projection, an exact reprojection for a plane, so the disparity at
+// the screen's depth is kept while the video and FXAA are shaded once.
+#define MONO_FOV_MARGIN 0.05f // tangent, room for the eyes' offset
+struct _mono {
+    bool enabled;
+    bool active;        // this frame
+    GLuint fbo;
+    GLuint texture[2];  // screen, anti-aliased
+    int width, height;
+    mat4 proj, view, view_proj; // between the eyes
+    unsigned int frames; // drawn mono, for dump_fps
+} mono;
+
+// Fixed foveated rendering (-E): the lenses spread the edges of each eye
+// buffer over fewer display pixels than its middle, so only a window around
+// the lens axis, inner of the eye's width and height, is drawn at full
+// density.  The whole eye is drawn first into a target of scale times the
+// density and scaled up into the eye buffer underneath, then the window is
+// drawn over it.  FXAA and ovrHmd_EndFrame see the one eye buffer as before.
+#define FOVEA_DEFAULT_INNER 0.5f
+#define FOVEA_DEFAULT_SCALE 0.5f
+struct _fovea {
+    bool enabled;
+    float inner;         // share of each eye's width and height at full density
+    float scale;         // pixel density of the periphery
+    GLuint fbo, texture;
+    int width, height;   // periphery target, one eye
+    double shaded_pixels, full_pixels; // for dump_fps
+} fovea = { false, FOVEA_DEFAULT_INNER, FOVEA_DEFAULT_SCALE };
+
+// Pixels of each eye that can show anything: the projected bounds of the
+// screen, the overlay and the thumbnail strip.  The eye clear and the post
+// pass are scissored to them, with a margin for FXAA's sample span.
+#define SCISSOR_MARGIN 10 // pixels
+struct _scissor {
+    SDL_Rect post[2];   // this frame, per eye, in framebuffer pixels
+    SDL_Rect prev[2];   // last frame's post rects, still to clear in fb_tex[1]
+    bool valid;         // fb_tex[1] is black outside prev
+    double post_pixels, clear_pixels, total_pixels; // for dump_fps
+} scissor;
+
+// Camera state computed once per frame and shared by both render paths.
+struct _frame_matrices {
+    mat4 proj[2];
+    mat4 view[2];
+    mat4 view_proj[2]; // what the core profile path uploads
+    mat4 model;        // placement of the virtual screen
+    mat4 crop;         // active picture inside the screen, see VideoCrop()
+    mat4 picture;      // model * crop, what the video is drawn with
+    float mesh_crop[4]; // crop offset x, y and scale x, y, for the curved screens
+} frame_mats;
 
 struct _param {
     bool    console_dump;
     bool    fullscreen;
     bool    use_fxaa;
+    bool    core_profile;
     float   fov;
     bool    no_prediction;
     bool    no_vsync;
@@ -111,9 +288,130 @@ struct _param {
     float   tv_zoffset;
     float   mesh_radius;
     distortion_t distortion;
+    colorspace_t colorspace;
+    projection_t projection;
     bool    view_locked;
+    bool    late_latch; // re-sample the head pose right before drawing
+    bool    analyze;     // detect black bars and the stereo layout
+    bool    scissor;     // clear and post process only the drawn bounds
+    bool    stereo_auto; // follow the detected stereo layout
+    bool    dirty_tiles; // upload only the tiles that changed
+    bool    high_depth;  // decode 10 bit sources to YUV, converted on the GPU
+    transfer_t transfer; // of high_depth sources
+    const char *capture_path;      // eye buffer capture output, 0 if off
+    const char *font_path;         // overlay font
+    const char *subtitle_path;     // .srt shown on the overlay, 0 to look next to the video
+    unsigned int capture_interval; // capture every nth frame
+    mediaio_backend_t io_backend;  // how the video file is read
+    size_t io_window;              // readahead, bytes
 } param;
 
+// Offline rendering: no HMD or visible window, every decoded frame is drawn
+// once through the normal pipeline and written out as fast as the machine
+// allows.  unlock() hands each frame over and waits until it was uploaded, so
+// VLC can run far ahead of realtime without frames being skipped.
+#define OFFLINE_RATE 32 // playback rate asked of VLC, the hand-off paces it
+#define OFFLINE_DEFAULT_FPS 30
+struct _offline {
+    bool enabled;
+    const char *path;  // output, same formats as -o
+    SDL_cond *cond;    // frame handed over / frame uploaded, also for replay
+    unsigned int frames;
+    double fps;        // of the source
+    Uint32 start;
+} offline;
+
+// Trace replay (-T) of a video: frames are handed over one at a time as
+// offline, and each HMD frame shows the decoded frames up to the media
+// position recorded for it.  A frame's position is counted at the source
+// frame rate from the start or the last seek rather than read from the
+// player's clock, so every replay shows the same frames and drift is never
+// corrected by seeking.
+#define REPLAY_WAIT_MS 100 // for a due frame, before drawing without it
+struct _replay {
+    bool enabled;
+    double fps;           // of the source
+    libvlc_time_t base;   // position of the first frame, the start or a seek target
+    unsigned int shown;   // frames uploaded since base
+} replay;
+
+// unlock() hands each frame over and waits until it was uploaded.
+bool GatedDecoding()
+{
+    return offline.enabled || replay.enabled;
+}
+
+// Background upload: decoded frames are uploaded by a thread with its own GL
+// context, shared with the render context, into a ring of textures.  Each
+// finished upload is published with a fence and the render thread switches
+// to the newest texture once that has signalled, so it never transfers
+// pixels itself.  A texture the renderer lets go of gets a fence of its own,
+// which the upload thread waits on in the GPU command stream before writing
+// it again.  Offline rendering keeps the synchronous upload.
+#define UPLOAD_TEXTURES 3  // one shown, one published, one being written
+#define UPLOAD_WAIT_MS 100 // between checks for shutdown
+typedef enum {
+    UPLOAD_FREE,
+    UPLOAD_READY, // published, fence signals when the upload is done
+    UPLOAD_SHOWN, // what RenderFrame() draws
+} upload_state_t;
+struct _uploader {
+    bool enabled;
+    SDL_GLContext context;
+    SDL_Thread *thread;
+    SDL_cond *cond;     // frame decoded, with video.sdlMutex
+    SDL_mutex *mutex;   // state and fence
+    bool stop;
+    GLuint texture[UPLOAD_TEXTURES];
+    GLuint allocated_width[UPLOAD_TEXTURES], allocated_height[UPLOAD_TEXTURES]; // upload thread
+    GLenum allocated_format[UPLOAD_TEXTURES];
+    upload_state_t state[UPLOAD_TEXTURES];
+    GLsync fence[UPLOAD_TEXTURES]; // READY: upload done, FREE: renderer done
+    dirty_hashes contents[UPLOAD_TEXTURES]; // upload thread
+} uploader;
+
+// Looping (-K): the clip restarts whenever it ends.  A pass played from the
+// start without seeking goes into the frame cache; once one has completed
+// VLC only plays the audio (:no-video) and the render thread shows cached
+// frames on its own clock, so later passes decode nothing and frame stepping
+// is instant.  A clip that doesn't fit the budget keeps looping by decoding.
+struct _loop {
+    bool enabled;
+    size_t budget;
+    framecache_storage_t storage;
+    bool filling;    // decoded frames of this pass go into the cache
+    bool cached;     // playing from the cache
+    bool paused;     // cache playback clock stopped at position
+    int frames;      // of a pass
+    double period;   // ms per pass
+    double position; // ms into the pass while paused
+    Uint32 start;    // ticks at the start of the pass
+    int shown;       // cached frame shown last, -1 none
+    int step;        // cached frame stepped back to while decoding, -1 none
+    bool gpu_frame;  // video.displayTexture is a cached frame's texture
+} loop;
+
+// Adaptive streams (-Q): the rendition cap follows what the screen can show
+// and whether frames are dropped, see abr.h.  A new cap reopens the stream
+// with :adaptive-maxheight and VLC's output is sized to it, so lower
+// renditions aren't scaled back up.  Uncapped it is the top of the ladder,
+// or the size the stream started at when larger: a stream starting on a low
+// rendition still gets back to full resolution.
+struct _rendition {
+    bool enabled;
+    unsigned int width, height; // what the stream started at, for the aspect ratio
+} rendition;
+
+// Image sequences (-r, or a directory as the video): frames are decoded by
+// imageseq's workers and delivered through lock/unlock/display like VLC's,
+// the player stays empty.  Seeking, pausing and stepping go to imageseq.
+struct _sequence {
+    bool enabled;
+    double fps;
+    size_t budget;
+    int workers;
+} sequence = { false, IMAGESEQ_DEFAULT_FPS, IMAGESEQ_DEFAULT_BUDGET, 0 };
+
 typedef enum {
     ASPECT_AUTO,
     ASPECT_4_BY_3,
@@ -121,23 +419,53 @@ typedef enum {
     MAX_ASPECT_MODE
 } aspect_ratio_mode_t;
 
+// What VLC decodes into with -b.  Staging buffers then hold the luma rows
+// followed by the chroma rows with Cb and Cr interleaved, 16 bit samples,
+// top row first.
+typedef enum {
+    YUV_NONE, // RV32
+    YUV_I0AL, // planar 4:2:0, 10 bits in the low bits
+    YUV_P010, // luma plane and interleaved chroma plane, 10 bits in the high bits
+} yuv_layout_t;
+
 struct _video {
     Uint32 width;
     Uint32 height;
     Uint32 pitch;
     bool updateFrame;
+    bool reupload;         // the staged frame again (new crop or transfer), not a new one
     SDL_mutex *sdlMutex;
     SDL_Surface *sdlSurface;
     GLuint glTexture[2];
-    Uint8 *glVideo[2];
+    GLuint displayTexture; // glTexture[0], or the upload thread's latest
+    Uint8 *glVideo[2];     // staging, the second one only with the upload thread
+    int stagingLatest;     // glVideo holding the last complete frame
+    int stagingRead;       // glVideo the upload thread is reading, -1 none
+    dirty_hashes stagingHashes[2]; // tiles of each glVideo, with -H
+    dirty_hashes textureHashes;    // what glTexture[0] holds
     GLuint glVideoWidth;
     GLuint glVideoHeight;
     GLuint glVideoPitch;
     unsigned int bpp;
     float aspect_ratio; // auto-detected aspect ratio.
     aspect_ratio_mode_t aspect_ratio_mode;
+    SDL_Rect active;    // detected picture without black bars, top row first
+    bool textureAllocated;
+    yuv_layout_t yuv;
+    Uint8 *yuvPlanes[3]; // what VLC decodes into instead of sdlSurface
+    unsigned int yuvPitch[3];
 } video;
 
+// Conversion of -b frames into the video texture.  Only one context ever
+// uploads, the upload thread's or else the render context, so the objects
+// are created in whichever converts first.
+struct _yuv_pass {
+    GLuint fbo;
+    GLuint vao, vbo; // core profile
+    GLuint texture;  // the staging buffer as 16 bit samples
+    GLuint width, height;
+} yuv_pass;
+
 void setDefaults() {
     param.console_dump = true;
     param.use_fxaa = true;
@@ -177,17 +505,23 @@ void setDefaults() {
     video.width = 0;
     video.height = 0;
     video.updateFrame = false;
+    video.reupload = false;
     video.sdlMutex = 0;
     video.sdlSurface = 0;
     video.glTexture[0] = 0;
     video.glTexture[1] = 0;
+    video.displayTexture = 0;
     video.glVideo[0] = 0;
     video.glVideo[1] = 0;
+    video.stagingLatest = 0;
+    video.stagingRead = -1;
     video.glVideoWidth = 0;
     video.glVideoHeight = 0;
     video.glVideoPitch = 0;
     video.aspect_ratio = 0;
     video.aspect_ratio_mode = ASPECT_AUTO;
+    video.textureAllocated = false;
+    video.yuv = YUV_NONE;
 }
 
 #define NEAR_CLIP_DIST 0.1
@@ -207,48 +541,44 @@ unsigned int next_pow2(unsigned int x)
     return x + 1;
 }
 
-// Ripped from:
-// Author: John Tsiombikas <nuclear@member.fsf.org>
-// LICENSE: This code is in the public domain. Do whatever you like with it.
-// DOC: convert a quaternion to a rotation matrix
-void quat_to_matrix(const float *quat, float *mat)
-{
-    mat[0] = 1.0 - 2.0 * quat[1] * quat[1] - 2.0 * quat[2] * quat[2];
-    mat[4] = 2.0 * quat[0] * quat[1] + 2.0 * quat[3] * quat[2];
-    mat[8] = 2.0 * quat[2] * quat[0] - 2.0 * quat[3] * quat[1];
-    mat[12] = 0.0f;
-
-    mat[1] = 2.0 * quat[0] * quat[1] - 2.0 * quat[3] * quat[2];
-    mat[5] = 1.0 - 2.0 * quat[0]*quat[0] - 2.0 * quat[2]*quat[2];
-    mat[9] = 2.0 * quat[1] * quat[2] + 2.0 * quat[3] * quat[0];
-    mat[13] = 0.0f;
-
-    mat[2] = 2.0 * quat[2] * quat[0] + 2.0 * quat[3] * quat[1];
-    mat[6] = 2.0 * quat[1] * quat[2] - 2.0 * quat[3] * quat[0];
-    mat[10] = 1.0 - 2.0 * quat[0]*quat[0] - 2.0 * quat[1]*quat[1];
-    mat[14] = 0.0f;
-
-    mat[3] = mat[7] = mat[11] = 0.0f;
-    mat[15] = 1.0f;
-}
-
 
 void UpdateVideoTarget(unsigned int width, unsigned int height)
 {
-    glGenTextures(1, video.glTexture);
+    if (!video.glTexture[0]) {
+        glGenTextures(1, video.glTexture);
+        if (!uploader.enabled)
+            video.displayTexture = video.glTexture[0];
+    }
 
     if (!video.glVideo[0] || width != video.width || height != video.height) {
-        delete video.glVideo[0];
+        // the arena hands back the previous frame's block when it still fits
+        arena_free(video.glVideo[0]);
+        arena_free(video.glVideo[1]);
         video.glVideoWidth = next_pow2(width);
         video.glVideoHeight = next_pow2(height);
-        video.glVideo[0] = new Uint8[video.glVideoWidth * video.glVideoHeight * 4];
-        memset(video.glVideo[0], 0, sizeof(video.glVideo[0]));
         video.glVideoPitch = video.glVideoWidth * 4;
+        // -b frames may come as YUV, chroma rows below the luma
+        size_t rows = video.glVideoHeight;
+        if (param.high_depth)
+            rows = max(rows, (size_t)height + (height + 1) / 2);
+        video.glVideo[0] = (Uint8*)arena_alloc(video.glVideoPitch * rows, "video");
+        video.glVideo[1] = uploader.enabled ?
+            (Uint8*)arena_alloc(video.glVideoPitch * rows, "video") : 0;
+        video.stagingLatest = 0;
+        mem_track_gpu("video", "frame texture", video.glVideoPitch * video.glVideoHeight *
+                (uploader.enabled ? UPLOAD_TEXTURES : 1));
         video.width = width;
         video.height = height;
-
-        cerr << "Changed video res to: " << width << "x" << height << endl;
-        cerr << "changed glVideo res to: " << video.glVideoWidth << "x" << video.glVideoHeight << endl;
+        video.active.x = video.active.y = 0;
+        video.active.w = width;
+        video.active.h = height;
+        video.textureAllocated = false;
+        video.textureHashes.valid = false;
+        analyze_reset();
+        metrics_video(width, height);
+
+        log_info("Changed video res to: %ux%u", width, height);
+        log_info("changed glVideo res to: %ux%u", video.glVideoWidth, video.glVideoHeight);
     }
 
     // sdl target
@@ -269,13 +599,23 @@ void UpdateVideoTarget(unsigned int width, unsigned int height)
         amask = 0xff000000;
 #endif
 
+        if (video.sdlSurface) {
+            arena_free(video.sdlSurface->pixels);
+            SDL_FreeSurface(video.sdlSurface);
+        }
+
+        // vlc decodes straight into this, so it comes from the arena as well
+        int pitch = video.width * (video.bpp / 8);
+        void *pixels = arena_alloc(pitch * video.height, "decode");
 #ifdef USE_RV16
-        video.sdlSurface = SDL_CreateRGBSurface(SDL_SWSURFACE, video.width, video.height, 16,
+        video.sdlSurface = SDL_CreateRGBSurfaceFrom(pixels, video.width, video.height, 16, pitch,
                 0xf800, 0x07e0, 0x001f, 0); // 5, 6, 5
 #else
-        video.sdlSurface = SDL_CreateRGBSurface(SDL_SWSURFACE, video.width, video.height, 32, rmask, gmask, bmask, amask);
+        video.sdlSurface = SDL_CreateRGBSurfaceFrom(pixels, video.width, video.height, 32, pitch,
+                rmask, gmask, bmask, amask);
 #endif
-        video.sdlMutex = SDL_CreateMutex();
+        if (!video.sdlMutex)
+            video.sdlMutex = SDL_CreateMutex();
     }
 }
 
@@ -289,7 +629,9 @@ void UpdateRenderTarget(unsigned int width, unsigned int height)
         // if fbo does not exist, then nothing does. create opengl objects
         glGenFramebuffers(1, &fbo);
         glGenTextures(2, fb_tex);
+#if defined (USE_DEPTH_BUFFER)
         glGenRenderbuffers(1, &fb_depth);
+#endif
 
         glBindTexture(GL_TEXTURE_2D, fb_tex[1]);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -315,15 +657,25 @@ void UpdateRenderTarget(unsigned int width, unsigned int height)
             GL_RGBA, GL_UNSIGNED_BYTE, 0);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, fb_tex[0], 0);
 
-    // create and attach the renderbuffer that will serve as our z-buffer
+#if defined (USE_DEPTH_BUFFER)
+    // create and attach the renderbuffer that will serve as our z-buffer.
+    // Nothing depth tests yet, the screen, overlay and strip are drawn in order.
     glBindRenderbuffer(GL_RENDERBUFFER, fb_depth);
     glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, fb_tex_width, fb_tex_height);
     glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, fb_depth);
+#endif
 
     if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
         fprintf(stderr, "Failed to create Complete Framebuffer!\n");
     }
 
+    mem_track_gpu("eye", "fb_tex[0] color", fb_tex_width * fb_tex_height * 4);
+    mem_track_gpu("eye", "fb_tex[1] post", fb_tex_width * fb_tex_height * 4);
+#if defined (USE_DEPTH_BUFFER)
+    mem_track_gpu("eye", "depth", fb_tex_width * fb_tex_height * 4);
+#endif
+    scissor.valid = false;
+
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     printf("created render target: %dx%d (texture size: %dx%d)\n", width, height, fb_tex_width, fb_tex_height);
 
@@ -335,72 +687,121 @@ void UpdateRenderTarget(unsigned int width, unsigned int height)
 }
 
 
-void SetupDisplay (ovrEyeType eye, bool skybox) {
-    // we'll just have to use the projection matrix supplied by the oculus SDK for this eye
-    // note that libovr matrices are the transpose of what OpenGL expects, so we have
-    // to use glLoadTransposeMatrixf instead of glLoadMatrixf to load it.
-    //
-    //double far_clip = currentMode == GUI ? 2000.0f : param.forward_clip_distance + FAR_CLIP_FUDGE_AMOUNT;
-    double far_clip = 2000.0f; // jdt: trying to lessen the difference between GUI and 3D modes.
-    // jdt: increase near_clip to get better depth buffer resolution if we turn that on.
-    ovrMatrix4f proj = ovrMatrix4f_Projection(hmd->DefaultEyeFov[eye], NEAR_CLIP_DIST, far_clip, 1);
-    glMatrixMode(GL_PROJECTION);
-    glLoadTransposeMatrixf(proj.M[0]);
+// Part of the frame that is uploaded and drawn.  Bars are only cut across
+// the stereo split: the halves of an SBS frame each have their own pillarbox.
+SDL_Rect VideoCrop()
+{
+    SDL_Rect crop = video.active;
+    if (param.stereo_mode == STEREO_SBS) {
+        crop.x = 0;
+        crop.w = video.width;
+    } else if (param.stereo_mode == STEREO_OVER_UNDER) {
+        crop.y = 0;
+        crop.h = video.height;
+    }
+    return crop;
+}
 
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
+// Where VideoCrop() lies inside video.displayTexture: uploads put it at the
+// origin of a power of two texture, cached frames on the GPU hold all of it.
+void SetVideoTexRect(GLuint prog)
+{
+    SDL_Rect crop = VideoCrop();
+    float x = 0, y = 0, w = video.glVideoWidth, h = video.glVideoHeight;
+    if (loop.gpu_frame) {
+        x = crop.x;
+        y = video.height - crop.y - crop.h; // bottom row first
+        w = video.width;
+        h = video.height;
+    }
+    glUniform4f(glGetUniformLocation(prog, "tex_rect"), x / w, y / h, crop.w / w, crop.h / h);
+}
 
-    if (!param.view_locked)
-    {
-        // retrieve the orientation quaternion and convert it to a rotation matrix 
-        float rot_mat[16];
-        quat_to_matrix(&eyePose[eye].Orientation.x, rot_mat);
+// Build both eyes' projection and view matrices once per frame.  The
+// fixed-function path loads them in SetupDisplay(), the core profile path
+// uploads the combined view-projection in a single uniform buffer update.
+void ComputeEyeMatrices()
+{
+    //double far_clip = currentMode == GUI ? 2000.0f : param.forward_clip_distance + FAR_CLIP_FUDGE_AMOUNT;
+    double far_clip = 2000.0f; // jdt: trying to lessen the difference between GUI and 3D modes.
+    float ipd = param.ipd_multiplier;
+
+    mat4_identity(&frame_mats.model);
+    mat4_translate(&frame_mats.model, 0, 0, param.tv_zoffset);
+    mat4_scale(&frame_mats.model, video.aspect_ratio, 1, 1);
+
+    // shrink the screen to the active picture, which stays where it was in
+    // the full frame
+    SDL_Rect crop = VideoCrop();
+    float sx = video.width ? (float)crop.w / video.width : 1;
+    float sy = video.height ? (float)crop.h / video.height : 1;
+    float cx = video.width ? (crop.x + crop.w / 2.0f) / video.width - 0.5f : 0;
+    float cy = video.height ? 0.5f - (crop.y + crop.h / 2.0f) / video.height : 0;
+    mat4_identity(&frame_mats.crop);
+    mat4_translate(&frame_mats.crop, cx * param.tv_size, cy * param.tv_size, 0);
+    mat4_scale(&frame_mats.crop, sx, sy, 1);
+    mat4_mul(&frame_mats.model, &frame_mats.crop, &frame_mats.picture);
+    frame_mats.mesh_crop[0] = cx * param.tv_size;
+    frame_mats.mesh_crop[1] = cy * param.tv_size;
+    frame_mats.mesh_crop[2] = sx;
+    frame_mats.mesh_crop[3] = sy;
+
+    for (int eye = 0; eye < 2; eye++) {
+        // jdt: increase near_clip to get better depth buffer resolution if we turn that on.
+        ovrMatrix4f proj = ovrMatrix4f_Projection(hmd->DefaultEyeFov[eye], NEAR_CLIP_DIST, far_clip, 1);
+        mat4_from_rows(proj.M, &frame_mats.proj[eye]);
+
+        mat4 *view = &frame_mats.view[eye];
+        mat4_identity(view);
+        if (!param.view_locked) {
+            mat4 rot;
+            mat4_view_rotation(&eyePose[eye].Orientation.x, &rot);
+
+            mat4_translate(view, eye_rdesc[eye].HmdToEyeViewOffset.x * ipd,
+                    eye_rdesc[eye].HmdToEyeViewOffset.y * ipd,
+                    eye_rdesc[eye].HmdToEyeViewOffset.z * ipd);
+            mat4_mul(view, &rot, view);
+            // translate the view matrix with the positional tracking
+            mat4_translate(view, -eyePose[eye].Position.x * ipd,
+                    -eyePose[eye].Position.y * ipd,
+                    -eyePose[eye].Position.z * ipd);
+        }
 
-        // jdt: trick to render skybox without stereo.. up close to avoid fog.
-        /*
-           if (skybox) {
-           glMultMatrixf(rot_mat);
-
-           CControl *ctrl = Players.GetCtrl (g_game.player_id);
-           if (ctrl && !State::manager.isGuiState()) {
-           TMatrix view_mat;
-           TransposeMatrix (ctrl->env_view_mat, view_mat);
-           view_mat[0][3] = 0;  // remove translation
-           view_mat[1][3] = 0;
-           view_mat[2][3] = 0;
-           view_mat[3][0] = 0;
-           view_mat[3][1] = 0;
-           view_mat[3][2] = 0;
-           glMultMatrixd ((double*)view_mat);
-           }
-
-           Env.DrawSkybox (TVector3(0,0,0), true);
-           glLoadIdentity();
-           }
-         */
+        mat4_mul(&frame_mats.proj[eye], view, &frame_mats.view_proj[eye]);
+    }
 
-        glTranslatef(eye_rdesc[eye].HmdToEyeViewOffset.x * param.ipd_multiplier,
-                eye_rdesc[eye].HmdToEyeViewOffset.y * param.ipd_multiplier,
-                eye_rdesc[eye].HmdToEyeViewOffset.z * param.ipd_multiplier);
+    if (param.core_profile) {
+        glBindBuffer(GL_UNIFORM_BUFFER, eye_ubo);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof frame_mats.view_proj, frame_mats.view_proj);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+}
 
-        glMultMatrixf(rot_mat);
+// Fixed-function path: load this eye's matrices with the screen placement.
+void SetupDisplay (ovrEyeType eye, bool skybox) {
+    glMatrixMode(GL_PROJECTION);
+    glLoadMatrixf(frame_mats.proj[eye].m);
 
-        // translate the view matrix with the positional tracking
-        glTranslatef(-eyePose[eye].Position.x * param.ipd_multiplier,
-                -eyePose[eye].Position.y * param.ipd_multiplier,
-                -eyePose[eye].Position.z * param.ipd_multiplier);
-        // move the camera to the eye level of the user
-        //glTranslate(0, -ovrHmd_GetFloat(hmd, OVR_KEY_EYE_HEIGHT, 1.65), 0);
-    }
+    mat4 modelview;
+    mat4_mul(&frame_mats.view[eye], &frame_mats.model, &modelview);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadMatrixf(modelview.m);
 
     glColor4f (1.0, 1.0, 1.0, 1.0);
 }
 
 void ClearDisplay () {
-    glDepthMask (GL_TRUE);
+    GLbitfield mask = GL_COLOR_BUFFER_BIT;
     glClearColor (0, 0, 0, 0);
+#if defined (USE_DEPTH_BUFFER)
+    glDepthMask (GL_TRUE);
+    mask |= GL_DEPTH_BUFFER_BIT;
+#endif
+#if defined (USE_STENCIL_BUFFER)
     glClearStencil (0);
-    glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+    mask |= GL_STENCIL_BUFFER_BIT;
+#endif
+    glClear (mask);
 }
 
 
@@ -488,7 +889,7 @@ int load_shader(GLenum type, const GLchar** shader_text)
     shader=glCreateShader(type);
 
     GLsizei length = strlen(*shader_text);
-    cout << "Compiling shader with " << length << " chars." << endl;
+    log_debug("Compiling shader with %d chars.", (int)length);
     glShaderSource(shader, 1, shader_text, NULL);
 
     glCompileShader(shader);
@@ -505,14 +906,24 @@ int load_shader(GLenum type, const GLchar** shader_text)
     return shader;
 }
 
-void init_shader_program(GLuint* program, const GLchar** vertshader, const GLchar** fragshader)
+void link_shader_program(GLuint* program, GLuint vertshader, GLuint fragshader)
 {
     GLint linked;
 
     *program=glCreateProgram();
 
-    if (vertshader) glAttachShader(*program, load_shader(GL_VERTEX_SHADER, vertshader));
-    if (fragshader) glAttachShader(*program, load_shader(GL_FRAGMENT_SHADER, fragshader));
+    if (vertshader) glAttachShader(*program, vertshader);
+    if (fragshader) glAttachShader(*program, fragshader);
+
+    // fixed locations so the core profile VAOs work with every program
+    glBindAttribLocation(*program, ATTRIB_POSITION, "a_position");
+    glBindAttribLocation(*program, ATTRIB_TEXCOORD, "a_texcoord");
+    glBindAttribLocation(*program, ATTRIB_COLOR, "a_color");
+    glBindAttribLocation(*program, ATTRIB_LENS, "a_lens");
+    glBindAttribLocation(*program, ATTRIB_TAN_R, "a_tan_r");
+    glBindAttribLocation(*program, ATTRIB_TAN_G, "a_tan_g");
+    glBindAttribLocation(*program, ATTRIB_TAN_B, "a_tan_b");
+    glBindAttribLocation(*program, ATTRIB_POSITION, "v_coord");
 
     glLinkProgram(*program);
 
@@ -523,28 +934,672 @@ void init_shader_program(GLuint* program, const GLchar** vertshader, const GLcha
     }
 }
 
+void init_shader_program(GLuint* program, const GLchar** vertshader, const GLchar** fragshader)
+{
+    link_shader_program(program,
+            vertshader ? load_shader(GL_VERTEX_SHADER, vertshader) : 0,
+            fragshader ? load_shader(GL_FRAGMENT_SHADER, fragshader) : 0);
+}
+
+void bind_eye_matrices(GLuint program)
+{
+    GLuint block = glGetUniformBlockIndex(program, "EyeMatrices");
+    if (block != GL_INVALID_INDEX)
+        glUniformBlockBinding(program, block, EYE_MATRICES_BINDING);
+}
+
+// Compile every permutation of the screen and post processing shaders for
+// the context's profile up front so switching modes at runtime only swaps
+// programs.  PROFILE is the first axis of each shader, so the variants of
+// one profile are a contiguous half of each table.
+void init_shader_permutations()
+{
+    const int profile = param.core_profile ? 1 : 0;
+    const int nvert = screen_vertShaderPermutationCount / 2;
+    const int nfrag = screen_fragShaderPermutationCount / 2;
+    GLuint screen_vert[nvert];
+    GLuint screen_frag[nfrag];
+    GLuint fxaa_vert = load_shader(GL_VERTEX_SHADER, fxaa_vertShaderPermutations[profile]);
+
+    for (int i = 0; i < nvert; i++)
+        screen_vert[i] = load_shader(GL_VERTEX_SHADER, screen_vertShaderPermutations[profile * nvert + i]);
+    for (int i = 0; i < nfrag; i++)
+        screen_frag[i] = load_shader(GL_FRAGMENT_SHADER, screen_fragShaderPermutations[profile * nfrag + i]);
+
+    for (int d = 0; d < MAX_DISTORTION; d++) {
+        for (int s = 0; s < MAX_STEREO_MODE; s++) {
+            for (int c = 0; c < MAX_COLORSPACE; c++) {
+                link_shader_program(&screen_prog[d][s][c],
+                        screen_vert[d * MAX_STEREO_MODE + s], screen_frag[c]);
+                if (param.core_profile)
+                    bind_eye_matrices(screen_prog[d][s][c]);
+            }
+        }
+    }
+
+    // the sky reuses its one vertex shader, the matrix is a plain uniform
+    const int nsky = sky_fragShaderPermutationCount / 2;
+    GLuint sky_vert = load_shader(GL_VERTEX_SHADER, sky_vertShaderPermutations[profile]);
+    for (int i = 0; i < nsky; i++) {
+        link_shader_program(&sky_prog[0][0][0] + i, sky_vert,
+                load_shader(GL_FRAGMENT_SHADER, sky_fragShaderPermutations[profile * nsky + i]));
+    }
+
+    for (int aa = 0; aa < 2; aa++) {
+        link_shader_program(&fxaa_prog[aa], fxaa_vert,
+                load_shader(GL_FRAGMENT_SHADER, fxaa_fragShaderPermutations[profile * 2 + aa]));
+    }
+
+    // -b conversion draws the same full screen quad
+    for (int t = 0; t < MAX_TRANSFER; t++) {
+        link_shader_program(&yuv_prog[t], fxaa_vert,
+                load_shader(GL_FRAGMENT_SHADER, yuv_fragShaderPermutations[profile * MAX_TRANSFER + t]));
+    }
+
+    init_shader_program(&layer_prog, layer_vertShaderPermutations[profile],
+            layer_fragShaderPermutations[profile]);
+    if (param.core_profile)
+        bind_eye_matrices(layer_prog);
+}
+
+GLuint create_quad_vao(GLuint *vbo, float lo, float hi)
+{
+    // x, y, s, t as a triangle fan
+    GLfloat verts[] = {
+        lo, lo, 0, 0,
+        hi, lo, 1, 0,
+        hi, hi, 1, 1,
+        lo, hi, 0, 1,
+    };
+    GLuint vao;
+
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, vbo);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, *vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof verts, verts, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(ATTRIB_POSITION);
+    glVertexAttribPointer(ATTRIB_POSITION, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), 0);
+    glEnableVertexAttribArray(ATTRIB_TEXCOORD);
+    glVertexAttribPointer(ATTRIB_TEXCOORD, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat),
+            (void*)(2 * sizeof(GLfloat)));
+    glBindVertexArray(0);
+
+    return vao;
+}
+
+// 36 vertices of the cube -1..1, two triangles per face.
+static void sky_cube(GLfloat v[36][3])
+{
+    static const GLfloat corners[6][2] = {
+        { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, -1 }, { 1, 1 }, { -1, 1 },
+    };
+    for (int face = 0; face < 6; face++) {
+        int axis = face / 2;
+        for (int i = 0; i < 6; i++) {
+            GLfloat *p = v[face * 6 + i];
+            p[axis] = face & 1 ? 1 : -1;
+            p[(axis + 1) % 3] = corners[i][0];
+            p[(axis + 2) % 3] = corners[i][1];
+        }
+    }
+}
+
+void InitCoreProfile()
+{
+    glGenBuffers(1, &eye_ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, eye_ubo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof frame_mats.view_proj, 0, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, EYE_MATRICES_BINDING, eye_ubo);
+
+    quad_vao = create_quad_vao(&quad_vbo, 0, 1);
+    post_vao = create_quad_vao(&post_vbo, -1, 1);
+
+    GLfloat cube[36][3];
+    sky_cube(cube);
+    glGenVertexArrays(1, &sky_vao);
+    glGenBuffers(1, &sky_vbo);
+    glBindVertexArray(sky_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, sky_vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof cube, cube, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(ATTRIB_POSITION);
+    glVertexAttribPointer(ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), 0);
+    glBindVertexArray(0);
+}
+
+void InitOverlay()
+{
+    const int profile = param.core_profile ? 1 : 0;
+    int width, height;
+
+    overlay.enabled = overlay_init_font(param.font_path, OVERLAY_FONT_PIXELS);
+    if (!overlay.enabled) {
+        cout << "No overlay font, status stays on the console only." << endl;
+        return;
+    }
+
+    const uint8_t *pixels = overlay_atlas(&width, &height);
+    glGenTextures(1, &overlay.atlas);
+    glBindTexture(GL_TEXTURE_2D, overlay.atlas);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, param.core_profile ? GL_R8 : GL_LUMINANCE8, width, height, 0,
+            param.core_profile ? GL_RED : GL_LUMINANCE, GL_UNSIGNED_BYTE, pixels);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    mem_track_gpu("overlay", "glyph atlas", width * height);
+    overlay_free_atlas();
+
+    init_shader_program(&overlay.prog, text_vertShaderPermutations[profile],
+            text_fragShaderPermutations[profile]);
+
+    if (param.core_profile) {
+        bind_eye_matrices(overlay.prog);
+
+        glGenVertexArrays(1, &overlay.vao);
+        glGenBuffers(1, &overlay.vbo);
+        glBindVertexArray(overlay.vao);
+        glBindBuffer(GL_ARRAY_BUFFER, overlay.vbo);
+        glEnableVertexAttribArray(ATTRIB_POSITION);
+        glVertexAttribPointer(ATTRIB_POSITION, 2, GL_FLOAT, GL_FALSE, sizeof(overlay_vertex),
+                (void*)offsetof(overlay_vertex, x));
+        glEnableVertexAttribArray(ATTRIB_TEXCOORD);
+        glVertexAttribPointer(ATTRIB_TEXCOORD, 2, GL_FLOAT, GL_FALSE, sizeof(overlay_vertex),
+                (void*)offsetof(overlay_vertex, s));
+        glEnableVertexAttribArray(ATTRIB_COLOR);
+        glVertexAttribPointer(ATTRIB_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(overlay_vertex),
+                (void*)offsetof(overlay_vertex, color));
+        glBindVertexArray(0);
+    }
+}
+
 // Load a texture
+// Upload the active picture of a staging buffer to the bound texture's
+// origin, with -H only the tiles that differ from what the texture holds.
+// glVideo is bottom row first.
+void UploadVideo(const Uint8 *pixels, GLuint pitch, SDL_Rect crop, int skip_rows,
+        const dirty_hashes *frame, dirty_hashes *contents)
+{
+    SDL_Rect area = { crop.x, skip_rows, crop.w, crop.h };
+    std::vector<SDL_Rect> rects;
+    if (param.dirty_tiles) {
+        int total;
+        int changed = dirty_changes(contents, frame, area, &rects, &total);
+        dirty_commit(contents, frame, area);
+        dirty_record(changed, total);
+        metrics_tiles(changed, total);
+    } else {
+        rects.push_back(area);
+    }
+
+    size_t bytes = 0;
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, pitch / 4);
+    for (size_t i = 0; i < rects.size(); i++) {
+        const SDL_Rect &r = rects[i];
+        glPixelStorei(GL_UNPACK_SKIP_PIXELS, r.x);
+        glPixelStorei(GL_UNPACK_SKIP_ROWS, r.y);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, r.x - area.x, r.y - area.y, r.w, r.h,
+                GL_BGRA, GL_UNSIGNED_BYTE, pixels);
+        bytes += r.w * r.h * 4;
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+    glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+    metrics_upload(bytes);
+}
+
+// Upload a -b staging buffer of a width x height picture and convert its
+// crop into target's origin, where UploadVideo() would have put it.
+void ConvertVideo(const Uint8 *pixels, GLuint pitch, SDL_Rect crop, int width, int height,
+        yuv_layout_t layout, GLuint target)
+{
+    GLuint samples = 2 * ((width + 1) / 2), rows = height + (height + 1) / 2;
+
+    if (!yuv_pass.fbo) {
+        glGenFramebuffers(1, &yuv_pass.fbo);
+        glGenTextures(1, &yuv_pass.texture);
+        if (param.core_profile)
+            yuv_pass.vao = create_quad_vao(&yuv_pass.vbo, -1, 1);
+    }
+    glBindTexture(GL_TEXTURE_2D, yuv_pass.texture);
+    if (yuv_pass.width != samples || yuv_pass.height != rows) {
+        // point sampled, the shader filters chroma itself
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R16, samples, rows, 0, GL_RED, GL_UNSIGNED_SHORT, 0);
+        yuv_pass.width = samples;
+        yuv_pass.height = rows;
+        mem_track_gpu("video", "yuv frame", (size_t)samples * rows * 2);
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, pitch / 2);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, samples, rows, GL_RED, GL_UNSIGNED_SHORT, pixels);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    metrics_upload((size_t)samples * rows * 2);
+
+    GLuint prog = yuv_prog[param.transfer];
+    glBindFramebuffer(GL_FRAMEBUFFER, yuv_pass.fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target, 0);
+    glViewport(0, 0, crop.w, crop.h);
+    glUseProgram(prog);
+    glUniform1i(glGetUniformLocation(prog, "u_texture0"), 0);
+    glUniform2f(glGetUniformLocation(prog, "texture_size"), samples, rows);
+    glUniform2f(glGetUniformLocation(prog, "luma_size"), width, height);
+    glUniform4f(glGetUniformLocation(prog, "crop_rect"), crop.x, crop.y, crop.w, crop.h);
+    glUniform1f(glGetUniformLocation(prog, "sample_scale"),
+            layout == YUV_P010 ? 65535.0f / (1023 << 6) : 65535.0f / 1023);
+    if (param.core_profile) {
+        glBindVertexArray(yuv_pass.vao);
+        glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+        glBindVertexArray(0);
+    } else {
+        glBegin(GL_QUADS);
+        glVertex2f(-1, -1);
+        glVertex2f(1, -1);
+        glVertex2f(1, 1);
+        glVertex2f(-1, 1);
+        glEnd();
+    }
+    glUseProgram(0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, target);
+}
+
 void LoadVideoTexture() {
     SDL_LockMutex(video.sdlMutex);
 
     glBindTexture(GL_TEXTURE_2D, video.glTexture[0]);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, video.glVideoWidth, video.glVideoHeight, 0,
-            GL_BGRA, GL_UNSIGNED_BYTE, video.glVideo[0]);
+    if (!video.textureAllocated) {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        // -b: rendered into, with the 10 bits kept
+        glTexImage2D(GL_TEXTURE_2D, 0, video.yuv ? GL_RGB10_A2 : GL_RGB,
+                video.glVideoWidth, video.glVideoHeight, 0, GL_BGRA, GL_UNSIGNED_BYTE, 0);
+        video.textureAllocated = true;
+    }
+
+    // only the active picture
+    SDL_Rect crop = VideoCrop();
+    if (video.yuv) {
+        ConvertVideo(video.glVideo[video.stagingLatest], video.glVideoPitch, crop,
+                video.width, video.height, video.yuv, video.glTexture[0]);
+    } else {
+        UploadVideo(video.glVideo[video.stagingLatest], video.glVideoPitch, crop,
+                video.height - crop.y - crop.h, &video.stagingHashes[video.stagingLatest],
+                &video.textureHashes);
+    }
     video.updateFrame = false;
+    video.reupload = false;
+    metrics_queue_depth(0);
+    if (GatedDecoding())
+        SDL_CondBroadcast(offline.cond);
+
+    SDL_UnlockMutex(video.sdlMutex);
+}
+
+// Background upload
+
+// Wake the upload thread for video.updateFrame, with video.sdlMutex held.
+void SignalUpload()
+{
+    if (uploader.enabled)
+        SDL_CondSignal(uploader.cond);
+}
+
+// Upload the staged frame again after the crop or the transfer changed.
+// Offline the next decoded frame picks the change up instead, a repeat would
+// be rendered and captured as a frame of its own.
+void ReuploadFrame()
+{
+    if (offline.enabled)
+        return;
+    SDL_LockMutex(video.sdlMutex);
+    video.reupload = true;
+    SignalUpload();
+    SDL_UnlockMutex(video.sdlMutex);
+}
+
+// Render thread, right after the render context was made current.  It stays
+// current, the upload thread binds the new one to the same window.
+void CreateUploadContext()
+{
+    if (!GLEW_ARB_sync) {
+        cerr << "Background upload needs fences, uploading on the render thread." << endl;
+        uploader.enabled = false;
+        return;
+    }
+    SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+    uploader.context = SDL_GL_CreateContext(sdlWindow);
+    SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 0);
+    SDL_GL_MakeCurrent(sdlWindow, glContext);
+    if (!uploader.context) {
+        cerr << "No shared upload context, uploading on the render thread: " << SDL_GetError() << endl;
+        uploader.enabled = false;
+    }
+}
+
+int UploadThread(void *)
+{
+    SDL_GL_MakeCurrent(sdlWindow, uploader.context);
+
+    for (;;) {
+        SDL_LockMutex(video.sdlMutex);
+        while (!video.updateFrame && !video.reupload && !uploader.stop)
+            SDL_CondWaitTimeout(uploader.cond, video.sdlMutex, UPLOAD_WAIT_MS);
+        if (uploader.stop) {
+            SDL_UnlockMutex(video.sdlMutex);
+            break;
+        }
+        // unlock() writes the next frame into the other buffer meanwhile
+        int staging = video.stagingLatest;
+        video.stagingRead = staging;
+        video.updateFrame = false;
+        video.reupload = false;
+        metrics_queue_depth(0);
+        SDL_Rect crop = VideoCrop();
+        GLuint width = video.glVideoWidth, height = video.glVideoHeight;
+        GLuint pitch = video.glVideoPitch;
+        int skip_rows = video.height - crop.y - crop.h;
+        int picture_width = video.width, picture_height = video.height;
+        yuv_layout_t yuv = video.yuv;
+        GLenum format = yuv ? GL_RGB10_A2 : GL_RGB;
+        const dirty_hashes *frame = &video.stagingHashes[staging];
+        SDL_UnlockMutex(video.sdlMutex);
+
+        // at most one texture is shown and one published, this isn't
+        // waiting for anything
+        SDL_LockMutex(uploader.mutex);
+        int newest = -1;
+        for (int i = 0; i < UPLOAD_TEXTURES; i++) {
+            if (uploader.state[i] == UPLOAD_READY ||
+                    (uploader.state[i] == UPLOAD_SHOWN && newest < 0))
+                newest = i;
+        }
+        SDL_Rect area = { crop.x, skip_rows, crop.w, crop.h };
+        int total;
+        if (param.dirty_tiles && newest >= 0 &&
+                dirty_changes(&uploader.contents[newest], frame, area, 0, &total) == 0) {
+            // the same picture as the newest texture, nothing to publish
+            SDL_UnlockMutex(uploader.mutex);
+            dirty_record(0, total);
+            metrics_tiles(0, total);
+            SDL_LockMutex(video.sdlMutex);
+            video.stagingRead = -1;
+            SDL_UnlockMutex(video.sdlMutex);
+            continue;
+        }
+        int slot = 0;
+        while (uploader.state[slot] != UPLOAD_FREE)
+            slot++;
+        GLsync released = uploader.fence[slot];
+        uploader.fence[slot] = 0;
+        SDL_UnlockMutex(uploader.mutex);
+
+        if (released) {
+            // the renderer's last draws from this texture go first
+            glWaitSync(released, 0, GL_TIMEOUT_IGNORED);
+            glDeleteSync(released);
+        }
+
+        glBindTexture(GL_TEXTURE_2D, uploader.texture[slot]);
+        if (uploader.allocated_width[slot] != width || uploader.allocated_height[slot] != height ||
+                uploader.allocated_format[slot] != format) {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, GL_BGRA, GL_UNSIGNED_BYTE, 0);
+            uploader.allocated_width[slot] = width;
+            uploader.allocated_height[slot] = height;
+            uploader.allocated_format[slot] = format;
+            uploader.contents[slot].valid = false;
+        }
+        if (yuv) {
+            ConvertVideo(video.glVideo[staging], pitch, crop, picture_width, picture_height, yuv,
+                    uploader.texture[slot]);
+        } else {
+            UploadVideo(video.glVideo[staging], pitch, crop, skip_rows, frame, &uploader.contents[slot]);
+        }
+        GLsync done = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush(); // the fence can't signal for the render context before it is submitted
+
+        // the pixels were copied by the driver when glTexSubImage2D returned
+        SDL_LockMutex(video.sdlMutex);
+        video.stagingRead = -1;
+        SDL_UnlockMutex(video.sdlMutex);
+
+        SDL_LockMutex(uploader.mutex);
+        for (int i = 0; i < UPLOAD_TEXTURES; i++) {
+            if (uploader.state[i] == UPLOAD_READY) {
+                // never shown, the renderer didn't come by in time
+                glDeleteSync(uploader.fence[i]);
+                uploader.fence[i] = 0;
+                uploader.state[i] = UPLOAD_FREE;
+                metrics_dropped();
+            }
+        }
+        uploader.state[slot] = UPLOAD_READY;
+        uploader.fence[slot] = done;
+        SDL_UnlockMutex(uploader.mutex);
+    }
+
+    SDL_GL_MakeCurrent(sdlWindow, 0);
+    return 0;
+}
+
+void StartUploader()
+{
+    glGenTextures(UPLOAD_TEXTURES, uploader.texture);
+    for (int i = 0; i < UPLOAD_TEXTURES; i++) {
+        uploader.state[i] = UPLOAD_FREE;
+        uploader.fence[i] = 0;
+        uploader.allocated_width[i] = uploader.allocated_height[i] = 0;
+        uploader.allocated_format[i] = 0;
+    }
+    uploader.stop = false;
+    uploader.cond = SDL_CreateCond();
+    uploader.mutex = SDL_CreateMutex();
+    uploader.thread = SDL_CreateThread(UploadThread, "upload", 0);
+}
 
+void StopUploader()
+{
+    if (!uploader.thread)
+        return;
+    SDL_LockMutex(video.sdlMutex);
+    uploader.stop = true;
+    SDL_CondSignal(uploader.cond);
     SDL_UnlockMutex(video.sdlMutex);
+    SDL_WaitThread(uploader.thread, 0);
+    uploader.thread = 0;
+    SDL_GL_DeleteContext(uploader.context);
+}
+
+// Render thread: show the newest published texture once its upload has
+// finished on the GPU, without waiting for it.  False when the previous one
+// stays.
+bool AcquireUploadedTexture()
+{
+    bool changed = false;
+
+    SDL_LockMutex(uploader.mutex);
+    for (int i = 0; i < UPLOAD_TEXTURES; i++) {
+        if (uploader.state[i] != UPLOAD_READY)
+            continue;
+        if (glClientWaitSync(uploader.fence[i], 0, 0) == GL_TIMEOUT_EXPIRED)
+            break;
+        glDeleteSync(uploader.fence[i]);
+        uploader.fence[i] = 0;
+
+        for (int j = 0; j < UPLOAD_TEXTURES; j++) {
+            if (uploader.state[j] == UPLOAD_SHOWN) {
+                // everything drawn from it so far has been issued
+                uploader.fence[j] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                glFlush();
+                uploader.state[j] = UPLOAD_FREE;
+            }
+        }
+        uploader.state[i] = UPLOAD_SHOWN;
+        video.displayTexture = uploader.texture[i];
+        changed = true;
+        break;
+    }
+    SDL_UnlockMutex(uploader.mutex);
+
+    return changed;
+}
+
+// Staging buffer for the next frame, with video.sdlMutex held: not the one
+// the upload thread is reading from, nor the last complete frame while it
+// might still start reading that.
+int NextStaging()
+{
+    if (!uploader.enabled)
+        return 0;
+    return 1 - (video.stagingRead >= 0 ? video.stagingRead : video.stagingLatest);
+}
+
+// The frame cache keeps staging buffers as they are, a YUV frame as rows of
+// BGRA sized pixels.
+void ResetFrameCache()
+{
+    if (video.yuv)
+        framecache_reset((video.width + 1) / 2, video.height + (video.height + 1) / 2);
+    else
+        framecache_reset(video.width, video.height);
 }
 
 // VLC Callback Functions
+
+// VLC's 9 to 16 bit planar YUV, I0AL and the like
+static bool deep_planar_chroma(const char *chroma)
+{
+    return chroma[0] == 'I' && strchr("024", chroma[1]) && strchr("9ACF", chroma[2]) &&
+        strchr("LB", chroma[3]);
+}
+
+static unsigned int align32(unsigned int bytes)
+{
+    return (bytes + 31) & ~31u;
+}
+
+// -b: 10 bit 4:2:0 is kept as decoded, deeper or less subsampled sources are
+// brought to it, anything else still comes as RV32.
+unsigned format_setup(void **opaque, char *chroma, unsigned *width, unsigned *height,
+        unsigned *pitches, unsigned *lines)
+{
+    char decoded[5] = { 0 };
+    memcpy(decoded, chroma, 4);
+
+    SDL_LockMutex(video.sdlMutex);
+    for (int i = 0; i < 3; i++) {
+        arena_free(video.yuvPlanes[i]);
+        video.yuvPlanes[i] = 0;
+        video.yuvPitch[i] = 0;
+    }
+    *width = video.width;
+    *height = video.height;
+    unsigned int wc = (video.width + 1) / 2, hc = (video.height + 1) / 2;
+    if (!strcmp(decoded, "P010") || !strcmp(decoded, "P016")) {
+        video.yuv = YUV_P010;
+        memcpy(chroma, "P010", 4);
+        video.yuvPitch[0] = align32(video.width * 2);
+        video.yuvPitch[1] = align32(wc * 4);
+    } else if (deep_planar_chroma(decoded)) {
+        video.yuv = YUV_I0AL;
+        memcpy(chroma, "I0AL", 4);
+        video.yuvPitch[0] = align32(video.width * 2);
+        video.yuvPitch[1] = video.yuvPitch[2] = align32(wc * 2);
+    } else {
+        video.yuv = YUV_NONE;
+        memcpy(chroma, "RV32", 4);
+        pitches[0] = video.width * 4;
+        lines[0] = video.height;
+    }
+    if (video.yuv) {
+        for (int i = 0; i < 3 && video.yuvPitch[i]; i++) {
+            pitches[i] = video.yuvPitch[i];
+            lines[i] = i ? hc : video.height;
+            video.yuvPlanes[i] = (Uint8*)arena_alloc(pitches[i] * lines[i], "decode");
+        }
+        // the conversion expands the range already
+        param.colorspace = COLORSPACE_RGB;
+    }
+    video.textureAllocated = false;
+    SDL_UnlockMutex(video.sdlMutex);
+
+    if (video.yuv)
+        log_info("Decoding %s as %.4s, %s converted on the GPU", decoded, chroma,
+                transfer_names[param.transfer]);
+    else
+        log_info("Decoding %s as %.4s", decoded, chroma);
+    if (loop.filling)
+        ResetFrameCache();
+    return 1;
+}
+
+void format_cleanup(void *opaque)
+{
+    SDL_LockMutex(video.sdlMutex);
+    for (int i = 0; i < 3; i++) {
+        arena_free(video.yuvPlanes[i]);
+        video.yuvPlanes[i] = 0;
+    }
+    SDL_UnlockMutex(video.sdlMutex);
+}
+
 void* lock(void *data, void **p_pixels) 
 {
+    if (video.yuv) {
+        for (int i = 0; i < 3; i++)
+            p_pixels[i] = video.yuvPlanes[i];
+        return NULL;
+    }
     SDL_LockSurface(video.sdlSurface);
     *p_pixels = video.sdlSurface->pixels;
     return NULL;
 }
 
+static void interleave_chroma(Uint16 *dst, const Uint16 *u, const Uint16 *v, unsigned int n)
+{
+    unsigned int i = 0;
+#ifdef __SSE2__
+    for (; i + 8 <= n; i += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(u + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(v + i));
+        _mm_storeu_si128((__m128i*)(dst + 2 * i), _mm_unpacklo_epi16(a, b));
+        _mm_storeu_si128((__m128i*)(dst + 2 * i + 8), _mm_unpackhi_epi16(a, b));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[2 * i] = u[i];
+        dst[2 * i + 1] = v[i];
+    }
+}
+
+// -b: the decoded planes into a staging buffer, see yuv_layout_t.
+static void CopyYuvFrame(Uint8 *dst)
+{
+    unsigned int wc = (video.width + 1) / 2, hc = (video.height + 1) / 2;
+    for (unsigned int y = 0; y < video.height; y++) {
+        memcpy(dst + y * video.glVideoPitch, video.yuvPlanes[0] + y * video.yuvPitch[0],
+                video.width * 2);
+    }
+    dst += video.height * video.glVideoPitch;
+    for (unsigned int y = 0; y < hc; y++) {
+        Uint8 *row = dst + y * video.glVideoPitch;
+        if (video.yuv == YUV_P010) {
+            memcpy(row, video.yuvPlanes[1] + y * video.yuvPitch[1], wc * 4);
+        } else {
+            interleave_chroma((Uint16*)row, (const Uint16*)(video.yuvPlanes[1] + y * video.yuvPitch[1]),
+                    (const Uint16*)(video.yuvPlanes[2] + y * video.yuvPitch[2]), wc);
+        }
+    }
+}
+
 void unlock(void *data, void *id, void *const *p_pixels)
 {
     Uint8 * pixelSource;
@@ -557,50 +1612,1076 @@ void unlock(void *data, void *id, void *const *p_pixels)
 
     SDL_LockMutex(video.sdlMutex);
 
+    // offline and replay: don't overwrite a frame that hasn't been rendered yet
+    while (GatedDecoding() && video.updateFrame && !quit)
+        SDL_CondWaitTimeout(offline.cond, video.sdlMutex, 100);
+
     Uint8 pixelDepth = video.sdlSurface->format->BytesPerPixel;
 
-    // TODO: openmp
-    for (unsigned int i = video.height; i > 0; i--) {
-        pixelDestination = video.glVideo[0] + (video.height-i) * video.glVideoPitch;
-        pixelSource = (Uint8*)video.sdlSurface->pixels + (i-1) * video.sdlSurface->pitch;
+    int staging = NextStaging();
+
+    if (video.yuv) {
+        CopyYuvFrame(video.glVideo[staging]);
+    } else {
+        dirty_hashes *hashes = &video.stagingHashes[staging];
+        if (param.dirty_tiles)
+            dirty_begin(hashes, video.width, video.height);
+
+        // TODO: openmp
+        for (unsigned int i = video.height; i > 0; i--) {
+            pixelDestination = video.glVideo[staging] + (video.height-i) * video.glVideoPitch;
+            pixelSource = (Uint8*)video.sdlSurface->pixels + (i-1) * video.sdlSurface->pitch;
 #ifdef MEMCPY_PIXEL_LINES
-        // requires same pixelDepth for both sdlsurface and opengl
-        memcpy(pixelDestination, pixelSource, video.sdlSurface->pitch);
-        pixelDestination += video.glVideoPitch;
+            // requires same pixelDepth for both sdlsurface and opengl
+            if (param.dirty_tiles)
+                dirty_copy_row(pixelDestination, pixelSource, video.width, video.height - i, hashes);
+            else
+                memcpy(pixelDestination, pixelSource, video.sdlSurface->pitch);
+            pixelDestination += video.glVideoPitch;
 #else
-        for (unsigned int j = 0; j < video.width; j++) {
-            pixelSource += j*pixelDepth;
+            for (unsigned int j = 0; j < video.width; j++) {
+                pixelSource += j*pixelDepth;
 #ifdef USE_RV16
-            pix = *(Uint16 *) pixelSource;
+                pix = *(Uint16 *) pixelSource;
 #else
-            pix = *(Uint32 *) pixelSource;
+                pix = *(Uint32 *) pixelSource;
 #endif
-            SDL_GetRGBA(pix, video.sdlSurface->format,
-                    &(pixelDestination[0]),
-                    &(pixelDestination[1]),
-                    &(pixelDestination[2]),
-                    &(pixelDestination[3]));
-            pixelDestination += 4;
-        }
+                SDL_GetRGBA(pix, video.sdlSurface->format,
+                        &(pixelDestination[0]),
+                        &(pixelDestination[1]),
+                        &(pixelDestination[2]),
+                        &(pixelDestination[3]));
+                pixelDestination += 4;
+            }
+            if (param.dirty_tiles) {
+                Uint8 *row = video.glVideo[staging] + (video.height-i) * video.glVideoPitch;
+                dirty_copy_row(row, row, video.width, video.height - i, hashes);
+            }
 #endif
-    }
+        }
+
+        if (param.analyze && video.bpp == 32 && analyze_wanted()) {
+            analyze_submit((Uint8*)video.sdlSurface->pixels, video.width, video.height,
+                    video.sdlSurface->pitch);
+        }
 
-    SDL_UnlockSurface(video.sdlSurface);
+        SDL_UnlockSurface(video.sdlSurface);
+    }
+    video.stagingLatest = staging;
+    if (GatedDecoding()) {
+        video.updateFrame = true;
+        SDL_CondBroadcast(offline.cond);
+    }
     SDL_UnlockMutex(video.sdlMutex);
+
+    // only this thread writes the buffer, the uploader may read it meanwhile
+    if (loop.filling && !framecache_add(video.glVideo[staging], video.glVideoPitch))
+        loop.filling = false;
 }
 
 void display(void *data, void *id) 
 {
-    video.updateFrame = true;
+    // offline and replayed frames are handed over in unlock(), flagging them
+    // again here would render one twice
+    if (!GatedDecoding()) {
+        SDL_LockMutex(video.sdlMutex);
+        if (video.updateFrame)
+            metrics_dropped();
+        video.updateFrame = true;
+        metrics_queue_depth(1);
+        SignalUpload();
+        SDL_UnlockMutex(video.sdlMutex);
+    }
 }
 
-void ToggleHmdFullscreen()
+// Image sequences: a frame from imageseq's playback thread, through the
+// same path as one VLC decoded.
+void DeliverSequenceFrame(const uint8_t *pixels, int pitch)
 {
-    static int fullscr, prev_x, prev_y;
+    void *planes[3];
+    lock(0, planes);
+    Uint8 *dst = (Uint8*)planes[0];
+    for (unsigned int y = 0; y < video.height; y++)
+        memcpy(dst + y * video.sdlSurface->pitch, pixels + y * pitch, video.width * 4);
+    unlock(0, 0, planes);
+    display(0, 0);
+}
 
-    // Using F9 in direct-to-rift mode causes hard-to-debug performance issues.
-    if(hmd->HmdCaps & ovrHmdCap_ExtendDesktop == 0) {
-        printf("Not switching to fullscreen in Direct-to-rift mode\n");
+// Offline: wait for the next frame from unlock(), false on timeout.
+bool WaitOfflineFrame()
+{
+    SDL_LockMutex(video.sdlMutex);
+    if (!video.updateFrame)
+        SDL_CondWaitTimeout(offline.cond, video.sdlMutex, 100);
+    bool ready = video.updateFrame;
+    SDL_UnlockMutex(video.sdlMutex);
+    return ready;
+}
+
+// Replay: upload the frames positioned at or before the media position
+// recorded for this frame, false when there was nothing new.  The next frame
+// stays with the decoder while it belongs to a later one.
+bool ReplayFrames()
+{
+    trace_frame fr;
+    if (!trace_get_frame(frame_index, &fr))
+        return false; // the trace ended, SampleEyePoses() quits
+    bool uploaded = false;
+    SDL_LockMutex(video.sdlMutex);
+    while (replay.base + replay.shown * 1000.0 / replay.fps <= fr.media_time && !quit) {
+        if (!video.updateFrame)
+            SDL_CondWaitTimeout(offline.cond, video.sdlMutex, REPLAY_WAIT_MS);
+        if (!video.updateFrame)
+            break; // paused, at the end or decoding slower
+        SDL_UnlockMutex(video.sdlMutex);
+        LoadVideoTexture();
+        SDL_LockMutex(video.sdlMutex);
+        replay.shown++;
+        uploaded = true;
+    }
+    // a new crop or transfer, when the staged frame is the one shown
+    bool reupload = video.reupload && !video.updateFrame;
+    SDL_UnlockMutex(video.sdlMutex);
+    if (reupload) {
+        LoadVideoTexture();
+        uploaded = true;
+    }
+    return uploaded;
+}
+
+// Looping
+
+// Hand a cached frame to the upload path like a decoded one, or point the
+// renderer straight at its texture.
+void ShowCachedFrame(int index)
+{
+    loop.shown = index;
+    GLuint texture = framecache_texture(index);
+    if (texture) {
+        loop.gpu_frame = true;
+        video.displayTexture = texture;
+        return;
+    }
+
+    SDL_LockMutex(video.sdlMutex);
+    int staging = NextStaging();
+    if (framecache_read(index, video.glVideo[staging], video.glVideoPitch)) {
+        if (param.dirty_tiles) {
+            dirty_hashes *hashes = &video.stagingHashes[staging];
+            dirty_begin(hashes, video.width, video.height);
+            for (unsigned int y = 0; y < video.height; y++) {
+                Uint8 *row = video.glVideo[staging] + y * video.glVideoPitch;
+                dirty_copy_row(row, row, video.width, y, hashes);
+            }
+        }
+        video.stagingLatest = staging;
+        video.updateFrame = true;
+        SignalUpload();
+    }
+    SDL_UnlockMutex(video.sdlMutex);
+}
+
+// Back to uploaded frames after showing a cached texture.
+void LeaveCachedTexture()
+{
+    if (!loop.gpu_frame)
+        return;
+    loop.gpu_frame = false;
+    video.displayTexture = video.glTexture[0];
+    if (uploader.enabled) {
+        SDL_LockMutex(uploader.mutex);
+        for (int i = 0; i < UPLOAD_TEXTURES; i++) {
+            if (uploader.state[i] == UPLOAD_SHOWN)
+                video.displayTexture = uploader.texture[i];
+        }
+        SDL_UnlockMutex(uploader.mutex);
+    }
+}
+
+void RestartPlayer()
+{
+    libvlc_media_player_stop(vlc_media_player);
+    libvlc_media_player_play(vlc_media_player);
+    if (loop.cached && loop.paused)
+        libvlc_media_player_set_pause(vlc_media_player, 1);
+}
+
+// ms into the current pass of cache playback
+double LoopPosition()
+{
+    return loop.paused ? loop.position : SDL_GetTicks() - loop.start;
+}
+
+void LoopSeek(libvlc_time_t ms)
+{
+    ms %= (libvlc_time_t)loop.period;
+    loop.position = ms;
+    loop.start = SDL_GetTicks() - ms;
+    libvlc_media_player_set_time(vlc_media_player, ms);
+}
+
+// Render thread, every frame: restart the clip when it ended, switch to the
+// cache after a complete pass and pick the cached frame due.
+void UpdateLoop()
+{
+    framecache_update();
+
+    if (loop.cached) {
+        double ms = LoopPosition();
+        if (ms >= loop.period) {
+            // next pass, the audio starts over with it
+            int passes = (int)(ms / loop.period);
+            loop.start += (Uint32)(passes * loop.period);
+            ms -= passes * loop.period;
+            RestartPlayer();
+        }
+        int index = min(loop.frames - 1, (int)(ms * loop.frames / loop.period));
+        if (index != loop.shown)
+            ShowCachedFrame(index);
+        return;
+    }
+
+    if (libvlc_media_player_get_state(vlc_media_player) != libvlc_Ended)
+        return;
+
+    int frames = framecache_count();
+    if (loop.filling && frames > 0) {
+        loop.cached = true;
+        loop.filling = false;
+        loop.frames = frames;
+        libvlc_time_t length = libvlc_media_get_duration(vlc_media);
+        float fps = libvlc_media_player_get_fps(vlc_media_player);
+        loop.period = length > 0 ? length : frames * 1000.0 / (fps > 0 ? fps : OFFLINE_DEFAULT_FPS);
+        libvlc_media_add_option(vlc_media, ":no-video");
+        log_info("loop: %d frames, %.1fs cached, no more decoding", frames, loop.period / 1000);
+        framecache_log();
+    } else {
+        // decode another pass, into the cache if it fits
+        ResetFrameCache();
+        loop.filling = !framecache_overflowed();
+    }
+    loop.start = SDL_GetTicks();
+    loop.step = -1;
+    LeaveCachedTexture();
+    RestartPlayer();
+}
+
+void TogglePause()
+{
+    if (sequence.enabled) {
+        imageseq_set_pause(!imageseq_paused());
+        return;
+    }
+    if (loop.cached) {
+        if (loop.paused)
+            loop.start = SDL_GetTicks() - (Uint32)loop.position;
+        else
+            loop.position = SDL_GetTicks() - loop.start;
+        loop.paused = !loop.paused;
+        libvlc_media_player_set_pause(vlc_media_player, loop.paused);
+        return;
+    }
+    libvlc_media_player_pause(vlc_media_player);
+    // resuming after stepping back continues where VLC is
+    loop.step = -1;
+    LeaveCachedTexture();
+}
+
+// Step one frame while paused: through the cache where it has the frame,
+// VLC decodes the next one otherwise.
+void StepFrame(int delta)
+{
+    if (sequence.enabled) {
+        imageseq_step(delta);
+        return;
+    }
+    if (loop.cached) {
+        if (!loop.paused)
+            TogglePause();
+        int index = (loop.shown + delta + loop.frames) % loop.frames;
+        loop.position = (index + 0.5) * loop.period / loop.frames;
+        libvlc_media_player_set_time(vlc_media_player, (libvlc_time_t)loop.position);
+        return;
+    }
+
+    if (libvlc_media_player_is_playing(vlc_media_player))
+        libvlc_media_player_set_pause(vlc_media_player, 1);
+    // the newest cached frame is the one VLC decoded last
+    int count = loop.filling ? framecache_count() : 0;
+    int index = (loop.step >= 0 ? loop.step : count - 1) + delta;
+    if (delta > 0 && (loop.step < 0 || index >= count)) {
+        loop.step = -1;
+        LeaveCachedTexture();
+        libvlc_media_player_next_frame(vlc_media_player);
+    } else if (index >= 0 && index < count) {
+        loop.step = index;
+        ShowCachedFrame(index);
+    }
+}
+
+// Adaptive streams
+
+// Video lines the flat screen can show, seen head on at its size and
+// distance, 0 without an estimate.
+float ScreenVideoLines()
+{
+    if (param.projection != PROJECTION_SCREEN || -param.tv_zoffset < NEAR_CLIP_DIST)
+        return 0;
+    const ovrFovPort &fov = hmd->DefaultEyeFov[0];
+    float lines = param.tv_size / -param.tv_zoffset * fb_height / (fov.UpTan + fov.DownTan);
+    // each eye gets half of an over/under frame
+    return param.stereo_mode == STEREO_OVER_UNDER ? 2 * lines : lines;
+}
+
+// With the player stopped: staging buffers and VLC's output for a new size.
+void ResizeVideo(unsigned int width, unsigned int height)
+{
+    SDL_LockMutex(video.sdlMutex);
+    while (video.stagingRead >= 0) {
+        SDL_UnlockMutex(video.sdlMutex);
+        SDL_Delay(1);
+        SDL_LockMutex(video.sdlMutex);
+    }
+    video.updateFrame = false;
+    video.reupload = false;
+    UpdateVideoTarget(width, height);
+    SDL_UnlockMutex(video.sdlMutex);
+    // -b reads the size in format_setup()
+    if (!param.high_depth)
+        libvlc_video_set_format(vlc_media_player, "RV32", width, height, width * 4);
+}
+
+void ReopenCapped()
+{
+    int cap = abr_cap();
+    libvlc_time_t ms = libvlc_media_player_get_time(vlc_media_player);
+    char option[64];
+    // later options override earlier ones, 0 lifts the cap
+    snprintf(option, sizeof option, ":adaptive-maxheight=%d", cap);
+    libvlc_media_add_option(vlc_media, option);
+    libvlc_media_player_stop(vlc_media_player);
+
+    unsigned int height = cap ? cap : max((unsigned int)ABR_LADDER_TOP, rendition.height);
+    unsigned int width = (rendition.width * height / rendition.height + 1) & ~1u;
+    ResizeVideo(width, height);
+    libvlc_media_player_play(vlc_media_player);
+    if (ms > 0)
+        libvlc_media_player_set_time(vlc_media_player, ms);
+    abr_restarted(SDL_GetTicks());
+
+    if (cap)
+        log_info("adaptive: renditions up to %dp, output %ux%u", cap, width, height);
+    else
+        log_info("adaptive: renditions uncapped, output %ux%u", width, height);
+}
+
+// Render thread, every frame.
+void UpdateRendition()
+{
+    if (!rendition.enabled)
+        return;
+    abr_sample(ScreenVideoLines());
+
+    // VLC's late pictures and ours replaced before upload
+    libvlc_media_stats_t stats;
+    unsigned long long frames = 0, dropped = metrics_dropped_count();
+    if (libvlc_media_get_stats(vlc_media, &stats)) {
+        frames = stats.i_displayed_pictures + stats.i_lost_pictures;
+        dropped += stats.i_lost_pictures;
+    }
+    if (abr_update(SDL_GetTicks(), frames, dropped, video.height))
+        ReopenCapped();
+}
+
+// Seeking
+//
+// Key repeat on the arrow keys used to fire one libvlc_media_player_set_time()
+// per event, each relative to a time sampled once per PollEvent() and each one
+// flushing the decoder.  Seek requests are now accumulated into a single
+// target which is only handed to VLC once the keys have been quiet for
+// SEEK_DEBOUNCE_MS.  While a seek is pending a strip of thumbnails around the
+// target is drawn below the screen, fed by a second low resolution player.
+
+#define SEEK_DEBOUNCE_MS 250
+#define SEEK_PREVIEW_LINGER_MS 750 // keep the strip up briefly after commit
+
+#define THUMB_W 128
+#define THUMB_H 72
+#define THUMB_ATLAS_COLS 8
+#define THUMB_ATLAS_ROWS 8
+#define THUMB_SLOTS (THUMB_ATLAS_COLS * THUMB_ATLAS_ROWS)
+#define THUMB_BUCKET_MS 5000 // thumbnail granularity, matches the smallest seek step
+#define THUMB_STRIP_COUNT 5  // thumbnails shown around the seek target (odd)
+#define THUMB_CAPTURE_TIMEOUT_MS 1500
+
+struct _seek {
+    bool pending;
+    libvlc_time_t target;
+    libvlc_time_t step; // magnitude of the last seek step, spaces the strip
+    Uint32 last_input;
+    Uint32 committed;
+    bool replayed;      // replay: the trace committed the seek before this frame
+} seek;
+
+struct _thumb {
+    bool enabled;
+    libvlc_media_player_t *player;
+    libvlc_media_t *media;
+    SDL_mutex *mutex;
+    Uint8 *pixels;      // decode target written by the preview player
+    Uint8 *ready;       // last captured frame waiting for upload
+    bool armed;         // next displayed frame near request_bucket is captured
+    bool captured;
+    int request_bucket; // -1 when idle
+    Uint32 request_ticks;
+    GLuint atlas;
+    GLuint atlas_width;
+    GLuint atlas_height;
+    int slot_bucket[THUMB_SLOTS];
+    Uint32 slot_used[THUMB_SLOTS];
+} thumb;
+
+void* thumb_lock(void *data, void **p_pixels)
+{
+    *p_pixels = thumb.pixels;
+    return NULL;
+}
+
+void thumb_unlock(void *data, void *id, void *const *p_pixels)
+{
+}
+
+void thumb_display(void *data, void *id)
+{
+    SDL_LockMutex(thumb.mutex);
+    if (thumb.armed) {
+        // frames decoded before the seek landed are still in flight, only
+        // accept one that belongs to the requested bucket.
+        libvlc_time_t t = libvlc_media_player_get_time(thumb.player);
+        if (t / THUMB_BUCKET_MS == thumb.request_bucket) {
+            memcpy(thumb.ready, thumb.pixels, THUMB_W * THUMB_H * 4);
+            thumb.armed = false;
+            thumb.captured = true;
+        }
+    }
+    SDL_UnlockMutex(thumb.mutex);
+}
+
+void InitThumbnails(const char *path)
+{
+    if (!thumb.enabled)
+        return;
+
+    thumb.mutex = SDL_CreateMutex();
+    thumb.pixels = (Uint8*)arena_alloc(THUMB_W * THUMB_H * 4, "thumbnail");
+    thumb.ready = (Uint8*)arena_alloc(THUMB_W * THUMB_H * 4, "thumbnail");
+    thumb.armed = thumb.captured = false;
+    thumb.request_bucket = -1;
+    for (int i = 0; i < THUMB_SLOTS; i++) {
+        thumb.slot_bucket[i] = -1;
+        thumb.slot_used[i] = 0;
+    }
+
+    thumb.atlas_width = next_pow2(THUMB_W * THUMB_ATLAS_COLS);
+    thumb.atlas_height = next_pow2(THUMB_H * THUMB_ATLAS_ROWS);
+    glGenTextures(1, &thumb.atlas);
+    glBindTexture(GL_TEXTURE_2D, thumb.atlas);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, thumb.atlas_width, thumb.atlas_height, 0,
+            GL_BGRA, GL_UNSIGNED_BYTE, 0);
+    mem_track_gpu("thumbnail", "atlas", thumb.atlas_width * thumb.atlas_height * 4);
+
+    // a second, silent player on the same file. VLC scales its output down to
+    // the thumbnail size so seeking it stays cheap even on 8K sources.
+    thumb.media = libvlc_media_new_path(vlc, path);
+    libvlc_media_add_option(thumb.media, ":no-audio");
+    libvlc_media_add_option(thumb.media, ":no-spu");
+    thumb.player = libvlc_media_player_new_from_media(thumb.media);
+    libvlc_video_set_format(thumb.player, "RV32", THUMB_W, THUMB_H, THUMB_W * 4);
+    libvlc_video_set_callbacks(thumb.player, thumb_lock, thumb_unlock, thumb_display, NULL);
+}
+
+int FindThumbnail(int bucket)
+{
+    for (int i = 0; i < THUMB_SLOTS; i++) {
+        if (thumb.slot_bucket[i] == bucket)
+            return i;
+    }
+    return -1;
+}
+
+// Runs on the render thread: uploads a finished capture into the atlas and
+// asks the preview player for the next missing thumbnail around the target.
+void UpdateThumbnails()
+{
+    if (!thumb.enabled)
+        return;
+
+    Uint32 now = SDL_GetTicks();
+
+    SDL_LockMutex(thumb.mutex);
+    if (thumb.captured) {
+        // evict the least recently drawn slot
+        int slot = 0;
+        for (int i = 1; i < THUMB_SLOTS; i++) {
+            if (thumb.slot_used[i] < thumb.slot_used[slot])
+                slot = i;
+        }
+        thumb.slot_bucket[slot] = thumb.request_bucket;
+        thumb.slot_used[slot] = now;
+
+        glBindTexture(GL_TEXTURE_2D, thumb.atlas);
+        glTexSubImage2D(GL_TEXTURE_2D, 0,
+                (slot % THUMB_ATLAS_COLS) * THUMB_W, (slot / THUMB_ATLAS_COLS) * THUMB_H,
+                THUMB_W, THUMB_H, GL_BGRA, GL_UNSIGNED_BYTE, thumb.ready);
+
+        thumb.captured = false;
+        thumb.request_bucket = -1;
+    } else if (thumb.armed && now - thumb.request_ticks > THUMB_CAPTURE_TIMEOUT_MS) {
+        thumb.armed = false; // give up, it will be asked for again
+        thumb.request_bucket = -1;
+    }
+    bool idle = thumb.request_bucket < 0;
+    SDL_UnlockMutex(thumb.mutex);
+
+    if (!idle)
+        return;
+
+    if (!seek.pending) {
+        libvlc_media_player_set_pause(thumb.player, 1);
+        return;
+    }
+
+    // nearest missing thumbnail first
+    int center = seek.target / THUMB_BUCKET_MS;
+    int spacing = max(1, (int)(seek.step / THUMB_BUCKET_MS));
+    for (int n = 0; n < THUMB_STRIP_COUNT; n++) {
+        int bucket = center + ((n + 1) / 2) * spacing * (n % 2 ? 1 : -1);
+        if (bucket < 0 || FindThumbnail(bucket) >= 0)
+            continue;
+
+        SDL_LockMutex(thumb.mutex);
+        thumb.request_bucket = bucket;
+        thumb.request_ticks = now;
+        thumb.armed = true;
+        SDL_UnlockMutex(thumb.mutex);
+
+        if (libvlc_media_player_get_state(thumb.player) < libvlc_Playing)
+            libvlc_media_player_play(thumb.player);
+        else
+            libvlc_media_player_set_pause(thumb.player, 0);
+        libvlc_media_player_set_time(thumb.player, (libvlc_time_t)bucket * THUMB_BUCKET_MS);
+        break;
+    }
+}
+
+// Accumulate a relative seek.  The base is the pending target when one
+// exists so repeated keys add up instead of restarting from a stale time.
+void RequestSeek(libvlc_time_t delta)
+{
+    // cached frames show at once and the rest are decoded in parallel, a
+    // sequence seeks on every key
+    if (sequence.enabled) {
+        long long target = max(0LL, min(imageseq_time() + delta, imageseq_length() - 1));
+        imageseq_seek(target);
+        seek.committed = SDL_GetTicks();
+        return;
+    }
+    if (!seek.pending)
+        seek.target = loop.cached ? (libvlc_time_t)LoopPosition() :
+            libvlc_media_player_get_time(vlc_media_player);
+
+    seek.target += delta;
+    if (seek.target < 0)
+        seek.target = 0;
+    libvlc_time_t length = libvlc_media_player_get_length(vlc_media_player);
+    if (length > 0 && seek.target > length)
+        seek.target = length;
+
+    seek.step = delta < 0 ? -delta : delta;
+    seek.pending = true;
+    seek.last_input = SDL_GetTicks();
+}
+
+void UpdateSeek()
+{
+    // a replay commits on the frame the recording did, not after the ticks
+    bool due = trace_is_replaying() ? seek.replayed :
+        SDL_GetTicks() - seek.last_input >= SEEK_DEBOUNCE_MS;
+    seek.replayed = false;
+    if (seek.pending && due) {
+        if (loop.cached) {
+            LoopSeek(seek.target);
+        } else {
+            libvlc_media_player_set_time(vlc_media_player, seek.target);
+            // the cache holds passes from the start only
+            if (loop.filling) {
+                loop.filling = false;
+                ResetFrameCache();
+            }
+        }
+        seek.pending = false;
+        seek.committed = SDL_GetTicks();
+        if (trace_is_recording()) {
+            trace_event ev;
+            memset(&ev, 0, sizeof ev);
+            ev.frame = frame_index;
+            ev.ticks = seek.committed;
+            ev.type = TRACE_SEEK_COMMIT;
+            trace_write_event(&ev);
+        }
+        if (replay.enabled) {
+            // frames count from the target, one decoded before it is dropped
+            SDL_LockMutex(video.sdlMutex);
+            replay.base = seek.target;
+            replay.shown = 0;
+            video.updateFrame = false;
+            SDL_CondBroadcast(offline.cond);
+            SDL_UnlockMutex(video.sdlMutex);
+        }
+    }
+    UpdateThumbnails();
+}
+
+bool SeekPreviewVisible()
+{
+    return thumb.enabled && (seek.pending ||
+            SDL_GetTicks() - seek.committed < SEEK_PREVIEW_LINGER_MS);
+}
+
+// Draw the thumbnail strip below a screen of size d.  The fixed-function
+// path expects the modelview to already hold the screen's placement, the core
+// profile path draws with the flat screen program and frame_mats.model.
+void DrawSeekPreview(ovrEyeType eye, float d, float texLeft, float texRight, float texUp, float texDown)
+{
+    int center = seek.target / THUMB_BUCKET_MS;
+    int spacing = max(1, (int)(seek.step / THUMB_BUCKET_MS));
+    float cell = d / THUMB_STRIP_COUNT;
+    float size = cell * 0.9f;
+    float top = -d/2 - cell * 0.1f;
+    Uint32 now = SDL_GetTicks();
+
+    // sub-rectangle of a thumbnail that corresponds to this eye's half
+    float tw = (float)THUMB_W / thumb.atlas_width;
+    float th = (float)THUMB_H / thumb.atlas_height;
+    float fl = texLeft / ((float)video.width / video.glVideoWidth);
+    float fr = texRight / ((float)video.width / video.glVideoWidth);
+    float fd = texDown / ((float)video.height / video.glVideoHeight);
+    float fu = texUp / ((float)video.height / video.glVideoHeight);
+
+    GLuint prog = screen_prog[DISTORTION_NONE][STEREO_NONE][COLORSPACE_RGB];
+    if (param.core_profile) {
+        glUseProgram(prog);
+        glUniform1i(glGetUniformLocation(prog, "fbo_texture"), 0);
+        glUniform1f(glGetUniformLocation(prog, "eye"), eye == ovrEye_Left ? 0 : 1);
+        glBindVertexArray(quad_vao);
+    } else {
+        glUseProgram(0); // flat strip, not bent by the screen distortion
+    }
+
+    glBindTexture(GL_TEXTURE_2D, thumb.atlas);
+    for (int n = 0; n < THUMB_STRIP_COUNT; n++) {
+        int offset = n - THUMB_STRIP_COUNT / 2;
+        int slot = FindThumbnail(center + offset * spacing);
+        if (slot < 0)
+            continue;
+        thumb.slot_used[slot] = now;
+
+        float x0 = -d/2 + n * cell + (cell - size) / 2;
+        float y0 = top - size;
+        float u0 = (slot % THUMB_ATLAS_COLS) * tw;
+        float v0 = (slot / THUMB_ATLAS_COLS) * th;
+        // thumbnails are stored top-down like the decoded frame
+        float l = u0 + fl * tw, r = u0 + fr * tw;
+        float b = v0 + (1 - fd) * th, t = v0 + (1 - fu) * th;
+
+        if (param.core_profile) {
+            mat4 model = frame_mats.model;
+            mat4_translate(&model, x0, y0, 0);
+            mat4_scale(&model, size, size, 1);
+            glUniformMatrix4fv(glGetUniformLocation(prog, "model"), 1, GL_FALSE, model.m);
+            glUniform4f(glGetUniformLocation(prog, "tex_rect"), l, b, r - l, t - b);
+            glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+            continue;
+        }
+
+        float shade = offset == 0 ? 1.0f : 0.6f;
+        glColor3f(shade, shade, shade);
+        glBegin(GL_QUADS);
+        glTexCoord2f(l, b); glVertex2f(x0, y0);
+        glTexCoord2f(r, b); glVertex2f(x0 + size, y0);
+        glTexCoord2f(r, t); glVertex2f(x0 + size, top);
+        glTexCoord2f(l, t); glVertex2f(x0, top);
+        glEnd();
+    }
+
+    if (param.core_profile)
+        glBindVertexArray(0);
+    else
+        glColor3f(1, 1, 1);
+}
+
+void SetStatus(const char *text)
+{
+    snprintf(overlay.status, sizeof overlay.status, "%s", text);
+    overlay.status_time = SDL_GetTicks();
+}
+
+static void format_time(libvlc_time_t ms, char *buf, size_t size)
+{
+    int sec = ms < 0 ? 0 : ms / 1000;
+    snprintf(buf, size, "%d:%02d:%02d", sec / 3600, sec / 60 % 60, sec % 60);
+}
+
+// Lay out this frame's text into one vertex batch, shared by both eyes.
+void UpdateOverlay()
+{
+    overlay.count = 0;
+    if (!overlay.enabled)
+        return;
+
+    // keep the angular layout of the screen, but not further than
+    // OVERLAY_MAX_DEPTH and never behind the screen.  A screen moved up to
+    // or behind the viewer counts as at the near plane.
+    float screen_depth = max((float)NEAR_CLIP_DIST, -param.tv_zoffset);
+    float depth = max((float)NEAR_CLIP_DIST, min(OVERLAY_MAX_DEPTH, screen_depth * 0.9f));
+    float k = depth / screen_depth;
+    float half = param.tv_size / 2 * k;
+    float line = OVERLAY_LINE_HEIGHT * depth;
+
+    mat4_identity(&overlay.model);
+    mat4_translate(&overlay.model, 0, 0, -depth);
+
+    overlay_begin();
+
+    char text[sizeof overlay.status + 64];
+    text[0] = 0;
+    if (SeekPreviewVisible()) {
+        char target[32], length[32];
+        format_time(seek.target, target, sizeof target);
+        format_time(libvlc_media_player_get_length(vlc_media_player), length, sizeof length);
+        snprintf(text, sizeof text, "seek %s / %s", target, length);
+    } else if (SDL_GetTicks() - overlay.status_time < OVERLAY_STATUS_MS && overlay.status[0]) {
+        snprintf(text, sizeof text, "%s", overlay.status);
+    }
+    if (text[0])
+        overlay_text(0, half * 0.9f, line, text, true, 0xffffffff);
+
+    const char *subtitle = subtitles_at(libvlc_media_player_get_time(vlc_media_player));
+    if (subtitle)
+        overlay_text(0, -half * 0.6f, line * 1.5f, subtitle, true, 0xffffffff);
+
+    const overlay_vertex *verts = overlay_vertices(&overlay.count);
+    for (int i = 0; i < overlay.count; i++) {
+        if (i == 0 || verts[i].x < overlay.bounds[0]) overlay.bounds[0] = verts[i].x;
+        if (i == 0 || verts[i].y < overlay.bounds[1]) overlay.bounds[1] = verts[i].y;
+        if (i == 0 || verts[i].x > overlay.bounds[2]) overlay.bounds[2] = verts[i].x;
+        if (i == 0 || verts[i].y > overlay.bounds[3]) overlay.bounds[3] = verts[i].y;
+    }
+    if (param.core_profile && overlay.count) {
+        glBindBuffer(GL_ARRAY_BUFFER, overlay.vbo);
+        glBufferData(GL_ARRAY_BUFFER, overlay.count * sizeof *verts, verts, GL_STREAM_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+}
+
+void DrawOverlay(ovrEyeType eye)
+{
+    if (!overlay.count)
+        return;
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glUseProgram(overlay.prog);
+    glBindTexture(GL_TEXTURE_2D, overlay.atlas);
+    glUniform1i(glGetUniformLocation(overlay.prog, "glyph_atlas"), 0);
+    glUniform1f(glGetUniformLocation(overlay.prog, "eye"), eye == ovrEye_Left ? 0 : 1);
+
+    if (param.core_profile) {
+        glUniformMatrix4fv(glGetUniformLocation(overlay.prog, "model"), 1, GL_FALSE, overlay.model.m);
+        glBindVertexArray(overlay.vao);
+        glDrawArrays(GL_TRIANGLES, 0, overlay.count);
+        glBindVertexArray(0);
+    } else {
+        mat4 modelview;
+        mat4_mul(&frame_mats.view[eye], &overlay.model, &modelview);
+        glMatrixMode(GL_MODELVIEW);
+        glLoadMatrixf(modelview.m);
+
+        int count;
+        const overlay_vertex *verts = overlay_vertices(&count);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glVertexPointer(2, GL_FLOAT, sizeof *verts, &verts->x);
+        glTexCoordPointer(2, GL_FLOAT, sizeof *verts, &verts->s);
+        glColorPointer(4, GL_UNSIGNED_BYTE, sizeof *verts, verts->color);
+        glDrawArrays(GL_TRIANGLES, 0, count);
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glColor4f(1, 1, 1, 1);
+    }
+
+    glDisable(GL_BLEND);
+}
+
+bool InitPano()
+{
+    if (!pano_init_cache()) {
+        cerr << "Failed to create the panorama tile atlas." << endl;
+        return false;
+    }
+    if (param.core_profile) {
+        glGenVertexArrays(1, &panorama.vao);
+        glGenBuffers(1, &panorama.vbo);
+        glBindVertexArray(panorama.vao);
+        glBindBuffer(GL_ARRAY_BUFFER, panorama.vbo);
+        glEnableVertexAttribArray(ATTRIB_POSITION);
+        glVertexAttribPointer(ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, sizeof(pano_vertex),
+                (void*)offsetof(pano_vertex, x));
+        glEnableVertexAttribArray(ATTRIB_TEXCOORD);
+        glVertexAttribPointer(ATTRIB_TEXCOORD, 2, GL_FLOAT, GL_FALSE, sizeof(pano_vertex),
+                (void*)offsetof(pano_vertex, s));
+        glBindVertexArray(0);
+    }
+    return true;
+}
+
+// Pick the tiles around the view direction and upload the missing ones,
+// after the poses are latched.  Both eyes look about the same way, the left
+// one decides.
+void UpdatePano()
+{
+    // forward is -z of the view rotation, the transposed third column
+    const mat4 &view = frame_mats.view[0];
+    float forward[3] = { -view.m[2], -view.m[6], -view.m[10] };
+
+    float tan_x = 0, tan_y = 0, span = 0;
+    for (int eye = 0; eye < 2; eye++) {
+        const ovrFovPort &fov = hmd->DefaultEyeFov[eye];
+        tan_x = max(tan_x, max(fov.LeftTan, fov.RightTan));
+        tan_y = max(tan_y, max(fov.UpTan, fov.DownTan));
+        span = max(span, fov.LeftTan + fov.RightTan);
+    }
+    float cone = atanf(sqrtf(tan_x * tan_x + tan_y * tan_y));
+    float pixels_per_radian = (fb_width / 2) / span;
+
+    panorama.verts = pano_update(forward, cone, pixels_per_radian, &panorama.count);
+    if (param.core_profile && panorama.count) {
+        glBindBuffer(GL_ARRAY_BUFFER, panorama.vbo);
+        glBufferData(GL_ARRAY_BUFFER, panorama.count * sizeof(pano_vertex), panorama.verts,
+                GL_STREAM_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+}
+
+void DrawPano(ovrEyeType eye)
+{
+    GLuint prog = screen_prog[DISTORTION_NONE][STEREO_NONE][COLORSPACE_RGB];
+    glUseProgram(prog);
+    glBindTexture(GL_TEXTURE_2D, pano_atlas());
+    glUniform1i(glGetUniformLocation(prog, "fbo_texture"), 0);
+    glUniform1f(glGetUniformLocation(prog, "eye"), eye == ovrEye_Left ? 0 : 1);
+    glUniform4f(glGetUniformLocation(prog, "tex_rect"), 0, 0, 1, 1);
+
+    if (param.core_profile) {
+        mat4 model;
+        mat4_identity(&model);
+        glUniformMatrix4fv(glGetUniformLocation(prog, "model"), 1, GL_FALSE, model.m);
+        glBindVertexArray(panorama.vao);
+        glDrawArrays(GL_TRIANGLES, 0, panorama.count);
+        glBindVertexArray(0);
+    } else if (panorama.count) {
+        // the sphere is around the viewer, not placed like the screen
+        glMatrixMode(GL_MODELVIEW);
+        glLoadMatrixf(frame_mats.view[eye].m);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glVertexPointer(3, GL_FLOAT, sizeof *panorama.verts, &panorama.verts->x);
+        glTexCoordPointer(2, GL_FLOAT, sizeof *panorama.verts, &panorama.verts->s);
+        glDrawArrays(GL_TRIANGLES, 0, panorama.count);
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+    }
+}
+
+// 360 layouts: the faces are looked up per fragment from the 2D video
+// texture, so the upload thread and dirty tiles work unchanged.  Only the
+// head rotation applies, the video is infinitely far away.
+void DrawSky(ovrEyeType eye)
+{
+    GLuint prog = sky_prog[param.projection - 1][param.stereo_mode][param.colorspace];
+    SDL_Rect crop = VideoCrop();
+    // one eye's face in texels: a third of the width, half the height
+    float face_w = crop.w / (param.stereo_mode == STEREO_SBS ? 6.f : 3.f);
+    float face_h = crop.h / (param.stereo_mode == STEREO_OVER_UNDER ? 4.f : 2.f);
+
+    glUseProgram(prog);
+    glBindTexture(GL_TEXTURE_2D, video.displayTexture);
+    glUniform1i(glGetUniformLocation(prog, "fbo_texture"), 0);
+    glUniform1f(glGetUniformLocation(prog, "eye"), eye == ovrEye_Left ? 0 : 1);
+    SetVideoTexRect(prog);
+    glUniform2f(glGetUniformLocation(prog, "face_inset"), 1 / max(face_w, 1.f), 1 / max(face_h, 1.f));
+
+    mat4 rotation = frame_mats.view[eye];
+    rotation.m[12] = rotation.m[13] = rotation.m[14] = 0;
+    if (param.core_profile) {
+        mat4 sky;
+        mat4_mul(&frame_mats.proj[eye], &rotation, &sky);
+        glUniformMatrix4fv(glGetUniformLocation(prog, "sky_matrix"), 1, GL_FALSE, sky.m);
+        glBindVertexArray(sky_vao);
+        glDrawArrays(GL_TRIANGLES, 0, 36);
+        glBindVertexArray(0);
+    } else {
+        GLfloat cube[36][3];
+        sky_cube(cube);
+        glMatrixMode(GL_MODELVIEW);
+        glLoadMatrixf(rotation.m);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glVertexPointer(3, GL_FLOAT, 0, cube);
+        glDrawArrays(GL_TRIANGLES, 0, 36);
+        glDisableClientState(GL_VERTEX_ARRAY);
+    }
+}
+
+// Grow the NDC rectangle b (x0, y0, x1, y1) by the projection of a model
+// space box.  Returns false when a corner is behind the eye, the whole
+// viewport has to be used then.
+bool ExtendBounds(float *b, const mat4 *view_proj, const mat4 *model,
+        const float lo[3], const float hi[3])
+{
+    mat4 mvp;
+    mat4_mul(view_proj, model, &mvp);
+    for (int i = 0; i < 8; i++) {
+        float p[4];
+        mat4_transform(&mvp, i & 1 ? hi[0] : lo[0], i & 2 ? hi[1] : lo[1],
+                i & 4 ? hi[2] : lo[2], p);
+        if (p[3] < NEAR_CLIP_DIST)
+            return false;
+        b[0] = min(b[0], p[0] / p[3]);
+        b[1] = min(b[1], p[1] / p[3]);
+        b[2] = max(b[2], p[0] / p[3]);
+        b[3] = max(b[3], p[1] / p[3]);
+    }
+    return true;
+}
+
+// Project everything this frame draws for both eyes, after the poses are
+// latched.  Meshes bent by the distortion modes only ever move away from
+// the viewer, by up to mesh_radius.
+void UpdateScissor()
+{
+    float d = param.tv_size;
+    float screen_lo[3] = { -d/2, -d/2, param.distortion == DISTORTION_NONE ? 0 : -param.mesh_radius };
+    float screen_hi[3] = { d/2, d/2, 0 };
+    float cell = d / THUMB_STRIP_COUNT;
+    float strip_lo[3] = { -d/2, -d/2 - cell, 0 };
+    float strip_hi[3] = { d/2, -d/2, 0 };
+    float overlay_lo[3] = { overlay.bounds[0], overlay.bounds[1], 0 };
+    float overlay_hi[3] = { overlay.bounds[2], overlay.bounds[3], 0 };
+    int w = fb_width / 2, h = fb_height;
+
+    if (panorama.enabled || param.projection != PROJECTION_SCREEN) {
+        // the sphere or the cube covers everything
+        for (int eye = 0; eye < 2; eye++) {
+            SDL_Rect *r = &scissor.post[eye];
+            r->x = eye == ovrEye_Left ? 0 : w;
+            r->y = 0;
+            r->w = w;
+            r->h = h;
+        }
+        return;
+    }
+
+    for (int eye = 0; eye < 2; eye++) {
+        const mat4 *vp = &frame_mats.view_proj[eye];
+        float b[4] = { 1, 1, -1, -1 };
+        bool ok = ExtendBounds(b, vp, &frame_mats.picture, screen_lo, screen_hi);
+        if (ok && SeekPreviewVisible())
+            ok = ExtendBounds(b, vp, &frame_mats.model, strip_lo, strip_hi);
+        if (ok && overlay.count)
+            ok = ExtendBounds(b, vp, &overlay.model, overlay_lo, overlay_hi);
+        if (!ok) {
+            b[0] = b[1] = -1;
+            b[2] = b[3] = 1;
+        }
+
+        // NDC to this eye's half of the framebuffer
+        int x0 = max(0, (int)floorf((b[0] + 1) / 2 * w) - SCISSOR_MARGIN);
+        int y0 = max(0, (int)floorf((b[1] + 1) / 2 * h) - SCISSOR_MARGIN);
+        int x1 = min(w, (int)ceilf((b[2] + 1) / 2 * w) + SCISSOR_MARGIN);
+        int y1 = min(h, (int)ceilf((b[3] + 1) / 2 * h) + SCISSOR_MARGIN);
+        SDL_Rect *r = &scissor.post[eye];
+        r->x = (eye == ovrEye_Left ? 0 : w) + x0;
+        r->y = y0;
+        r->w = max(0, x1 - x0);
+        r->h = max(0, y1 - y0);
+    }
+}
+
+// The eye buffer is cleared another margin around the post rect, which FXAA
+// samples into.
+SDL_Rect ClearRect(ovrEyeType eye)
+{
+    const SDL_Rect &r = scissor.post[eye];
+    int x0 = eye == ovrEye_Left ? 0 : fb_width / 2;
+    int x1 = x0 + fb_width / 2;
+    int cx0 = max(x0, r.x - SCISSOR_MARGIN);
+    int cy0 = max(0, r.y - SCISSOR_MARGIN);
+    int cx1 = min(x1, r.x + r.w + SCISSOR_MARGIN);
+    int cy1 = min((int)fb_height, r.y + r.h + SCISSOR_MARGIN);
+    SDL_Rect c = { cx0, cy0, cx1 - cx0, cy1 - cy0 };
+    return c;
+}
+
+void ClearEye(ovrEyeType eye)
+{
+    SDL_Rect c = ClearRect(eye);
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(c.x, c.y, c.w, c.h);
+    ClearDisplay();
+    scissor.clear_pixels += c.w * c.h;
+}
+
+// Apply the analysis results: a new crop is uploaded on the next frame, even
+// when paused (offline with the next decoded one), and the stereo mode
+// follows unless the user picked one.
+void UpdateAnalysis()
+{
+    analyze_result r;
+    if (!analyze_poll(&r))
+        return;
+
+    static const char *stereo_names[] = { "unknown", "none", "SBS", "over/under" };
+    log_info("analysis: picture %dx%d+%d+%d of %ux%u, stereo %s", r.width, r.height, r.x, r.y,
+            video.width, video.height, stereo_names[r.stereo]);
+
+    if (param.stereo_auto && r.stereo != ANALYZE_STEREO_UNKNOWN) {
+        switch (r.stereo) {
+        case ANALYZE_STEREO_SBS: param.stereo_mode = STEREO_SBS; break;
+        case ANALYZE_STEREO_OVER_UNDER: param.stereo_mode = STEREO_OVER_UNDER; break;
+        default: param.stereo_mode = STEREO_NONE; break;
+        }
+    }
+
+    SDL_LockMutex(video.sdlMutex);
+    video.active.x = r.x;
+    video.active.y = r.y;
+    video.active.w = r.width;
+    video.active.h = r.height;
+    SDL_UnlockMutex(video.sdlMutex);
+    ReuploadFrame();
+}
+
+void ToggleHmdFullscreen()
+{
+    static int fullscr, prev_x, prev_y;
+
+    // Using F9 in direct-to-rift mode causes hard-to-debug performance issues.
+    if(hmd->HmdCaps & ovrHmdCap_ExtendDesktop == 0) {
+        printf("Not switching to fullscreen in Direct-to-rift mode\n");
         return;
     }
 
@@ -627,7 +2708,10 @@ void ToggleHmdFullscreen()
         printf("\tSwapping window resolution to: %dx%d\n", hmd->Resolution.h, hmd->Resolution.w);
 
         distort_caps |= ovrDistortionCap_LinuxDevFullscreen;
-        ovrHmd_ConfigureRendering(hmd, &glcfg.Config, distort_caps, hmd->DefaultEyeFov, eye_rdesc);
+        if (lens.enabled)
+            printf("\tClient distortion doesn't rotate, rotate the Rift's display instead\n");
+        else
+            ovrHmd_ConfigureRendering(hmd, &glcfg.Config, distort_caps, hmd->DefaultEyeFov, eye_rdesc);
 #endif
     } else {
         // return to windowed mode and move the window back to its original position
@@ -638,7 +2722,8 @@ void ToggleHmdFullscreen()
         glcfg.OGL.Header.BackBufferSize = hmd->Resolution;
 
         distort_caps &= ~ovrDistortionCap_LinuxDevFullscreen;
-        ovrHmd_ConfigureRendering(hmd, &glcfg.Config, distort_caps, hmd->DefaultEyeFov, eye_rdesc);
+        if (!lens.enabled)
+            ovrHmd_ConfigureRendering(hmd, &glcfg.Config, distort_caps, hmd->DefaultEyeFov, eye_rdesc);
 #endif
     }
 }
@@ -674,6 +2759,78 @@ void OvrFindResolution()
     fb_height = eyeres[0].h > eyeres[1].h ? eyeres[0].h : eyeres[1].h;
 }
 
+// Compile the lens programs and upload both eyes' distortion meshes.
+bool InitLens()
+{
+    if (!GLEW_ARB_vertex_array_object && !GLEW_VERSION_3_0) {
+        cerr << "Client distortion needs vertex array objects." << endl;
+        return false;
+    }
+
+    const int profile = param.core_profile ? 1 : 0;
+    const int nvert = lens_vertShaderPermutationCount / 2;
+    const int nfrag = lens_fragShaderPermutationCount / 2;
+    GLuint vert[nvert], frag[nfrag];
+    for (int i = 0; i < nvert; i++)
+        vert[i] = load_shader(GL_VERTEX_SHADER, lens_vertShaderPermutations[profile * nvert + i]);
+    for (int i = 0; i < nfrag; i++)
+        frag[i] = load_shader(GL_FRAGMENT_SHADER, lens_fragShaderPermutations[profile * nfrag + i]);
+    for (int d = 0; d < MAX_DISTORTION; d++) {
+        for (int s = 0; s < MAX_STEREO_MODE; s++) {
+            for (int c = 0; c < MAX_COLORSPACE; c++)
+                link_shader_program(&lens.prog[d][s][c], vert[d], frag[s * MAX_COLORSPACE + c]);
+        }
+    }
+
+    unsigned int caps = ovrDistortionCap_Chromatic | ovrDistortionCap_TimeWarp | ovrDistortionCap_Vignette;
+    glGenVertexArrays(2, lens.vao);
+    glGenBuffers(2, lens.vbo);
+    glGenBuffers(2, lens.ibo);
+    for (int eye = 0; eye < 2; eye++) {
+        ovrDistortionMesh mesh;
+        if (!ovrHmd_CreateDistortionMesh(hmd, (ovrEyeType)eye, eye_rdesc[eye].Fov, caps, &mesh)) {
+            cerr << "Failed to create the distortion mesh." << endl;
+            return false;
+        }
+
+        glBindVertexArray(lens.vao[eye]);
+        glBindBuffer(GL_ARRAY_BUFFER, lens.vbo[eye]);
+        glBufferData(GL_ARRAY_BUFFER, mesh.VertexCount * sizeof(ovrDistortionVertex),
+                mesh.pVertexData, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lens.ibo[eye]);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.IndexCount * sizeof(unsigned short),
+                mesh.pIndexData, GL_STATIC_DRAW);
+
+        const GLsizei stride = sizeof(ovrDistortionVertex);
+        glEnableVertexAttribArray(ATTRIB_POSITION);
+        glVertexAttribPointer(ATTRIB_POSITION, 2, GL_FLOAT, GL_FALSE, stride,
+                (void*)offsetof(ovrDistortionVertex, ScreenPosNDC));
+        glEnableVertexAttribArray(ATTRIB_LENS);
+        glVertexAttribPointer(ATTRIB_LENS, 2, GL_FLOAT, GL_FALSE, stride,
+                (void*)offsetof(ovrDistortionVertex, TimeWarpFactor));
+        glEnableVertexAttribArray(ATTRIB_TAN_R);
+        glVertexAttribPointer(ATTRIB_TAN_R, 2, GL_FLOAT, GL_FALSE, stride,
+                (void*)offsetof(ovrDistortionVertex, TanEyeAnglesR));
+        glEnableVertexAttribArray(ATTRIB_TAN_G);
+        glVertexAttribPointer(ATTRIB_TAN_G, 2, GL_FLOAT, GL_FALSE, stride,
+                (void*)offsetof(ovrDistortionVertex, TanEyeAnglesG));
+        glEnableVertexAttribArray(ATTRIB_TAN_B);
+        glVertexAttribPointer(ATTRIB_TAN_B, 2, GL_FLOAT, GL_FALSE, stride,
+                (void*)offsetof(ovrDistortionVertex, TanEyeAnglesB));
+        glBindVertexArray(0);
+
+        lens.index_count[eye] = mesh.IndexCount;
+        mem_track_gpu("lens", eye == ovrEye_Left ? "left mesh" : "right mesh",
+                mesh.VertexCount * sizeof(ovrDistortionVertex) + mesh.IndexCount * sizeof(unsigned short));
+        ovrHmd_DestroyDistortionMesh(&mesh);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    printf("client distortion: %d+%d mesh indices, drawing straight to the %dx%d backbuffer\n",
+            lens.index_count[0], lens.index_count[1], hmd->Resolution.w, hmd->Resolution.h);
+    return true;
+}
+
 void OvrConfigureRendering()
 {
     // fill in the ovrGLTexture structures that describe our render target texture
@@ -754,7 +2911,15 @@ void OvrConfigureRendering()
     distort_caps |= param.no_compute_shader ? 0 : ovrDistortionCap_ComputeShader; // #ifdef'd out in the sdk for linux
 #endif
 
-    if(!ovrHmd_ConfigureRendering(hmd, &glcfg.Config, distort_caps, hmd->DefaultEyeFov, eye_rdesc)) {
+    if (lens.enabled) {
+        // the SDK only supplies meshes and timing, it doesn't render
+        for (int eye = 0; eye < 2; eye++)
+            eye_rdesc[eye] = ovrHmd_GetRenderDesc(hmd, (ovrEyeType)eye, hmd->DefaultEyeFov[eye]);
+        if (!InitLens()) {
+            SDL_Quit();
+            exit(1);
+        }
+    } else if(!ovrHmd_ConfigureRendering(hmd, &glcfg.Config, distort_caps, hmd->DefaultEyeFov, eye_rdesc)) {
         fprintf(stderr, "failed to configure renderer for Oculus SDK\n");
     }
 
@@ -763,6 +2928,8 @@ void OvrConfigureRendering()
 
 void Init () {
 
+    arena_init();
+
 #ifdef OVR_ENABLED
     // jdt: oculus init needs better home
     if (!ovr_Initialize()) {
@@ -777,12 +2944,18 @@ void Init () {
     // requiring anything higher than OpenGL 3.0 causes deprecation of 
     // GL_LIGHTING GL_LIGHT0 GL_NORMALIZE, etc.. need replacements.
     // also deprecates immediate mode, which would be a complete overhaul.
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 0);
+    if (param.core_profile) {
+        // everything goes through VAOs and the eye matrix uniform buffer
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+    } else {
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 0);
+    }
     SDL_GL_SetAttribute(SDL_GL_ACCELERATED_VISUAL, 1);
     SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
     /*
-       SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
        SDL_GL_SetAttribute(SDL_GL_FRAMEBUFFER_SRGB_CAPABLE, 1); // enables TrueColor
        SDL_GL_SetAttribute(SDL_GL_RED_SIZE, 8);
        SDL_GL_SetAttribute(SDL_GL_GREEN_SIZE, 8);
@@ -808,6 +2981,8 @@ void Init () {
     Uint32 window_width = 1920; //resolution.width;
     Uint32 window_height = 1080; //resolution.height;
     Uint32 window_flags = SDL_WINDOW_OPENGL;
+    if (offline.enabled)
+        window_flags |= SDL_WINDOW_HIDDEN; // only the context is needed
     if (param.fullscreen) {
         // jdt: fullscreen option now controls whether to automatically send 
         // window fullscreen to the rift in extended mode.
@@ -839,11 +3014,16 @@ void Init () {
         SDL_Quit();
     }
     cout << "Status: Using GLEW: " << (char*)glewGetString(GLEW_VERSION) << endl;
+    if (uploader.enabled)
+        CreateUploadContext();
     printf("Setting up video mode with res: %ux%u\n", window_width, window_height);
 
 #ifdef OVR_ENABLED
-    if (!(hmd = ovrHmd_Create(0))) {
-        cout << "No Oculus Rift device found.  Creating fake DK2." << endl;
+    if (offline.enabled || !(hmd = ovrHmd_Create(0))) {
+        if (offline.enabled)
+            cout << "Offline rendering with a virtual DK2." << endl;
+        else
+            cout << "No Oculus Rift device found.  Creating fake DK2." << endl;
         if(!(hmd = ovrHmd_CreateDebug(ovrHmd_DK2))) {
             cout << "failed to create virtual debug HMD" << endl;
             SDL_Quit();
@@ -856,13 +3036,21 @@ void Init () {
     printf("\tdisplay resolution: %dx%d\n", hmd->Resolution.w, hmd->Resolution.h);
     printf("\tdisplay position: %d,%d\n", hmd->WindowsPos.x, hmd->WindowsPos.y);
 
-    OvrConfigureTracking();
+    if (!offline.enabled)
+        OvrConfigureTracking();
     OvrFindResolution();
 
     fbo = fb_tex[0] = fb_tex[1] = fb_depth = 0;
-    UpdateRenderTarget(fb_width, fb_height);
+    if (!lens.enabled)
+        UpdateRenderTarget(fb_width, fb_height);
 
-    OvrConfigureRendering();
+    if (offline.enabled) {
+        // nothing is presented, only the eye parameters are needed
+        for (int eye = 0; eye < 2; eye++)
+            eye_rdesc[eye] = ovrHmd_GetRenderDesc(hmd, (ovrEyeType)eye, hmd->DefaultEyeFov[eye]);
+    } else {
+        OvrConfigureRendering();
+    }
 #else
     fb_width = window_width;
     fb_height = window_height;
@@ -874,31 +3062,41 @@ void Init () {
     init_shader_program(&dome_distort_prog, "shaders/dome_distort.vert", "shaders/dome_distort.frag");
     init_shader_program(&cylinder_distort_prog, "shaders/cylinder_distort.vert", "shaders/cylinder_distort.frag");
 #else
-    cout << "loading fxaa shader" << endl;
-    init_shader_program(&fxaa_prog, fxaa_vertShaderSource, fxaa_fragShaderSource);
-    cout << "loading passthrough shader" << endl;
-    init_shader_program(&passthrough_prog, passthrough_vertShaderSource, passthrough_fragShaderSource);
-    cout << "loading dome shader" << endl;
-    init_shader_program(&dome_distort_prog, dome_distort_vertShaderSource, dome_distort_fragShaderSource);
-    cout << "loading cylinder shader" << endl;
-    init_shader_program(&cylinder_distort_prog, cylinder_distort_vertShaderSource, cylinder_distort_fragShaderSource);
+    cout << "loading shader permutations" << endl;
+    init_shader_permutations();
 #endif
+    if (param.core_profile)
+        InitCoreProfile();
+    InitOverlay();
 
 #ifdef OVR_ENABLED
-    if (param.fullscreen && (hmd->HmdCaps & ovrHmdCap_ExtendDesktop))
+    if (param.fullscreen && !offline.enabled && (hmd->HmdCaps & ovrHmdCap_ExtendDesktop))
         ToggleHmdFullscreen ();
 #endif
 
 }
 
 
+#define CAPTURE_FPS 75 // DK2 refresh, for the y4m header
+
 const unsigned int maxFrames = 50;
 static unsigned int numFrames = 0;
 static float averagefps = 0;
 static float prevTime = 0;
 static unsigned int numDumps = 0;
+#define FPS_LINE 512 // room for every optional part of the fps line
 
-void dump_fps()
+// printf at the end of what buf holds, cut at size
+static void appendf(char *buf, size_t size, const char *format, ...)
+{
+    size_t n = strlen(buf);
+    va_list ap;
+    va_start(ap, format);
+    vsnprintf(buf + n, size - n, format, ap);
+    va_end(ap);
+}
+
+void dump_fps()
 {
     numFrames++;
 
@@ -909,7 +3107,50 @@ void dump_fps()
         }
         numFrames = 0;
         prevTime = curTime;
-        printf("%u fps:%.3f\n", numDumps*maxFrames, averagefps);
+        char line[FPS_LINE] = "";
+        appendf(line, sizeof line, "%u fps:%.3f", numDumps*maxFrames, averagefps);
+#ifdef OVR_ENABLED
+        if (pose_latency.count) {
+            // pose age at scanout, as predicted by the SDK's frame timing
+            appendf(line, sizeof line, " pose->scanout early:%.2fms late:%.2fms",
+                    pose_latency.early_sum / pose_latency.count * 1000.0,
+                    pose_latency.late_sum / pose_latency.count * 1000.0);
+            pose_latency.early_sum = pose_latency.late_sum = 0;
+            pose_latency.count = 0;
+        }
+#endif
+        if (capture_active())
+            appendf(line, sizeof line, " capture:%.2fms dropped:%u", capture_overhead_ms(), capture_dropped());
+        if (offline.enabled)
+            appendf(line, sizeof line, " %.2fx realtime", averagefps / offline.fps);
+        if (param.scissor && scissor.total_pixels) {
+            // share of the eye buffer pixels still cleared and post processed
+            appendf(line, sizeof line, " clear:%.0f%% post:%.0f%%", scissor.clear_pixels / scissor.total_pixels * 100,
+                    scissor.post_pixels / scissor.total_pixels * 100);
+            scissor.clear_pixels = scissor.post_pixels = scissor.total_pixels = 0;
+        }
+        if (param.dirty_tiles) {
+            unsigned int frames, duplicates;
+            double changed;
+            dirty_stats(&frames, &duplicates, &changed);
+            appendf(line, sizeof line, " tiles:%.0f%% dup:%u/%u", changed * 100, duplicates, frames);
+        }
+        if (fovea.full_pixels) {
+            // scene pixels shaded against drawing the same bounds at full density
+            appendf(line, sizeof line, " fovea:%.0f%%", fovea.shaded_pixels / fovea.full_pixels * 100);
+            fovea.shaded_pixels = fovea.full_pixels = 0;
+        }
+        if (mono.frames) {
+            appendf(line, sizeof line, " mono:%u", mono.frames);
+            mono.frames = 0;
+        }
+        if (panorama.enabled) {
+            int level, visible;
+            unsigned int uploads;
+            pano_stats(&level, &visible, &uploads);
+            appendf(line, sizeof line, " pano L%d tiles:%d uploads:%u", level, visible, uploads);
+        }
+        log_info("%s", line);
         numDumps++;
     }
 }
@@ -990,17 +3231,508 @@ void draw_mesh(float d, int nx, int ny, float texLeft, float texRight, float tex
 }
 
 
-void RenderFrame()
+// Core profile counterpart of draw_mesh(): the same grid with 0..1
+// texcoords in a VAO, only rebuilt when the screen size or mode changes.
+void UpdateScreenMesh(float d, int nx, int ny)
 {
-#ifdef OVR_ENABLED
-    ovrHmd_BeginFrame(hmd, frame_index);
+    static float prev_d;
+    static int prev_nx, prev_ny;
+
+    if (screen_vao && d == prev_d && nx == prev_nx && ny == prev_ny)
+        return;
+    prev_d = d;
+    prev_nx = nx;
+    prev_ny = ny;
+
+    if (!screen_vao) {
+        glGenVertexArrays(1, &screen_vao);
+        glGenBuffers(1, &screen_vbo);
+        glGenBuffers(1, &screen_ibo);
+    }
+
+    GLfloat *verts = new GLfloat[nx * ny * 4];
+    GLushort *indices = new GLushort[(nx-1) * (ny-1) * 6];
+
+    for (int y = 0; y < ny; y++) {
+        for (int x = 0; x < nx; x++) {
+            GLfloat *v = verts + (y * nx + x) * 4;
+            v[0] = x * d / (nx-1) - d/2;
+            v[1] = y * d / (ny-1) - d/2;
+            v[2] = (float)x / (nx-1);
+            v[3] = (float)y / (ny-1);
+        }
+    }
+
+    screen_index_count = 0;
+    for (int y = 0; y < ny-1; y++) {
+        for (int x = 0; x < nx-1; x++) {
+            GLushort i = y * nx + x;
+            indices[screen_index_count++] = i;
+            indices[screen_index_count++] = i + 1;
+            indices[screen_index_count++] = i + nx;
+            indices[screen_index_count++] = i + 1;
+            indices[screen_index_count++] = i + nx + 1;
+            indices[screen_index_count++] = i + nx;
+        }
+    }
+
+    glBindVertexArray(screen_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, screen_vbo);
+    glBufferData(GL_ARRAY_BUFFER, nx * ny * 4 * sizeof(GLfloat), verts, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(ATTRIB_POSITION);
+    glVertexAttribPointer(ATTRIB_POSITION, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), 0);
+    glEnableVertexAttribArray(ATTRIB_TEXCOORD);
+    glVertexAttribPointer(ATTRIB_TEXCOORD, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat),
+            (void*)(2 * sizeof(GLfloat)));
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, screen_ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, screen_index_count * sizeof(GLushort), indices, GL_STATIC_DRAW);
+    glBindVertexArray(0);
+
+    delete[] verts;
+    delete[] indices;
+}
+
+static void pose_from_trace(const trace_pose &tp, ovrPosef &pose)
+{
+    memcpy(&pose.Orientation.x, tp.orientation, sizeof tp.orientation);
+    memcpy(&pose.Position.x, tp.position, sizeof tp.position);
+}
+
+static void pose_to_trace(const ovrPosef &pose, trace_pose &tp)
+{
+    memcpy(tp.orientation, &pose.Orientation.x, sizeof tp.orientation);
+    memcpy(tp.position, &pose.Position.x, sizeof tp.position);
+}
+
+void SampleEyePoses(unsigned int index)
+{
+    if (trace_is_replaying()) {
+        trace_frame fr;
+        if (!trace_get_frame(index, &fr)) {
+            quit = true; // end of the trace
+            return;
+        }
+        pose_from_trace(fr.eye[0], eyePose[0]);
+        pose_from_trace(fr.eye[1], eyePose[1]);
+        pose_from_trace(fr.head, trackingState.HeadPose.ThePose);
+        trackingState.StatusFlags = fr.status;
+        poseSampleTime = ovr_GetTimeInSeconds();
+        return;
+    }
+
+    if (offline.enabled) {
+        // fixed camera facing the screen, or the scripted path
+        float q[4] = { 0, 0, 0, 1 };
+        if (posepath_loaded())
+            posepath_sample(offline.frames / offline.fps, q);
+        for (int eye = 0; eye < 2; eye++) {
+            memcpy(&eyePose[eye].Orientation.x, q, sizeof q);
+            eyePose[eye].Position.x = eyePose[eye].Position.y = eyePose[eye].Position.z = 0;
+        }
+        trackingState.HeadPose.ThePose = eyePose[0];
+        poseSampleTime = ovr_GetTimeInSeconds();
+        return;
+    }
 
     ovrVector3f eye_view_offsets[2] = {
         eye_rdesc[0].HmdToEyeViewOffset,
         eye_rdesc[1].HmdToEyeViewOffset
     };
-    ovrHmd_GetEyePoses(hmd, frame_index, eye_view_offsets, eyePose, &trackingState);
-    frame_index++;
+    ovrHmd_GetEyePoses(hmd, index, eye_view_offsets, eyePose, &trackingState);
+    poseSampleTime = ovr_GetTimeInSeconds();
+}
+
+// Called just before the eyes are drawn: re-sample the head pose as late as
+// possible and build the matrices the draws read from.  The same poses go to
+// ovrHmd_EndFrame so timewarp only has to correct the remaining interval.
+// A head-locked screen doesn't use the pose for drawing, so it keeps the
+// sample from the top of the frame.
+void LatchEyePoses(unsigned int index)
+{
+    if (param.late_latch && !param.view_locked)
+        SampleEyePoses(index);
+
+    ComputeEyeMatrices();
+}
+
+// Store what this frame was drawn with.  A replay shows the frames up to the
+// recorded media position, see ReplayFrames().
+void RecordFrame(unsigned int index)
+{
+    if (!trace_is_recording())
+        return;
+
+    trace_frame fr;
+    fr.frame = index;
+    fr.time = poseSampleTime;
+    fr.media_time = libvlc_media_player_get_time(vlc_media_player);
+    pose_to_trace(eyePose[0], fr.eye[0]);
+    pose_to_trace(eyePose[1], fr.eye[1]);
+    pose_to_trace(trackingState.HeadPose.ThePose, fr.head);
+    fr.status = trackingState.StatusFlags;
+    trace_write_frame(&fr);
+}
+
+// Client distortion frame: one pass per eye from the video texture to the
+// backbuffer.  The poses are latched and the timewarp matrices fetched right
+// before the draws, which then only have to cover scanout.
+void RenderLensFrame(unsigned int index)
+{
+    frameTiming = ovrHmd_BeginFrameTiming(hmd, index);
+    SampleEyePoses(index);
+    double early_sample = poseSampleTime;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, hmd->Resolution.w, hmd->Resolution.h);
+    glClearColor(0, 0, 0, 1);
+    glClear(GL_COLOR_BUFFER_BIT);
+    metrics_distortion(distortion_names[param.distortion]);
+
+    GLuint prog = lens.prog[param.distortion][param.stereo_mode][param.colorspace];
+    glUseProgram(prog);
+    glBindTexture(GL_TEXTURE_2D, video.displayTexture);
+    glUniform1i(glGetUniformLocation(prog, "fbo_texture"), 0);
+    glUniform3f(glGetUniformLocation(prog, "mesh_focus"), 0, 0, 0);
+    glUniform1f(glGetUniformLocation(prog, "mesh_radius"), param.mesh_radius);
+    glUniform1f(glGetUniformLocation(prog, "mesh_size"), param.tv_size);
+    SetVideoTexRect(prog);
+
+    LatchEyePoses(index);
+    glUniform4fv(glGetUniformLocation(prog, "mesh_crop"), 1, frame_mats.mesh_crop);
+    pose_latency.early_sum += frameTiming.ScanoutMidpointSeconds - early_sample;
+    pose_latency.late_sum += frameTiming.ScanoutMidpointSeconds - poseSampleTime;
+    pose_latency.count++;
+
+    for (int eye = 0; eye < 2; eye++) {
+        mat4 warp[2], view_picture, eye_to_mesh;
+        if (param.no_timewarp) {
+            mat4_identity(&warp[0]);
+            mat4_identity(&warp[1]);
+        } else {
+            ovrMatrix4f tw[2];
+            ovrHmd_GetEyeTimewarpMatrices(hmd, (ovrEyeType)eye, eyePose[eye], tw);
+            mat4_from_rows(tw[0].M, &warp[0]);
+            mat4_from_rows(tw[1].M, &warp[1]);
+        }
+        mat4_mul(&frame_mats.view[eye], &frame_mats.picture, &view_picture);
+        mat4_affine_inverse(&view_picture, &eye_to_mesh);
+
+        glUniformMatrix4fv(glGetUniformLocation(prog, "eye_rotation_start"), 1, GL_FALSE, warp[0].m);
+        glUniformMatrix4fv(glGetUniformLocation(prog, "eye_rotation_end"), 1, GL_FALSE, warp[1].m);
+        glUniformMatrix4fv(glGetUniformLocation(prog, "eye_to_mesh"), 1, GL_FALSE, eye_to_mesh.m);
+        glUniform1f(glGetUniformLocation(prog, "eye"), eye == ovrEye_Left ? 0 : 1);
+
+        glBindVertexArray(lens.vao[eye]);
+        glDrawElements(GL_TRIANGLES, lens.index_count[eye], GL_UNSIGNED_SHORT, 0);
+    }
+    glBindVertexArray(0);
+    glUseProgram(0);
+
+    // what the user saw, undistorted views aren't rendered in this mode
+    capture_frame(hmd->Resolution.w, hmd->Resolution.h);
+
+    RecordFrame(index);
+    SDL_GL_SwapWindow(sdlWindow);
+    ovrHmd_EndFrameTiming(hmd);
+
+    if (param.console_dump) dump_fps();
+}
+
+// Both eyes sample the same thing only for unsplit video on the flat screen.
+bool MonoFrame()
+{
+    return mono.enabled && param.stereo_mode == STEREO_NONE &&
+        param.distortion == DISTORTION_NONE && param.projection == PROJECTION_SCREEN &&
+        !panorama.enabled;
+}
+
+void DrawFullscreenQuad()
+{
+    if (param.core_profile) {
+        glBindVertexArray(post_vao);
+        glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+        glBindVertexArray(0);
+    } else {
+        glBegin (GL_QUADS);
+        glVertex2f(-1, -1); 
+        glVertex2f( 1, -1);
+        glVertex2f(1, 1);
+        glVertex2f(-1, 1);
+        glEnd();
+    }
+}
+
+// After the poses are latched: the shared view between the eyes, with a
+// field of view covering both, and the screen drawn and anti-aliased into
+// the layer.  distort_prog is current with the video bound and is again on
+// return.
+void DrawMonoLayer(GLuint distort_prog)
+{
+    ovrFovPort fov = hmd->DefaultEyeFov[0];
+    float span = 0, vspan = 0;
+    for (int eye = 0; eye < 2; eye++) {
+        const ovrFovPort &f = hmd->DefaultEyeFov[eye];
+        fov.UpTan = max(fov.UpTan, f.UpTan);
+        fov.DownTan = max(fov.DownTan, f.DownTan);
+        fov.LeftTan = max(fov.LeftTan, f.LeftTan);
+        fov.RightTan = max(fov.RightTan, f.RightTan);
+        span = max(span, f.LeftTan + f.RightTan);
+        vspan = max(vspan, f.UpTan + f.DownTan);
+    }
+    fov.UpTan += MONO_FOV_MARGIN;
+    fov.DownTan += MONO_FOV_MARGIN;
+    fov.LeftTan += MONO_FOV_MARGIN;
+    fov.RightTan += MONO_FOV_MARGIN;
+
+    // an eye's pixel density over the wider field
+    int width = (int)ceilf(fb_width / 2 * (fov.LeftTan + fov.RightTan) / span);
+    int height = (int)ceilf(fb_height * (fov.UpTan + fov.DownTan) / vspan);
+    if (!mono.fbo) {
+        glGenFramebuffers(1, &mono.fbo);
+        glGenTextures(2, mono.texture);
+    }
+    if (width != mono.width || height != mono.height) {
+        for (int i = 0; i < 2; i++) {
+            glBindTexture(GL_TEXTURE_2D, mono.texture[i]);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        }
+        mono.width = width;
+        mono.height = height;
+        mem_track_gpu("eye", "mono layer", (size_t)width * height * 4 * 2);
+    }
+
+    ovrMatrix4f proj = ovrMatrix4f_Projection(fov, NEAR_CLIP_DIST, 2000.0f, 1);
+    mat4_from_rows(proj.M, &mono.proj);
+    for (int i = 0; i < 16; i++)
+        mono.view.m[i] = (frame_mats.view[0].m[i] + frame_mats.view[1].m[i]) / 2;
+    mat4_mul(&mono.proj, &mono.view, &mono.view_proj);
+
+    // only the screen's bounds are cleared, drawn and anti-aliased
+    float d = param.tv_size;
+    float lo[3] = { -d/2, -d/2, 0 }, hi[3] = { d/2, d/2, 0 };
+    float b[4] = { 1, 1, -1, -1 };
+    if (!ExtendBounds(b, &mono.view_proj, &frame_mats.picture, lo, hi)) {
+        b[0] = b[1] = -1;
+        b[2] = b[3] = 1;
+    }
+    int x0 = max(0, (int)floorf((b[0] + 1) / 2 * width) - SCISSOR_MARGIN);
+    int y0 = max(0, (int)floorf((b[1] + 1) / 2 * height) - SCISSOR_MARGIN);
+    int x1 = min(width, (int)ceilf((b[2] + 1) / 2 * width) + SCISSOR_MARGIN);
+    int y1 = min(height, (int)ceilf((b[3] + 1) / 2 * height) + SCISSOR_MARGIN);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, mono.fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mono.texture[0], 0);
+    glViewport(0, 0, width, height);
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(x0, y0, max(0, x1 - x0), max(0, y1 - y0));
+    glClearColor(0, 0, 0, 1);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    glUniform1f(glGetUniformLocation(distort_prog, "eye"), 0);
+    if (param.core_profile) {
+        // the shared view takes the left eye's slot for this draw
+        glBindBuffer(GL_UNIFORM_BUFFER, eye_ubo);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof mono.view_proj, &mono.view_proj);
+        glBindVertexArray(screen_vao);
+        glDrawElements(GL_TRIANGLES, screen_index_count, GL_UNSIGNED_SHORT, 0);
+        glBindVertexArray(0);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof frame_mats.view_proj[0], &frame_mats.view_proj[0]);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    } else {
+        mat4 modelview;
+        mat4_mul(&mono.view, &frame_mats.picture, &modelview);
+        glMatrixMode(GL_PROJECTION);
+        glLoadMatrixf(mono.proj.m);
+        glMatrixMode(GL_MODELVIEW);
+        glLoadMatrixf(modelview.m);
+        draw_mesh(d, 2, 2, 0, 1, 1, 0);
+    }
+
+    if (param.use_fxaa) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mono.texture[1], 0);
+        glClear(GL_COLOR_BUFFER_BIT);
+        if (!param.core_profile) {
+            glMatrixMode(GL_PROJECTION);
+            glLoadIdentity();
+            glMatrixMode(GL_MODELVIEW);
+            glLoadIdentity();
+        }
+        glUseProgram(fxaa_prog[1]);
+        glBindTexture(GL_TEXTURE_2D, mono.texture[0]);
+        glUniform1i(glGetUniformLocation(fxaa_prog[1], "u_texture0"), 0);
+        glUniform2f(glGetUniformLocation(fxaa_prog[1], "resolution"), width, height);
+        DrawFullscreenQuad();
+        glUseProgram(distort_prog);
+        glBindTexture(GL_TEXTURE_2D, video.displayTexture);
+    }
+    glDisable(GL_SCISSOR_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    mono.frames++;
+}
+
+// In place of the screen mesh: the screen's plane textured from the layer.
+void DrawMonoScreen(ovrEyeType eye)
+{
+    // mesh to the shared view's clip space, biased to 0..1
+    mat4 bias, mvp, layer;
+    mat4_identity(&bias);
+    mat4_translate(&bias, 0.5f, 0.5f, 0.5f);
+    mat4_scale(&bias, 0.5f, 0.5f, 0.5f);
+    mat4_mul(&mono.view_proj, &frame_mats.picture, &mvp);
+    mat4_mul(&bias, &mvp, &layer);
+
+    glUseProgram(layer_prog);
+    glBindTexture(GL_TEXTURE_2D, mono.texture[param.use_fxaa ? 1 : 0]);
+    glUniform1i(glGetUniformLocation(layer_prog, "layer_texture"), 0);
+    glUniform1f(glGetUniformLocation(layer_prog, "eye"), eye == ovrEye_Left ? 0 : 1);
+    glUniformMatrix4fv(glGetUniformLocation(layer_prog, "layer_matrix"), 1, GL_FALSE, layer.m);
+    if (param.core_profile) {
+        glUniformMatrix4fv(glGetUniformLocation(layer_prog, "model"), 1, GL_FALSE, frame_mats.picture.m);
+        glBindVertexArray(screen_vao);
+        glDrawElements(GL_TRIANGLES, screen_index_count, GL_UNSIGNED_SHORT, 0);
+        glBindVertexArray(0);
+    } else {
+        glPushMatrix();
+        glMultMatrixf(frame_mats.crop.m);
+        draw_mesh(param.tv_size, 2, 2, 0, 1, 1, 0);
+        glPopMatrix();
+    }
+}
+
+// Everything an eye sees, into the viewport set.  distort_prog is current
+// with the video bound and is again on return.
+void DrawEye(ovrEyeType eye, GLuint distort_prog, GLuint mesh_nx, GLuint mesh_ny)
+{
+    if (!param.core_profile)
+        SetupDisplay (eye, true);
+
+    float texLeft = 0;
+    float texRight =(float)video.width / video.glVideoWidth;
+    float texDown = 0;
+    float texUp = (float)video.height / video.glVideoHeight;
+
+    if (param.stereo_mode == STEREO_SBS) {
+        texLeft = eye == ovrEye_Left ? 0.0f : texRight/2;
+        texRight = eye == ovrEye_Left ? texRight/2 : texRight;
+    } else if (param.stereo_mode == STEREO_OVER_UNDER) {
+        texDown = eye == ovrEye_Left ? 0.0f : texUp/2;
+        texUp = eye == ovrEye_Left ? texUp/2 : texUp;
+    } 
+
+    float d = param.tv_size;
+
+    // the shader maps the 0..1 mesh onto this eye's part of the frame
+    glUniform1f(glGetUniformLocation(distort_prog, "eye"), eye == ovrEye_Left ? 0 : 1);
+    if (panorama.enabled) {
+        DrawPano(eye);
+    } else if (param.projection != PROJECTION_SCREEN) {
+        DrawSky(eye);
+    } else if (mono.active) {
+        DrawMonoScreen(eye);
+    } else if (param.core_profile) {
+        glBindVertexArray(screen_vao);
+        glDrawElements(GL_TRIANGLES, screen_index_count, GL_UNSIGNED_SHORT, 0);
+        glBindVertexArray(0);
+    } else {
+        glPushMatrix();
+        glMultMatrixf(frame_mats.crop.m);
+        draw_mesh(d, mesh_nx, mesh_ny, 0, 1, 1, 0);
+        glPopMatrix();
+    }
+
+    if (SeekPreviewVisible())
+        DrawSeekPreview(eye, d, texLeft, texRight, texUp, texDown);
+    DrawOverlay(eye);
+    glUseProgram(distort_prog);
+    glBindTexture(GL_TEXTURE_2D, video.displayTexture);
+}
+
+// Fixed foveated rendering: draw the eye into the periphery target, scale
+// it up into the eye's viewport within the bounds drawn this frame and
+// leave the scissor on the full density window.  Bound to fbo again on
+// return, with the eye's viewport.
+void DrawPeriphery(ovrEyeType eye, GLuint distort_prog, GLuint mesh_nx, GLuint mesh_ny)
+{
+    int w = fb_width / 2, h = fb_height;
+    int x0 = eye == ovrEye_Left ? 0 : w;
+    int width = max(1, (int)ceilf(w * fovea.scale));
+    int height = max(1, (int)ceilf(h * fovea.scale));
+    if (!fovea.fbo) {
+        glGenFramebuffers(1, &fovea.fbo);
+        glGenTextures(1, &fovea.texture);
+    }
+    if (width != fovea.width || height != fovea.height) {
+        glBindTexture(GL_TEXTURE_2D, fovea.texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, fovea.fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, fovea.texture, 0);
+        fovea.width = width;
+        fovea.height = height;
+        mem_track_gpu("eye", "fovea periphery", (size_t)width * height * 4);
+    }
+
+    // what is drawn of this eye at all, and the same in the target
+    SDL_Rect b = { x0, 0, w, h };
+    if (param.scissor)
+        b = ClearRect(eye);
+    float sx = (float)width / w, sy = (float)height / h;
+    int px0 = (int)floorf((b.x - x0) * sx), py0 = (int)floorf(b.y * sy);
+    int px1 = min(width, (int)ceilf((b.x + b.w - x0) * sx));
+    int py1 = min(height, (int)ceilf((b.y + b.h) * sy));
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fovea.fbo);
+    glViewport(0, 0, width, height);
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(px0, py0, max(0, px1 - px0), max(0, py1 - py0));
+    ClearDisplay();
+    DrawEye(eye, distort_prog, mesh_nx, mesh_ny);
+
+    // scaled up under the window, the AA=0 post program is a plain copy
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(x0, 0, w, h);
+    glScissor(b.x, b.y, b.w, b.h);
+    glUseProgram(fxaa_prog[0]);
+    glBindTexture(GL_TEXTURE_2D, fovea.texture);
+    glUniform1i(glGetUniformLocation(fxaa_prog[0], "u_texture0"), 0);
+    DrawFullscreenQuad();
+    glUseProgram(distort_prog);
+    glBindTexture(GL_TEXTURE_2D, video.displayTexture);
+
+    // the window around the lens axis, which needn't be the viewport's middle
+    const ovrFovPort &fov = hmd->DefaultEyeFov[eye];
+    int cw = (int)(w * fovea.inner), ch = (int)(h * fovea.inner);
+    int cx = x0 + min(w - cw, max(0, (int)(w * fov.LeftTan / (fov.LeftTan + fov.RightTan)) - cw / 2));
+    int cy = min(h - ch, max(0, (int)(h * fov.DownTan / (fov.UpTan + fov.DownTan)) - ch / 2));
+    int wx0 = max(cx, b.x), wy0 = max(cy, b.y);
+    int wx1 = min(cx + cw, b.x + b.w), wy1 = min(cy + ch, b.y + b.h);
+    glScissor(wx0, wy0, max(0, wx1 - wx0), max(0, wy1 - wy0));
+
+    fovea.shaded_pixels += max(0, px1 - px0) * max(0, py1 - py0) +
+        max(0, wx1 - wx0) * max(0, wy1 - wy0);
+    fovea.full_pixels += b.w * b.h;
+}
+
+void RenderFrame()
+{
+#ifdef OVR_ENABLED
+    unsigned int index = frame_index++;
+    if (lens.enabled) {
+        RenderLensFrame(index);
+        return;
+    }
+    if (!offline.enabled)
+        frameTiming = ovrHmd_BeginFrame(hmd, index);
+
+    SampleEyePoses(index);
+    double early_sample = poseSampleTime;
 #endif
 
 #ifdef OVR_ENABLED
@@ -1024,12 +3756,15 @@ void RenderFrame()
     //current->Loop(g_game.time_step);
     //glEndList();
 
-    ClearDisplay();
+    // scissored, each eye clears its own bounds
+    if (!param.scissor)
+        ClearDisplay();
 
-    glEnable(GL_TEXTURE_2D);
-    glColor3f(1,1,1);
+    if (!param.core_profile) {
+        glEnable(GL_TEXTURE_2D);
+        glColor3f(1,1,1);
+    }
 
-    GLuint distort_prog = 0;
     GLuint nmesh = 20;
     GLuint mesh_nx = 2;
     GLuint mesh_ny = 2;
@@ -1038,27 +3773,47 @@ void RenderFrame()
     case DISTORTION_DOME:
         mesh_nx = nmesh + 1;
         mesh_ny = nmesh + 1;
-        distort_prog = dome_distort_prog;
         break;
     case DISTORTION_CYLINDER:
         mesh_nx = nmesh * 2 + 1;
         mesh_ny = 2;
-        distort_prog = cylinder_distort_prog;
         break;
     default: break;
     };
 
-    if (distort_prog) {
-        glUseProgram (distort_prog);
-        glBindTexture(GL_TEXTURE_2D, video.glTexture[0]);
-        glUniform1i(glGetUniformLocation(distort_prog, "fbo_texture"), 0);
-        glUniform3f(glGetUniformLocation(distort_prog, "mesh_focus"), 0, 0, 0); // TODO
-        glUniform1f(glGetUniformLocation(distort_prog, "mesh_radius"), param.mesh_radius); //param.tv_size * sqrt(2));
-    } else {
-        glBindTexture(GL_TEXTURE_2D, video.glTexture[0]);
-    }
+    // the variant matching the current modes, no runtime branches inside
+    GLuint distort_prog = screen_prog[param.distortion][param.stereo_mode][param.colorspace];
+    glUseProgram (distort_prog);
+    glBindTexture(GL_TEXTURE_2D, video.displayTexture);
+    glUniform1i(glGetUniformLocation(distort_prog, "fbo_texture"), 0);
+    glUniform3f(glGetUniformLocation(distort_prog, "mesh_focus"), 0, 0, 0); // TODO
+    glUniform1f(glGetUniformLocation(distort_prog, "mesh_radius"), param.mesh_radius); //param.tv_size * sqrt(2));
+    SetVideoTexRect(distort_prog);
+    if (param.core_profile)
+        UpdateScreenMesh(param.tv_size, mesh_nx, mesh_ny);
+    UpdateOverlay();
+    metrics_distortion(distortion_names[param.distortion]);
 
 #ifdef OVR_ENABLED
+    LatchEyePoses(index);
+    if (!offline.enabled) {
+        pose_latency.early_sum += frameTiming.ScanoutMidpointSeconds - early_sample;
+        pose_latency.late_sum += frameTiming.ScanoutMidpointSeconds - poseSampleTime;
+        pose_latency.count++;
+    }
+
+    if (param.core_profile)
+        glUniformMatrix4fv(glGetUniformLocation(distort_prog, "model"), 1, GL_FALSE, frame_mats.picture.m);
+    glUniform4fv(glGetUniformLocation(distort_prog, "mesh_crop"), 1, frame_mats.mesh_crop);
+    if (panorama.enabled)
+        UpdatePano();
+    if (param.scissor)
+        UpdateScissor();
+    mono.active = MonoFrame();
+    if (mono.active)
+        DrawMonoLayer(distort_prog);
+    bool fovea_active = fovea.enabled && fovea.inner < 1 && fovea.scale < 1;
+
     for (int i = 0; i < 2; ++i)
     {
         ovrEyeType eye = hmd->EyeRenderOrder[i];
@@ -1068,28 +3823,12 @@ void RenderFrame()
         } else {
             glViewport(fb_width/2, 0, fb_width/2, fb_height);
         }
+        if (param.scissor)
+            ClearEye(eye);
 
-        SetupDisplay (eye, true);
-
-        float texLeft = 0;
-        float texRight =(float)video.width / video.glVideoWidth;
-        float texDown = 0;
-        float texUp = (float)video.height / video.glVideoHeight;
-
-        if (param.stereo_mode == STEREO_SBS) {
-            texLeft = eye == ovrEye_Left ? 0.0f : texRight/2;
-            texRight = eye == ovrEye_Left ? texRight/2 : texRight;
-        } else if (param.stereo_mode == STEREO_OVER_UNDER) {
-            texDown = eye == ovrEye_Left ? 0.0f : texUp/2;
-            texUp = eye == ovrEye_Left ? texUp/2 : texUp;
-        } 
-
-        glTranslatef(0, 0, param.tv_zoffset);
-
-        float d = param.tv_size;
-
-        glScalef(video.aspect_ratio, 1, 1);
-        draw_mesh(d, mesh_nx, mesh_ny, texLeft, texRight, texUp, texDown);
+        if (fovea_active)
+            DrawPeriphery(eye, distort_prog, mesh_nx, mesh_ny);
+        DrawEye(eye, distort_prog, mesh_nx, mesh_ny);
 
         // TODO;
         //glCallList(stereo_gl_list);
@@ -1146,28 +3885,49 @@ void RenderFrame()
     // previous framebuffer texture and write to the one Oculus is configured with.
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, fb_tex[1], 0);
     glClearColor(0, 0, 0, 1);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (param.scissor && scissor.valid) {
+        // only what last frame's pass wrote needs to go back to black
+        for (int eye = 0; eye < 2; eye++) {
+            const SDL_Rect &r = scissor.prev[eye];
+            glScissor(r.x, r.y, r.w, r.h);
+            glClear(GL_COLOR_BUFFER_BIT);
+        }
+    } else {
+        glDisable(GL_SCISSOR_TEST);
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
     glViewport(0, 0, fb_tex_width, fb_tex_height);
-    glLoadIdentity();
-    if (param.use_fxaa) {
+    if (!param.core_profile)
+        glLoadIdentity();
+    {
         // jdt: TODO uniforms don't need to be set every frame
-        glUseProgram (fxaa_prog);
-        glBindTexture(GL_TEXTURE_2D, fb_tex[0]);
-        glUniform1i(glGetUniformLocation(fxaa_prog, "u_texture0"), 0);
-        glUniform2f(glGetUniformLocation(fxaa_prog, "resolution"), fb_tex_width, fb_tex_height);
-        glUniform1i(glGetUniformLocation(fxaa_prog, "enabled"), 1);
-    } else {
-        glUseProgram (passthrough_prog);
+        // the AA=0 permutation is a plain copy, a mono frame's layer was
+        // anti-aliased already
+        GLuint post_prog = fxaa_prog[param.use_fxaa && !mono.active ? 1 : 0];
+        glUseProgram (post_prog);
         glBindTexture(GL_TEXTURE_2D, fb_tex[0]);
-        glUniform1i(glGetUniformLocation(passthrough_prog, "fbo_texture"), 0);
-    }
-    glBegin (GL_QUADS);
-    glVertex2f(-1, -1); 
-    glVertex2f( 1, -1);
-    glVertex2f(1, 1);
-    glVertex2f(-1, 1);
-    glEnd();
+        glUniform1i(glGetUniformLocation(post_prog, "u_texture0"), 0);
+        glUniform2f(glGetUniformLocation(post_prog, "resolution"), fb_tex_width, fb_tex_height);
+    }
+    // one pass per eye rect when scissored
+    for (int pass = 0; pass < (param.scissor ? 2 : 1); pass++) {
+        if (param.scissor) {
+            const SDL_Rect &r = scissor.post[pass];
+            glEnable(GL_SCISSOR_TEST);
+            glScissor(r.x, r.y, r.w, r.h);
+            scissor.post_pixels += r.w * r.h;
+            scissor.prev[pass] = r;
+        }
+        DrawFullscreenQuad();
+    }
+    glDisable(GL_SCISSOR_TEST);
     glUseProgram(0);
+    scissor.valid = param.scissor;
+    scissor.total_pixels += fb_width * fb_height;
+
+    // what the user saw, read back asynchronously
+    capture_frame(fb_width, fb_height);
+
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, fb_tex[0], 0);
 
     // After drawing both eyes and post processing, revert to drawing directly to the
@@ -1175,7 +3935,10 @@ void RenderFrame()
     // and chromatic aberation and double buffering.
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-    ovrHmd_EndFrame(hmd, eyePose, &fb_ovr_tex[0].Texture);
+    RecordFrame(index);
+
+    if (!offline.enabled)
+        ovrHmd_EndFrame(hmd, eyePose, &fb_ovr_tex[0].Texture);
 #else
     SDL_GL_SwapWindow(sdlWindow);
 #endif
@@ -1183,92 +3946,167 @@ void RenderFrame()
     if (param.console_dump) dump_fps();
 }
 
-void PollEvent()
+void HandleEvent(SDL_Event &event)
 {
-    SDL_Event event;
     unsigned int key;
     int x, y;
 
-    unsigned int seekspeed[] = {5000, 30000, 240000};
-    libvlc_time_t curtime = libvlc_media_player_get_time(vlc_media_player);
+    libvlc_time_t seekspeed[] = {5000, 30000, 240000};
 
-    while (SDL_PollEvent (&event)) {
-        switch (event.type) {
-        case SDL_KEYDOWN:
-            SDL_GetMouseState(&x, &y);
-            key = event.key.keysym.sym;
-
-            switch(key) {
-            case SDLK_F2:
-            case SDLK_F9: ToggleHmdFullscreen(); break;
-            case SDLK_x: param.use_fxaa = !param.use_fxaa; break;
-            case SDLK_LSHIFT:
-            case SDLK_RSHIFT: ovrHmd_RecenterPose(hmd); break;
-            case SDLK_SPACE: libvlc_media_player_pause (vlc_media_player); break;
-            case SDLK_ESCAPE: quit = true; break;
-            case SDLK_a: param.tv_size -= 0.1f; break;
-            case SDLK_d: param.tv_size += 0.1f; break;
-            case SDLK_w: param.tv_zoffset += 0.1; break;
-            case SDLK_s: param.tv_zoffset -= 0.1; break;
-            case SDLK_v: param.view_locked = !param.view_locked; break;
-            case SDLK_m: libvlc_audio_toggle_mute(vlc_media_player); break;
-            case SDLK_h: param.ipd_multiplier--; break;
-            case SDLK_l: param.ipd_multiplier++; break;
-            case SDLK_j: param.mesh_radius -= 0.1; break;
-            case SDLK_k: param.mesh_radius += 0.1; break;
-            case SDLK_1:
-            case SDLK_2:
-            case SDLK_3: {
-                param.distortion = (distortion_t)(key - SDLK_1);
-                float half_mesh = param.tv_size / 2;
-                switch(param.distortion) {
-                case DISTORTION_NONE:
-                    param.mesh_radius = half_mesh;
-                    break;
-                case DISTORTION_DOME:
-                    param.mesh_radius = sqrt(2 * half_mesh * half_mesh);
-                    break;
-                case DISTORTION_CYLINDER:
-                    param.mesh_radius = half_mesh;
-                    break;
-                default: break;
-                }
+    switch (event.type) {
+    case SDL_KEYDOWN:
+        SDL_GetMouseState(&x, &y);
+        key = event.key.keysym.sym;
+
+        switch(key) {
+        case SDLK_F2:
+        case SDLK_F9: ToggleHmdFullscreen(); break;
+        case SDLK_x: param.use_fxaa = !param.use_fxaa; break;
+        case SDLK_e:
+            fovea.enabled = !fovea.enabled;
+            log_info("foveated rendering: %s", fovea.enabled ? "on" : "off");
+            break;
+        case SDLK_LSHIFT:
+        case SDLK_RSHIFT: ovrHmd_RecenterPose(hmd); break;
+        case SDLK_SPACE: TogglePause(); break;
+        case SDLK_COMMA: StepFrame(-1); break;
+        case SDLK_PERIOD: StepFrame(1); break;
+        case SDLK_ESCAPE: quit = true; break;
+        case SDLK_a: param.tv_size -= 0.1f; break;
+        case SDLK_d: param.tv_size += 0.1f; break;
+        case SDLK_w: param.tv_zoffset += 0.1; break;
+        case SDLK_s: param.tv_zoffset -= 0.1; break;
+        case SDLK_v: param.view_locked = !param.view_locked; break;
+        case SDLK_m: libvlc_audio_toggle_mute(vlc_media_player); break;
+        case SDLK_i:
+            mem_report(stdout);
+            mediaio_report(stdout);
+            framecache_report(stdout);
+            if (rendition.enabled)
+                abr_report(stdout);
+            if (sequence.enabled)
+                imageseq_report(stdout);
+            break;
+        case SDLK_h: param.ipd_multiplier--; break;
+        case SDLK_l: param.ipd_multiplier++; break;
+        case SDLK_j: param.mesh_radius -= 0.1; break;
+        case SDLK_k: param.mesh_radius += 0.1; break;
+        case SDLK_1:
+        case SDLK_2:
+        case SDLK_3: {
+            param.distortion = (distortion_t)(key - SDLK_1);
+            float half_mesh = param.tv_size / 2;
+            switch(param.distortion) {
+            case DISTORTION_NONE:
+                param.mesh_radius = half_mesh;
                 break;
-            }
-            case SDLK_r: {
-                param.stereo_mode = (stereo_mode_t)(((int)param.stereo_mode + 1) % MAX_STEREO_MODE);
+            case DISTORTION_DOME:
+                param.mesh_radius = sqrt(2 * half_mesh * half_mesh);
                 break;
-            }
-            case SDLK_t: {
-                video.aspect_ratio_mode = (aspect_ratio_mode_t)(((int)video.aspect_ratio_mode+1) % MAX_ASPECT_MODE);
-                switch(video.aspect_ratio_mode) {
-                    case ASPECT_4_BY_3: video.aspect_ratio = 4.f / 3.f; break;
-                    case ASPECT_16_BY_9: video.aspect_ratio = 16.f / 9.f; break;
-                    default:
-                    case ASPECT_AUTO: video.aspect_ratio = video.width / video.height; break;
-                }
+            case DISTORTION_CYLINDER:
+                param.mesh_radius = half_mesh;
                 break;
-            }
-            case SDLK_UP: libvlc_media_player_set_time(vlc_media_player, curtime + seekspeed[0]); break;
-            case SDLK_DOWN: libvlc_media_player_set_time(vlc_media_player, curtime - seekspeed[0]); break;
-            case SDLK_LEFT: libvlc_media_player_set_time(vlc_media_player, curtime - seekspeed[1]); break;
-            case SDLK_RIGHT: libvlc_media_player_set_time(vlc_media_player, curtime + seekspeed[1]); break;
-            case SDLK_PAGEUP: libvlc_media_player_set_time(vlc_media_player, curtime + seekspeed[2]); break;
-            case SDLK_PAGEDOWN: libvlc_media_player_set_time(vlc_media_player, curtime - seekspeed[2]); break;
             default: break;
             }
-            cout << "ipd:" << param.ipd_multiplier << " tsize:" << param.tv_size << "  zoffset:" << param.tv_zoffset << "  mesh_radius:" << param.mesh_radius << endl;
+            break;
+        }
+        case SDLK_p:
+            param.projection = (projection_t)(((int)param.projection + 1) % MAX_PROJECTION);
+            break;
+        case SDLK_c: {
+            if (video.yuv) {
+                // baked into the video texture, the staged frame is converted again
+                param.transfer = (transfer_t)(((int)param.transfer + 1) % MAX_TRANSFER);
+                log_info("transfer: %s", transfer_names[param.transfer]);
+                ReuploadFrame();
+            } else {
+                param.colorspace = (colorspace_t)(((int)param.colorspace + 1) % MAX_COLORSPACE);
+            }
+            break;
+        }
+        case SDLK_r: {
+            param.stereo_mode = (stereo_mode_t)(((int)param.stereo_mode + 1) % MAX_STEREO_MODE);
+            param.stereo_auto = false;
+            ReuploadFrame(); // the crop depends on the stereo split
+            break;
+        }
+        case SDLK_t: {
+            video.aspect_ratio_mode = (aspect_ratio_mode_t)(((int)video.aspect_ratio_mode+1) % MAX_ASPECT_MODE);
+            switch(video.aspect_ratio_mode) {
+                case ASPECT_4_BY_3: video.aspect_ratio = 4.f / 3.f; break;
+                case ASPECT_16_BY_9: video.aspect_ratio = 16.f / 9.f; break;
+                default:
+                case ASPECT_AUTO: video.aspect_ratio = video.width / video.height; break;
+            }
+            break;
+        }
+        case SDLK_UP: RequestSeek(seekspeed[0]); break;
+        case SDLK_DOWN: RequestSeek(-seekspeed[0]); break;
+        case SDLK_LEFT: RequestSeek(-seekspeed[1]); break;
+        case SDLK_RIGHT: RequestSeek(seekspeed[1]); break;
+        case SDLK_PAGEUP: RequestSeek(seekspeed[2]); break;
+        case SDLK_PAGEDOWN: RequestSeek(-seekspeed[2]); break;
+        default: break;
+        }
+        {
+            char status[256];
+            snprintf(status, sizeof status, "ipd:%g tsize:%g  zoffset:%g  mesh_radius:%g  projection:%s",
+                    param.ipd_multiplier, param.tv_size, param.tv_zoffset, param.mesh_radius,
+                    projection_names[param.projection]);
+            log_info("%s", status);
+            SetStatus(status);
+        }
 
 #ifdef OVR_ENABLED
-            // jdt: grr this damn oculus safety screen won't go away.
-            ovrHmd_DismissHSWDisplay(hmd);
+        // jdt: grr this damn oculus safety screen won't go away.
+        ovrHmd_DismissHSWDisplay(hmd);
 #endif
-            break;
+        break;
 
-        case SDL_QUIT:
-            quit = true;
-            break;
+    case SDL_QUIT:
+        quit = true;
+        break;
+    }
+}
+
+void PollEvent()
+{
+    SDL_Event event;
+
+    while (SDL_PollEvent (&event)) {
+        bool is_key = event.type == SDL_KEYDOWN || event.type == SDL_KEYUP;
+
+        // while replaying, input comes from the trace. ESC still quits.
+        if (is_key && trace_is_replaying() && event.key.keysym.sym != SDLK_ESCAPE)
+            continue;
+
+        if (is_key && trace_is_recording()) {
+            trace_event ev;
+            ev.frame = frame_index;
+            ev.ticks = SDL_GetTicks();
+            ev.type = event.type;
+            ev.sym = event.key.keysym.sym;
+            ev.mod = event.key.keysym.mod;
+            ev.repeat = event.key.repeat;
+            trace_write_event(&ev);
         }
+
+        HandleEvent(event);
+    }
+
+    trace_event ev;
+    while (trace_next_event(frame_index, &ev)) {
+        if (ev.type == TRACE_SEEK_COMMIT) {
+            seek.replayed = true;
+            continue;
+        }
+        memset(&event, 0, sizeof event);
+        event.type = ev.type;
+        event.key.keysym.sym = ev.sym;
+        event.key.keysym.mod = ev.mod;
+        event.key.repeat = ev.repeat;
+        event.key.state = ev.type == SDL_KEYDOWN ? SDL_PRESSED : 0;
+        HandleEvent(event);
     }
 }
 
@@ -1280,8 +4118,40 @@ void printUsage(int argc, char *argv[])
     cerr << "\t\tChange during playback with numeric keys 1-3." << endl;
     cerr << "\t-s[1-3] Sets stereo mode (1=None,2=SBS,3=Over/Under)" << endl;
     cerr << "\t\tCycle modes during playback with the 'r' key." << endl;
+    cerr << "\t-p[1-3] Sets projection (1=Screen,2=Cubemap 3x2,3=EAC 3x2)" << endl;
+    cerr << "\t\tCycle projections during playback with the 'p' key." << endl;
     cerr << "\t-f Startup fullscreen on Oculus Rift (only valid in extended mode)." << endl;
     cerr << "\t\tUse F2 or F9 to toggle video to rift during playback." << endl;
+    cerr << "\t-m Draw 2D video on the flat screen once for both eyes." << endl;
+    cerr << "\t-E <inner>[,<scale>] Draw only the inner share of each eye at full density, the rest at scale (default 0.5,0.5)." << endl;
+    cerr << "\t\tToggle during playback with the 'e' key." << endl;
+    cerr << "\t-P Disable the thumbnail strip shown while seeking." << endl;
+    cerr << "\t-C Use an OpenGL 3.3 core profile context and render path." << endl;
+    cerr << "\t-L Don't re-sample the head pose right before drawing." << endl;
+    cerr << "\t-t <file> Record head poses, key input and media position to a trace." << endl;
+    cerr << "\t-T <file> Replay a trace instead of the HMD pose and keyboard." << endl;
+    cerr << "\t\tEvery frame is decoded and shown at its recorded media position, not with -R." << endl;
+    cerr << "\t-o <file> Capture the eye buffer to a .y4m stream, numbered .png files or raw BGRA." << endl;
+    cerr << "\t-O <n> Capture every nth frame only (default 1)." << endl;
+    cerr << "\t-F <font> TrueType font for the in-headset overlay." << endl;
+    cerr << "\t-S <file> Show .srt subtitles on the overlay (default: <video>.srt if present)." << endl;
+    cerr << "\t-D Client-side distortion: draw the video straight to the HMD backbuffer." << endl;
+    cerr << "\t-H Upload only the tiles that changed, skip identical frames." << endl;
+    cerr << "\t-U Upload video frames on the render thread, not on a thread of their own." << endl;
+    cerr << "\t-B Clear and post process the whole eye buffer, not just the drawn bounds." << endl;
+    cerr << "\t-A Don't detect black bars and the stereo layout." << endl;
+    cerr << "\t-R <file> Render every frame offline to a file (as -o) as fast as possible." << endl;
+    cerr << "\t-Y <file> Camera path for -R: lines of <seconds> <yaw> <pitch> <roll> in degrees." << endl;
+    cerr << "\t-M <socket> Serve Prometheus metrics on a Unix domain socket." << endl;
+    cerr << "\t-I <vlc|mmap|readahead> How the video file is read (default vlc)." << endl;
+    cerr << "\t-W <MB> Read ahead window for -I mmap and readahead (default 64)." << endl;
+    cerr << "\t-K <MB>[,raw|lz4|gpu] Loop the video, after the first pass from a frame cache of MB." << endl;
+    cerr << "\t-Q Cap HLS/DASH renditions to what the screen shows and the machine keeps up with." << endl;
+    cerr << "\t-b <sdr|pq|hlg> Decode 10 bit video to YUV and convert it on the GPU, tone mapping PQ or HLG." << endl;
+    cerr << "\t\tCycle transfers during playback with the 'c' key." << endl;
+    cerr << "\t-r <fps>[,MB[,workers]] Play <video-filename>, a directory of .png, .dpx or .ppm frames," << endl;
+    cerr << "\t\tat fps from a decoded frame cache of MB (default 24,2048, the core count less one workers)." << endl;
+    cerr << "\t-X <image.ppm> Build a panorama tile pyramid into <video-filename> and exit." << endl;
 }
 
 int main(int argc, char *argv[])
@@ -1291,17 +4161,39 @@ int main(int argc, char *argv[])
         return 1;
     }
     string basename; // filename of input
+    const char *pano_source = 0; // -X, image to build a tile pyramid from
 
     quit = false;
     frame_index = 0;
     param.stereo_mode = STEREO_NONE;
     param.distortion = DISTORTION_NONE;
+    param.projection = PROJECTION_SCREEN;
+    param.colorspace = COLORSPACE_RGB;
     param.fullscreen = false;
     param.view_locked = false;
+    param.core_profile = false;
+    param.late_latch = true;
+    param.analyze = true;
+    param.scissor = true;
+    param.stereo_auto = true;
+    param.dirty_tiles = false;
+    param.high_depth = false;
+    param.transfer = TRANSFER_SDR;
+    param.capture_path = 0;
+    param.capture_interval = 1;
+    param.font_path = OVERLAY_DEFAULT_FONT;
+    param.subtitle_path = 0;
+    param.io_backend = MEDIAIO_VLC;
+    param.io_window = MEDIAIO_DEFAULT_WINDOW;
+    thumb.enabled = true;
+    uploader.enabled = true;
+    loop.enabled = false;
+    loop.shown = -1;
+    loop.step = -1;
 
     int c;
     opterr = 0;
-    while ((c = getopt(argc, argv, "fvd:s:")) != -1) {
+    while ((c = getopt(argc, argv, "fvmPCLABDUHQd:s:p:t:T:o:O:F:S:R:Y:M:X:I:W:K:b:r:E:")) != -1) {
         switch(c) {
         case 'f': param.fullscreen = true; break;
         case 'd': {
@@ -1317,10 +4209,102 @@ int main(int argc, char *argv[])
                 param.stereo_mode = STEREO_NONE;
             else
                 param.stereo_mode = (stereo_mode_t)(istereo-1);
+            param.stereo_auto = false;
+        } break;
+        case 'p': {
+            int iprojection = atoi(optarg);
+            if (iprojection < 1 || iprojection > (int)MAX_PROJECTION)
+                param.projection = PROJECTION_SCREEN;
+            else
+                param.projection = (projection_t)(iprojection-1);
         } break;
         case 'v': param.view_locked = true; break;
+        case 'm': mono.enabled = true; break;
+        case 'E': {
+            int n = sscanf(optarg, "%f,%f", &fovea.inner, &fovea.scale);
+            if (n < 1 || fovea.inner <= 0 || fovea.inner > 1 || fovea.scale <= 0 || fovea.scale > 1) {
+                fprintf(stderr, "Invalid foveation `%s'.\n", optarg);
+                printUsage(argc, argv);
+                return 1;
+            }
+            fovea.enabled = true;
+        } break;
+        case 'P': thumb.enabled = false; break;
+        case 'C': param.core_profile = true; break;
+        case 'L': param.late_latch = false; break;
+        case 'A': param.analyze = false; break;
+        case 'B': param.scissor = false; break;
+        case 'D': lens.enabled = true; break;
+        case 'U': uploader.enabled = false; break;
+        case 'H': param.dirty_tiles = true; break;
+        case 'Q': rendition.enabled = true; break;
+        case 't':
+            if (!trace_record(optarg))
+                return 1;
+            break;
+        case 'T':
+            if (!trace_replay(optarg))
+                return 1;
+            break;
+        case 'o': param.capture_path = optarg; break;
+        case 'O': param.capture_interval = atoi(optarg); break;
+        case 'F': param.font_path = optarg; break;
+        case 'S': param.subtitle_path = optarg; break;
+        case 'R':
+            offline.enabled = true;
+            offline.path = optarg;
+            break;
+        case 'Y':
+            if (!posepath_load(optarg))
+                return 1;
+            break;
+        case 'M':
+            if (!metrics_open(optarg))
+                return 1;
+            break;
+        case 'X': pano_source = optarg; break;
+        case 'I':
+            if (!mediaio_parse_backend(optarg, &param.io_backend)) {
+                fprintf(stderr, "Unknown I/O backend `%s'.\n", optarg);
+                printUsage(argc, argv);
+                return 1;
+            }
+            break;
+        case 'W': param.io_window = (size_t)max(1, atoi(optarg)) << 20; break;
+        case 'K':
+            if (!framecache_parse(optarg, &loop.budget, &loop.storage)) {
+                fprintf(stderr, "Invalid frame cache `%s'.\n", optarg);
+                printUsage(argc, argv);
+                return 1;
+            }
+            loop.enabled = true;
+            break;
+        case 'r':
+            if (!imageseq_parse(optarg, &sequence.fps, &sequence.budget, &sequence.workers)) {
+                fprintf(stderr, "Invalid image sequence rate `%s'.\n", optarg);
+                printUsage(argc, argv);
+                return 1;
+            }
+            sequence.enabled = true;
+            break;
+        case 'b': {
+            int t = 0;
+            while (t < MAX_TRANSFER && strcmp(optarg, transfer_names[t]))
+                t++;
+            if (t == MAX_TRANSFER) {
+                fprintf(stderr, "Unknown transfer `%s'.\n", optarg);
+                printUsage(argc, argv);
+                return 1;
+            }
+            param.high_depth = true;
+            param.transfer = (transfer_t)t;
+        } break;
         case '?':
-            if (optopt == 'd' || optopt == 'c')
+            if (optopt == 'd' || optopt == 's' || optopt == 'p' || optopt == 't' ||
+                    optopt == 'T' || optopt == 'o' || optopt == 'O' || optopt == 'F' || optopt == 'S' ||
+                    optopt == 'R' || optopt == 'Y' || optopt == 'M' || optopt == 'X' ||
+                    optopt == 'I' || optopt == 'W' || optopt == 'K' || optopt == 'b' || optopt == 'r' ||
+                    optopt == 'E')
                 fprintf(stderr, "Option -%c requires an argument.\n", optopt);
             else if (isprint (optopt))
                 fprintf(stderr, "Unknown option `-%c'.\n", optopt);
@@ -1337,15 +4321,149 @@ int main(int argc, char *argv[])
         return -1;
     }
     basename = argv[argc-1];
+
+    if (pano_source)
+        return pano_build(pano_source, basename.c_str()) ? 0 : 1;
+    panorama.enabled = pano_open(basename.c_str());
+    if (panorama.enabled) {
+        thumb.enabled = false;
+        param.analyze = false;
+        if (offline.enabled) {
+            cerr << "-R renders videos only." << endl;
+            return 1;
+        }
+        if (lens.enabled) {
+            cerr << "-D is ignored for panoramas." << endl;
+            lens.enabled = false;
+        }
+        loop.enabled = false;
+    }
+
+    bool is_sequence = !panorama.enabled && imageseq_is_sequence(basename.c_str());
+    if (sequence.enabled && !is_sequence)
+        cerr << "-r plays a directory of frames, ignored." << endl;
+    sequence.enabled = is_sequence;
+    if (sequence.enabled) {
+        if (offline.enabled) {
+            cerr << "-R renders videos only." << endl;
+            return 1;
+        }
+        if (loop.enabled) {
+            cerr << "-K is ignored for image sequences, they play from a frame cache of their own." << endl;
+            loop.enabled = false;
+        }
+        if (param.high_depth) {
+            cerr << "-b is ignored for image sequences, frames are decoded to BGRA." << endl;
+            param.high_depth = false;
+        }
+        thumb.enabled = false;
+        if (!imageseq_open(basename.c_str(), sequence.fps, sequence.budget, sequence.workers))
+            return 1;
+    }
+
+    if (strstr(basename.c_str(), "://")) {
+        // a second session on the stream just for thumbnails isn't worth it
+        thumb.enabled = false;
+    } else if (rendition.enabled) {
+        cerr << "-Q applies to adaptive streams (http://.../master.m3u8 or .mpd), ignored." << endl;
+        rendition.enabled = false;
+    }
+    if (trace_is_replaying() && offline.enabled) {
+        cerr << "-T can't be used with -R, offline renders once per decoded frame and a trace once per HMD frame." << endl;
+        return 1;
+    }
+    replay.enabled = trace_is_replaying() && !panorama.enabled && !sequence.enabled;
+    if (replay.enabled && loop.enabled) {
+        cerr << "-K is ignored with -T, a replay decodes every frame." << endl;
+        loop.enabled = false;
+    }
+    if (rendition.enabled && (loop.enabled || offline.enabled || replay.enabled)) {
+        cerr << "-Q is ignored with -K, -R and -T." << endl;
+        rendition.enabled = false;
+    }
+
+    if (lens.enabled && fovea.enabled) {
+        cerr << "-E is ignored with -D, there is no eye buffer to draw at two densities." << endl;
+        fovea.enabled = false;
+    }
+    if (lens.enabled && param.projection != PROJECTION_SCREEN) {
+        cerr << "-D draws the screen only, ignored with -p." << endl;
+        lens.enabled = false;
+    }
+
+    if (offline.enabled || replay.enabled || panorama.enabled)
+        uploader.enabled = false;
+    if (offline.enabled) {
+        thumb.enabled = false;
+        if (param.capture_path) {
+            cerr << "-o is ignored when rendering offline with -R." << endl;
+            param.capture_path = 0;
+        }
+        if (lens.enabled) {
+            cerr << "-D is ignored when rendering offline with -R." << endl;
+            lens.enabled = false;
+        }
+        if (loop.enabled) {
+            cerr << "-K is ignored when rendering offline with -R." << endl;
+            loop.enabled = false;
+        }
+    }
+    if (param.high_depth) {
+        if (param.dirty_tiles) {
+            cerr << "-H is ignored with -b." << endl;
+            param.dirty_tiles = false;
+        }
+        if (loop.enabled && loop.storage == FRAMECACHE_GPU) {
+            cerr << "-K keeps frames in memory with -b, the GPU holds BGRA only." << endl;
+            loop.storage = FRAMECACHE_RAW;
+        }
+    }
     cout << "Reading video from: " << basename << endl;
+    // from here on nothing the player runs waits for the console
+    log_open();
 
     setDefaults();
     Init();
+    if (param.high_depth && !GLEW_ARB_texture_rg && !GLEW_VERSION_3_0) {
+        cerr << "-b needs 16 bit red textures (GL_ARB_texture_rg), decoding to RV32." << endl;
+        param.high_depth = false;
+    }
+    if (panorama.enabled && !InitPano())
+        return 1;
 
-    const char * const vlc_args[] = {
-        "-I", "dummy", "--ignore-config"
-    };
-    vlc = libvlc_new(sizeof(vlc_args) / sizeof(*vlc_args), vlc_args);
+#ifdef OVR_ENABLED
+    if (param.capture_path) {
+        if (!GLEW_ARB_pixel_buffer_object || !GLEW_ARB_sync)
+            cerr << "Capture needs pixel buffer objects and fences, disabled." << endl;
+        else if (!capture_open(param.capture_path, param.capture_interval, CAPTURE_FPS, false))
+            return 1;
+    }
+#endif
+
+    // Subtitles the overlay can show are drawn there, not blended by VLC into
+    // every decoded frame on the CPU.  Tracks muxed into the file can't be
+    // read as text through libvlc and are still blended.
+    if (param.subtitle_path) {
+        if (!subtitles_load(param.subtitle_path))
+            cerr << "Failed to read subtitles from " << param.subtitle_path << endl;
+    } else {
+        subtitles_load((basename.substr(0, basename.find_last_of('.')) + ".srt").c_str());
+    }
+
+    const char *vlc_args[8];
+    int vlc_argc = 0;
+    vlc_args[vlc_argc++] = "-I";
+    vlc_args[vlc_argc++] = "dummy";
+    vlc_args[vlc_argc++] = "--ignore-config";
+    vlc_args[vlc_argc++] = subtitles_count() && overlay.enabled ?
+        "--no-sub-autodetect-file" : "--sub-autodetect-file";
+    if (offline.enabled || replay.enabled) {
+        // every frame, no clock to keep up with
+        vlc_args[vlc_argc++] = "--no-audio";
+        vlc_args[vlc_argc++] = "--no-drop-late-frames";
+        vlc_args[vlc_argc++] = "--no-skip-frames";
+    }
+    vlc = libvlc_new(vlc_argc, vlc_args);
     if (!vlc) {
         cerr << "Failed to Create VLC Instance" << endl;
         return -1;
@@ -1353,34 +4471,136 @@ int main(int argc, char *argv[])
 
     vlc_media_player = libvlc_media_player_new(vlc);
     vlc_event_manager = libvlc_media_player_event_manager(vlc_media_player);
-    vlc_media = libvlc_media_new_path (vlc, basename.c_str());
-    libvlc_media_player_set_media (vlc_media_player, vlc_media);
-
-    libvlc_media_player_play (vlc_media_player);
-
-    while(!quit && libvlc_media_player_get_state(vlc_media_player) < libvlc_Playing) {
-        PollEvent();
-    }
+    // a panorama only uses the player for the key handling, it stays empty
+    if (sequence.enabled) {
+        video.width = imageseq_width();
+        video.height = imageseq_height();
+        UpdateVideoTarget(video.width, video.height);
+        if (param.analyze)
+            analyze_start();
+        if (uploader.enabled)
+            StartUploader();
+        imageseq_start(DeliverSequenceFrame);
+        video.aspect_ratio = (float)video.width / video.height;
+    } else if (!panorama.enabled) {
+        vlc_media = mediaio_media_new(vlc, basename.c_str(), param.io_backend, param.io_window);
+        libvlc_media_player_set_media (vlc_media_player, vlc_media);
+
+        libvlc_media_player_play (vlc_media_player);
+
+        while(!quit && libvlc_media_player_get_state(vlc_media_player) < libvlc_Playing) {
+            PollEvent();
+        }
 
-    libvlc_video_get_size(vlc_media_player, 0, &video.width, &video.height);
-    UpdateVideoTarget(video.width, video.height);
+        libvlc_video_get_size(vlc_media_player, 0, &video.width, &video.height);
+        UpdateVideoTarget(video.width, video.height);
+        rendition.enabled = rendition.enabled && video.height > 0;
+        if (rendition.enabled) {
+            rendition.width = video.width;
+            rendition.height = video.height;
+            abr_init(SDL_GetTicks());
+        }
+        InitThumbnails(basename.c_str());
 
 #ifdef USE_RV16
-    libvlc_video_set_format (vlc_media_player, "RV16", video.width, video.height, video.width*(video.bpp/8));
+        libvlc_video_set_format (vlc_media_player, "RV16", video.width, video.height, video.width*(video.bpp/8));
 #else
-    libvlc_video_set_format (vlc_media_player, "RV32", video.width, video.height, video.width*(video.bpp/8));
+        if (param.high_depth)
+            libvlc_video_set_format_callbacks(vlc_media_player, format_setup, format_cleanup);
+        else
+            libvlc_video_set_format (vlc_media_player, "RV32", video.width, video.height, video.width*(video.bpp/8));
 #endif
-    libvlc_video_set_callbacks (vlc_media_player, lock, unlock, display, NULL);
+        if (offline.enabled) {
+            offline.fps = libvlc_media_player_get_fps(vlc_media_player);
+            if (offline.fps <= 0)
+                offline.fps = OFFLINE_DEFAULT_FPS;
+            offline.cond = SDL_CreateCond();
+            if (!capture_open(offline.path, 1, offline.fps, true))
+                return 1;
+            libvlc_media_player_set_rate(vlc_media_player, OFFLINE_RATE);
+            offline.start = SDL_GetTicks();
+        }
+        if (replay.enabled) {
+            replay.fps = libvlc_media_player_get_fps(vlc_media_player);
+            if (replay.fps <= 0)
+                replay.fps = OFFLINE_DEFAULT_FPS;
+            offline.cond = SDL_CreateCond();
+        }
+        if (param.analyze)
+            analyze_start();
+        if (uploader.enabled)
+            StartUploader();
+        if (loop.enabled) {
+            framecache_init(loop.budget, loop.storage);
+            ResetFrameCache();
+            loop.filling = true;
+        }
+        libvlc_video_set_callbacks (vlc_media_player, lock, unlock, display, NULL);
 
-    video.aspect_ratio = video.width / video.height;
+        video.aspect_ratio = video.width / video.height;
+    }
 
-    while(!quit && libvlc_media_player_get_state(vlc_media_player) != libvlc_Ended) {
+    while(!quit && (loop.enabled || libvlc_media_player_get_state(vlc_media_player) != libvlc_Ended)) {
         PollEvent();
-        if (video.updateFrame)
+        UpdateSeek();
+        UpdateAnalysis();
+        if (offline.enabled && !WaitOfflineFrame())
+            continue;
+        if (loop.enabled)
+            UpdateLoop();
+        UpdateRendition();
+        if (loop.gpu_frame) {
+            // drawn straight from the cached texture
+        } else if (replay.enabled) {
+            if (!ReplayFrames())
+                metrics_repeated();
+        } else if (uploader.enabled) {
+            if (!AcquireUploadedTexture())
+                metrics_repeated();
+        } else if (video.updateFrame || video.reupload) {
             LoadVideoTexture();
+        } else if (!panorama.enabled) {
+            metrics_repeated();
+        }
         RenderFrame();
+        metrics_frame();
+        offline.frames++;
+    }
+
+    if (offline.enabled) {
+        // the last frame may have arrived with the end of the stream
+        if (!quit && video.updateFrame) {
+            LoadVideoTexture();
+            RenderFrame();
+            offline.frames++;
+        }
+        float seconds = (SDL_GetTicks() - offline.start) / 1000.0f;
+        float fps = seconds > 0 ? offline.frames / seconds : 0;
+        printf("offline: %u frames in %.1fs, %.1f fps, %.2fx realtime (source %.2f fps)\n",
+                offline.frames, seconds, fps, fps / offline.fps, offline.fps);
+    }
+
+    if (thumb.player)
+        libvlc_media_player_stop(thumb.player);
+    imageseq_close();
+    analyze_stop();
+    StopUploader();
+    log_close();
+
+    if (param.console_dump) {
+        mem_report(stdout);
+        mediaio_report(stdout);
+        framecache_report(stdout);
+        if (rendition.enabled)
+            abr_report(stdout);
+        if (sequence.enabled)
+            imageseq_report(stdout);
     }
 
+    trace_close();
+    capture_close();
+    metrics_close();
+
 #ifdef OVR_ENABLED
     ovrHmd_Destroy(hmd);
 #endif
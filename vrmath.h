@@ -0,0 +1,142 @@
+#ifndef VRMATH_H
+#define VRMATH_H
+
+// Small matrix/quaternion helpers for the per-frame eye matrices.
+//
+// Matrices are column-major like OpenGL and 16 byte aligned so the columns
+// load straight into SSE registers; without SSE the plain loops are simple
+// enough for the compiler to vectorize.
+
+#include <cmath>
+#include <cstring>
+
+#ifdef __SSE__
+# include <xmmintrin.h>
+#endif
+
+struct mat4 {
+    float m[16];
+} __attribute__((aligned(16)));
+
+static inline void mat4_identity(mat4 *out)
+{
+    memset(out->m, 0, sizeof out->m);
+    out->m[0] = out->m[5] = out->m[10] = out->m[15] = 1.0f;
+}
+
+// out = a * b, out may alias either input.
+static inline void mat4_mul(const mat4 *a, const mat4 *b, mat4 *out)
+{
+    mat4 r;
+#ifdef __SSE__
+    __m128 c0 = _mm_load_ps(&a->m[0]);
+    __m128 c1 = _mm_load_ps(&a->m[4]);
+    __m128 c2 = _mm_load_ps(&a->m[8]);
+    __m128 c3 = _mm_load_ps(&a->m[12]);
+    for (int i = 0; i < 4; i++) {
+        __m128 col = _mm_mul_ps(c0, _mm_set1_ps(b->m[i*4 + 0]));
+        col = _mm_add_ps(col, _mm_mul_ps(c1, _mm_set1_ps(b->m[i*4 + 1])));
+        col = _mm_add_ps(col, _mm_mul_ps(c2, _mm_set1_ps(b->m[i*4 + 2])));
+        col = _mm_add_ps(col, _mm_mul_ps(c3, _mm_set1_ps(b->m[i*4 + 3])));
+        _mm_store_ps(&r.m[i*4], col);
+    }
+#else
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            r.m[i*4 + j] = a->m[0*4 + j] * b->m[i*4 + 0]
+                         + a->m[1*4 + j] * b->m[i*4 + 1]
+                         + a->m[2*4 + j] * b->m[i*4 + 2]
+                         + a->m[3*4 + j] * b->m[i*4 + 3];
+        }
+    }
+#endif
+    *out = r;
+}
+
+// out = m * translate(x, y, z), the equivalent of glTranslatef
+static inline void mat4_translate(mat4 *m, float x, float y, float z)
+{
+    for (int j = 0; j < 4; j++)
+        m->m[12 + j] += m->m[j] * x + m->m[4 + j] * y + m->m[8 + j] * z;
+}
+
+// out = m * scale(x, y, z), the equivalent of glScalef
+static inline void mat4_scale(mat4 *m, float x, float y, float z)
+{
+    for (int j = 0; j < 4; j++) {
+        m->m[j] *= x;
+        m->m[4 + j] *= y;
+        m->m[8 + j] *= z;
+    }
+}
+
+// libovr matrices are row-major
+static inline void mat4_from_rows(const float rows[4][4], mat4 *out)
+{
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++)
+            out->m[i*4 + j] = rows[j][i];
+    }
+}
+
+// View rotation for an orientation quaternion (x, y, z, w): the inverse of
+// the head rotation.  Same layout as John Tsiombikas' public domain
+// quat_to_matrix() the fixed-function path used to multiply in.
+static inline void mat4_view_rotation(const float *quat, mat4 *mat)
+{
+    float x = quat[0], y = quat[1], z = quat[2], w = quat[3];
+
+    mat->m[0] = 1.0f - 2.0f * y * y - 2.0f * z * z;
+    mat->m[4] = 2.0f * x * y + 2.0f * w * z;
+    mat->m[8] = 2.0f * z * x - 2.0f * w * y;
+    mat->m[12] = 0.0f;
+
+    mat->m[1] = 2.0f * x * y - 2.0f * w * z;
+    mat->m[5] = 1.0f - 2.0f * x * x - 2.0f * z * z;
+    mat->m[9] = 2.0f * y * z + 2.0f * w * x;
+    mat->m[13] = 0.0f;
+
+    mat->m[2] = 2.0f * z * x + 2.0f * w * y;
+    mat->m[6] = 2.0f * y * z - 2.0f * w * x;
+    mat->m[10] = 1.0f - 2.0f * x * x - 2.0f * y * y;
+    mat->m[14] = 0.0f;
+
+    mat->m[3] = mat->m[7] = mat->m[11] = 0.0f;
+    mat->m[15] = 1.0f;
+}
+
+// transform a point (w = 1), returns the homogeneous result in out[4]
+static inline void mat4_transform(const mat4 *m, float x, float y, float z, float *out)
+{
+    for (int j = 0; j < 4; j++)
+        out[j] = m->m[j] * x + m->m[4 + j] * y + m->m[8 + j] * z + m->m[12 + j];
+}
+
+// inverse of a matrix without projection (last row 0 0 0 1), scale allowed
+static inline void mat4_affine_inverse(const mat4 *a, mat4 *out)
+{
+    const float *m = a->m;
+    float c00 = m[5] * m[10] - m[9] * m[6];
+    float c01 = m[9] * m[2] - m[1] * m[10];
+    float c02 = m[1] * m[6] - m[5] * m[2];
+    float det = m[0] * c00 + m[4] * c01 + m[8] * c02;
+    float k = det != 0.0f ? 1.0f / det : 0.0f;
+    mat4 r;
+
+    r.m[0] = c00 * k;
+    r.m[1] = c01 * k;
+    r.m[2] = c02 * k;
+    r.m[4] = (m[8] * m[6] - m[4] * m[10]) * k;
+    r.m[5] = (m[0] * m[10] - m[8] * m[2]) * k;
+    r.m[6] = (m[4] * m[2] - m[0] * m[6]) * k;
+    r.m[8] = (m[4] * m[9] - m[8] * m[5]) * k;
+    r.m[9] = (m[8] * m[1] - m[0] * m[9]) * k;
+    r.m[10] = (m[0] * m[5] - m[4] * m[1]) * k;
+    r.m[3] = r.m[7] = r.m[11] = 0.0f;
+    for (int j = 0; j < 3; j++)
+        r.m[12 + j] = -(r.m[j] * m[12] + r.m[4 + j] * m[13] + r.m[8 + j] * m[14]);
+    r.m[15] = 1.0f;
+    *out = r;
+}
+
+#endif // VRMATH_H